@@ -351,6 +351,57 @@ int xc_lockprof_query(xc_interface *xch,
     return rc;
 }
 
+static int xc_sched_stats_get(xc_interface *xch, uint32_t cmd,
+                              uint32_t cpu, uint32_t domid, uint32_t vcpu,
+                              uint64_t *buckets, size_t nr)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(buckets, nr * XEN_SYSCTL_SCHED_STATS_BUCKETS *
+                             sizeof(*buckets), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, buckets) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_sched_stats_op;
+    sysctl.u.sched_stats_op.cmd = cmd;
+    sysctl.u.sched_stats_op.cpu = cpu;
+    sysctl.u.sched_stats_op.domid = domid;
+    sysctl.u.sched_stats_op.vcpu = vcpu;
+    set_xen_guest_handle(sysctl.u.sched_stats_op.buckets, buckets);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, buckets);
+
+    return rc;
+}
+
+int xc_sched_stats_get_pcpu(xc_interface *xch, uint32_t cpu,
+                            uint64_t *buckets)
+{
+    return xc_sched_stats_get(xch, XEN_SYSCTL_SCHED_STATS_get_pcpu, cpu,
+                              0, 0, buckets, XEN_SYSCTL_SCHED_STATS_NR);
+}
+
+int xc_sched_stats_get_vcpu(xc_interface *xch, uint32_t domid,
+                            uint32_t vcpu, uint64_t *buckets)
+{
+    return xc_sched_stats_get(xch, XEN_SYSCTL_SCHED_STATS_get_vcpu, 0,
+                              domid, vcpu, buckets,
+                              XEN_SYSCTL_SCHED_STATS_NR_VCPU);
+}
+
+int xc_sched_stats_reset(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_sched_stats_op;
+    sysctl.u.sched_stats_op.cmd = XEN_SYSCTL_SCHED_STATS_reset;
+
+    return do_sysctl(xch, &sysctl);
+}
+
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus)
 {
@@ -156,3 +156,25 @@ int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask)
     return do_sysctl(xch, &sysctl);
 }
 
+
+int xc_tbuf_get_lost(xc_interface *xch, uint64_t *lost)
+{
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(lost, TRC_NR_CLASSES * sizeof(*lost),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+    int ret;
+
+    if ( xc_hypercall_bounce_pre(xch, lost) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_tbuf_op;
+    sysctl.interface_version = XEN_SYSCTL_INTERFACE_VERSION;
+    sysctl.u.tbuf_op.cmd  = XEN_SYSCTL_TBUFOP_get_lost;
+    set_xen_guest_handle(sysctl.u.tbuf_op.lost, lost);
+
+    ret = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, lost);
+
+    return ret;
+}
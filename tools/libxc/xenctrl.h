@@ -826,6 +826,13 @@ xc_sched_arinc653_schedule_get(
     uint32_t cpupool_id,
     struct xen_sysctl_arinc653_schedule *schedule);
 
+int xc_sched_gang_params_set(xc_interface *xch,
+                             uint32_t cpupool_id,
+                             struct xen_sysctl_gang_schedule *schedule);
+int xc_sched_gang_params_get(xc_interface *xch,
+                             uint32_t cpupool_id,
+                             struct xen_sysctl_gang_schedule *schedule);
+
 /**
  * This function sends a trigger to a domain.
  *
@@ -1349,6 +1356,17 @@ int xc_lockprof_query(xc_interface *xch,
                       uint64_t *time,
                       xc_hypercall_buffer_t *data);
 
+/*
+ * Scheduling latency histograms, see XEN_SYSCTL_sched_stats_op.  @buckets
+ * receives XEN_SYSCTL_SCHED_STATS_NR (pcpu) or XEN_SYSCTL_SCHED_STATS_NR_VCPU
+ * (vcpu) arrays of XEN_SYSCTL_SCHED_STATS_BUCKETS counters.
+ */
+int xc_sched_stats_get_pcpu(xc_interface *xch, uint32_t cpu,
+                            uint64_t *buckets);
+int xc_sched_stats_get_vcpu(xc_interface *xch, uint32_t domid,
+                            uint32_t vcpu, uint64_t *buckets);
+int xc_sched_stats_reset(xc_interface *xch);
+
 void *xc_memalign(xc_interface *xch, size_t alignment, size_t size);
 
 /**
@@ -1493,6 +1511,16 @@ int xc_tbuf_set_cpu_mask(xc_interface *xch, uint32_t mask);
 
 int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask);
 
+/**
+ * This function retrieves how many trace records were lost because a
+ * buffer was full since tracing was last enabled, by trace class.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm lost array of TRC_NR_CLASSES counts, indexed by class bit
+ * @return 0 on success, -1 on failure.
+ */
+int xc_tbuf_get_lost(xc_interface *xch, uint64_t *lost);
+
 int xc_domctl(xc_interface *xch, struct xen_domctl *domctl);
 int xc_sysctl(xc_interface *xch, struct xen_sysctl *sysctl);
 
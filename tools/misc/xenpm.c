@@ -68,6 +68,11 @@ void show_help(void)
             "                                     output after CTRL-C or SIGINT or several seconds.\n"
             " enable-turbo-mode     [cpuid]       enable Turbo Mode for processors that support it.\n"
             " disable-turbo-mode    [cpuid]       disable Turbo Mode for processors that support it.\n"
+            " get-sched-latency     [cpuid]       list wakeup/run delay and schedule() time\n"
+            "                                     histograms of CPU <cpuid> or all\n"
+            " get-vcpu-sched-latency <domid> [vcpu] list wakeup/run delay histograms\n"
+            "                                     of a vcpu or all vcpus of a domain\n"
+            " reset-sched-latency                 clear all scheduling latency histograms\n"
             );
 }
 /* wrapper function */
@@ -1134,6 +1139,163 @@ void disable_turbo_mode(int argc, char *argv[])
                 errno, strerror(errno));
 }
 
+static const char *const sched_stats_name[XEN_SYSCTL_SCHED_STATS_NR] = {
+    [XEN_SYSCTL_SCHED_STATS_wakeup]   = "wakeup",
+    [XEN_SYSCTL_SCHED_STATS_delay]    = "run delay",
+    [XEN_SYSCTL_SCHED_STATS_schedule] = "schedule",
+};
+
+/* Upper bound of a histogram bucket, in ns. */
+static uint64_t sched_stats_limit(unsigned int b)
+{
+    return 1ull << (b + 10);
+}
+
+static void print_sched_hist(const char *name, const uint64_t *buckets)
+{
+    static const unsigned int pct[] = { 50, 90, 99 };
+    uint64_t total = 0, sum;
+    unsigned int i, p, last = XEN_SYSCTL_SCHED_STATS_BUCKETS - 1;
+
+    for ( i = 0; i < XEN_SYSCTL_SCHED_STATS_BUCKETS; i++ )
+        total += buckets[i];
+
+    printf("  %-10s %12"PRIu64" samples", name, total);
+    if ( !total )
+    {
+        printf("\n");
+        return;
+    }
+
+    /* Percentiles are only as precise as the (power of two) buckets. */
+    for ( p = 0; p < ARRAY_SIZE(pct); p++ )
+    {
+        for ( i = 0, sum = 0; i < last; i++ )
+        {
+            sum += buckets[i];
+            if ( sum * 100 >= total * pct[p] )
+                break;
+        }
+        if ( i < last )
+            printf(", p%u < %.1fus", pct[p], sched_stats_limit(i) / 1000.0);
+        else
+            printf(", p%u >= %.1fus", pct[p],
+                   sched_stats_limit(last - 1) / 1000.0);
+    }
+    printf("\n");
+
+    for ( i = 0; i < XEN_SYSCTL_SCHED_STATS_BUCKETS; i++ )
+    {
+        if ( !buckets[i] )
+            continue;
+        if ( i < last )
+            printf("    < %12.1fus", sched_stats_limit(i) / 1000.0);
+        else
+            printf("    >=%12.1fus", sched_stats_limit(last - 1) / 1000.0);
+        printf(" %12"PRIu64" %6.2f%%\n", buckets[i],
+               buckets[i] * 100.0 / total);
+    }
+}
+
+static int show_sched_latency_by_cpuid(int cpuid)
+{
+    uint64_t buckets[XEN_SYSCTL_SCHED_STATS_NR]
+                    [XEN_SYSCTL_SCHED_STATS_BUCKETS];
+    unsigned int i;
+
+    if ( xc_sched_stats_get_pcpu(xc_handle, cpuid, &buckets[0][0]) )
+        return -errno;
+
+    printf("cpu id               : %d\n", cpuid);
+    for ( i = 0; i < XEN_SYSCTL_SCHED_STATS_NR; i++ )
+        print_sched_hist(sched_stats_name[i], buckets[i]);
+    printf("\n");
+
+    return 0;
+}
+
+void sched_latency_func(int argc, char *argv[])
+{
+    int cpuid = -1;
+
+    if ( argc > 0 )
+        parse_cpuid(argv[0], &cpuid);
+
+    if ( cpuid < 0 )
+    {
+        int i;
+
+        /* Offline cpus fail with EINVAL and are skipped. */
+        for ( i = 0; i < max_cpu_nr; i++ )
+            show_sched_latency_by_cpuid(i);
+    }
+    else if ( show_sched_latency_by_cpuid(cpuid) )
+        fprintf(stderr, "failed to get scheduling latency of CPU%d (%d - %s)\n",
+                cpuid, errno, strerror(errno));
+}
+
+static int show_sched_latency_by_vcpu(uint32_t domid, uint32_t vcpu)
+{
+    uint64_t buckets[XEN_SYSCTL_SCHED_STATS_NR_VCPU]
+                    [XEN_SYSCTL_SCHED_STATS_BUCKETS];
+    unsigned int i;
+
+    if ( xc_sched_stats_get_vcpu(xc_handle, domid, vcpu, &buckets[0][0]) )
+        return -errno;
+
+    printf("domain %u vcpu %u\n", domid, vcpu);
+    for ( i = 0; i < XEN_SYSCTL_SCHED_STATS_NR_VCPU; i++ )
+        print_sched_hist(sched_stats_name[i], buckets[i]);
+    printf("\n");
+
+    return 0;
+}
+
+void vcpu_sched_latency_func(int argc, char *argv[])
+{
+    xc_dominfo_t info;
+    unsigned int domid, vcpu;
+
+    if ( argc < 1 || argc > 2 || sscanf(argv[0], "%u", &domid) != 1 ||
+         (argc == 2 && sscanf(argv[1], "%u", &vcpu) != 1) )
+    {
+        fprintf(stderr, "Missing or invalid argument(s)\n");
+        exit(EINVAL);
+    }
+
+    if ( argc == 2 )
+    {
+        if ( show_sched_latency_by_vcpu(domid, vcpu) )
+        {
+            fprintf(stderr, "failed to get scheduling latency of d%uv%u "
+                    "(%d - %s)\n", domid, vcpu, errno, strerror(errno));
+            exit(errno);
+        }
+        return;
+    }
+
+    if ( xc_domain_getinfo(xc_handle, domid, 1, &info) != 1 ||
+         info.domid != domid )
+    {
+        fprintf(stderr, "failed to get info of domain %u\n", domid);
+        exit(ESRCH);
+    }
+
+    /* Vcpus which were never brought up fail with ENOENT. */
+    for ( vcpu = 0; vcpu <= info.max_vcpu_id; vcpu++ )
+        show_sched_latency_by_vcpu(domid, vcpu);
+}
+
+void reset_sched_latency_func(int argc, char *argv[])
+{
+    if ( argc )
+        fprintf(stderr, "Ignoring argument(s)\n");
+
+    if ( xc_sched_stats_reset(xc_handle) )
+        fprintf(stderr, "failed to reset scheduling latency (%d - %s)\n",
+                errno, strerror(errno));
+}
+
 struct {
     const char *name;
     void (*function)(int argc, char *argv[]);
@@ -1156,6 +1318,9 @@ struct {
     { "set-max-cstate", set_max_cstate_func},
     { "enable-turbo-mode", enable_turbo_mode },
     { "disable-turbo-mode", disable_turbo_mode },
+    { "get-sched-latency", sched_latency_func },
+    { "get-vcpu-sched-latency", vcpu_sched_latency_func },
+    { "reset-sched-latency", reset_sched_latency_func },
 };
 
 int main(int argc, char *argv[])
@@ -0,0 +1,246 @@
+/*
+ * barrier-latency.c
+ *
+ * Barrier latency of a multi-threaded, spin-synchronised workload, as
+ * seen inside a guest.  One thread per vcpu does a fixed amount of work
+ * and then waits at a spinning barrier, in a loop.  For each round, the
+ * release latency is the time from the last thread arriving at the
+ * barrier to the last thread leaving it, and the round time the time
+ * between two consecutive releases.  When all vcpus run, both stay close
+ * to the cache line transfer time and the work time respectively; when a
+ * vcpu gets descheduled, every other vcpu spins until it runs again.
+ *
+ * To compare co-scheduling with independent scheduling, run a guest with
+ * as many vcpus as the pool has pcpus next to a cpu-bound one of the same
+ * size, once in a credit pool and once in a gang one:
+ *
+ *   xl cpupool-create 'name="gang"' 'sched="gang"' 'cpus=["4-7"]'
+ *   (start both guests in the pool, a cpu hog in the second one)
+ *   barrier-latency -t 4            (in the first guest)
+ *
+ * With the credit scheduler, the release latency tail is made of whole
+ * timeslices of the other guest.  With gang scheduling it is not, and
+ * the cost moves to rounds straddling the switch between the two gangs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHELINE 64
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__ ( "pause" ::: "memory" )
+#else
+#define cpu_relax() __asm__ __volatile__ ( "" ::: "memory" )
+#endif
+
+struct barrier {
+    volatile unsigned int count;
+    volatile unsigned int sense;
+    volatile uint64_t release_ns;
+} __attribute__((__aligned__(CACHELINE)));
+
+static struct barrier barrier;
+static unsigned int nr_threads;
+static unsigned long rounds = 100000;
+static unsigned int work_ns = 10000;
+
+/* Per round: release latency (max over threads) and round time. */
+static uint64_t *release;
+static uint64_t *round_ns;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads] [-r rounds] [-w work_ns]\n"
+            "  -t threads     threads, one per vcpu (default: online cpus)\n"
+            "  -r rounds      barrier rounds (default 100000)\n"
+            "  -w work_ns     work between barriers (default 10000)\n",
+            prog);
+    exit(2);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void work(void)
+{
+    uint64_t end = now_ns() + work_ns;
+
+    while ( now_ns() < end )
+        ;
+}
+
+static void atomic_max(uint64_t *p, uint64_t val)
+{
+    uint64_t old = *p;
+
+    while ( old < val )
+    {
+        uint64_t prev = __sync_val_compare_and_swap(p, old, val);
+
+        if ( prev == old )
+            break;
+        old = prev;
+    }
+}
+
+/* Sense-reversing spin barrier. */
+static void barrier_wait(unsigned int *local_sense, unsigned long round)
+{
+    uint64_t t;
+
+    *local_sense = !*local_sense;
+
+    if ( __sync_add_and_fetch(&barrier.count, 1) == nr_threads )
+    {
+        barrier.count = 0;
+        barrier.release_ns = now_ns();
+        __sync_synchronize();
+        barrier.sense = *local_sense;
+    }
+    else
+        while ( barrier.sense != *local_sense )
+            cpu_relax();
+
+    __sync_synchronize();
+    t = now_ns();
+    atomic_max(&release[round], t - barrier.release_ns);
+}
+
+static void *thread_fn(void *arg)
+{
+    unsigned int id = (unsigned long)arg, sense = 0;
+    uint64_t last = 0;
+    unsigned long i;
+
+    for ( i = 0; i < rounds; i++ )
+    {
+        work();
+        barrier_wait(&sense, i);
+
+        if ( id == 0 )
+        {
+            if ( i )
+                round_ns[i] = barrier.release_ns - last;
+            last = barrier.release_ns;
+        }
+    }
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, uint64_t *samples, size_t nr)
+{
+    static const double pct[] = { 50, 90, 99, 99.9, 99.99 };
+    uint64_t sum = 0;
+    unsigned int i;
+
+    qsort(samples, nr, sizeof(*samples), cmp_u64);
+    for ( i = 0; i < nr; i++ )
+        sum += samples[i];
+
+    printf("%-8s mean %9.1fus", name, sum / 1000.0 / nr);
+    for ( i = 0; i < sizeof(pct) / sizeof(pct[0]); i++ )
+        printf(", p%g %9.1fus", pct[i],
+               samples[(size_t)((nr - 1) * pct[i] / 100)] / 1000.0);
+    printf(", max %9.1fus\n", samples[nr - 1] / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t *threads;
+    uint64_t start, elapsed;
+    unsigned long i;
+    int c;
+
+    nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ( (c = getopt(argc, argv, "t:r:w:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 't': nr_threads = strtoul(optarg, NULL, 0); break;
+        case 'r': rounds = strtoul(optarg, NULL, 0); break;
+        case 'w': work_ns = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( nr_threads < 2 || rounds < 2 )
+        usage(argv[0]);
+
+    threads = calloc(nr_threads, sizeof(*threads));
+    release = calloc(rounds, sizeof(*release));
+    round_ns = calloc(rounds, sizeof(*round_ns));
+    if ( !threads || !release || !round_ns )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    start = now_ns();
+    for ( i = 0; i < nr_threads; i++ )
+    {
+        errno = pthread_create(&threads[i], NULL, thread_fn, (void *)i);
+        if ( errno )
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for ( i = 0; i < nr_threads; i++ )
+        pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+
+    printf("%u threads, %lu rounds of %uus work: %.0f rounds/s, "
+           "%.1f%% of the time in barriers\n",
+           nr_threads, rounds, work_ns / 1000,
+           rounds * 1e9 / elapsed,
+           100.0 - 100.0 * rounds * work_ns / elapsed);
+    report("release", release, rounds);
+    report("round", round_ns + 1, rounds - 1);
+
+    free(round_ns);
+    free(release);
+    free(threads);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
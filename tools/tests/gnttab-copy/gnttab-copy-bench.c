@@ -0,0 +1,207 @@
+/*
+ * gnttab-copy-bench.c
+ *
+ * Measures GNTTABOP_copy throughput.  Pages are granted by this domain
+ * to itself through the gntalloc driver and then copied between in
+ * batches, either as consecutive fragments of the same page (the way
+ * netback copies a packet) or scattered over all pages, which defeats
+ * the per-batch reuse of grant pins and mappings in Xen.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+#include <xen/grant_table.h>
+
+#define PAGE_SIZE XC_PAGE_SIZE
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d domid] [-p pages] [-s size] [-b batch] "
+            "[-i iterations] [-r]\n"
+            "  -d domid       id of the domain running this test (default 0)\n"
+            "  -p pages       pages granted per side (default 16)\n"
+            "  -s size        bytes per copy op (default 512)\n"
+            "  -b batch       copy ops per hypercall (default 64)\n"
+            "  -i iterations  hypercalls issued (default 100000)\n"
+            "  -r             scatter consecutive ops over different pages\n",
+            prog);
+    exit(2);
+}
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface *xch;
+    xc_gntshr *xgs;
+    uint32_t domid = 0, *src_refs, *dst_refs;
+    unsigned int pages = 16, size = 512, batch = 64, scatter = 0;
+    unsigned long iterations = 100000, i, done = 0;
+    unsigned int per_page, k;
+    uint8_t *src = NULL, *dst = NULL;
+    gnttab_copy_t *ops;
+    double start, elapsed;
+    int opt, rc = 1;
+
+    while ( (opt = getopt(argc, argv, "d:p:s:b:i:r")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd': domid = strtoul(optarg, NULL, 0); break;
+        case 'p': pages = strtoul(optarg, NULL, 0); break;
+        case 's': size = strtoul(optarg, NULL, 0); break;
+        case 'b': batch = strtoul(optarg, NULL, 0); break;
+        case 'i': iterations = strtoul(optarg, NULL, 0); break;
+        case 'r': scatter = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( !pages || !batch || !size || size > PAGE_SIZE ||
+         PAGE_SIZE % size )
+        usage(argv[0]);
+    per_page = PAGE_SIZE / size;
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+
+    xgs = xc_gntshr_open(NULL, 0);
+    if ( !xgs )
+    {
+        perror("xc_gntshr_open");
+        goto out_xch;
+    }
+
+    src_refs = calloc(pages, sizeof(*src_refs));
+    dst_refs = calloc(pages, sizeof(*dst_refs));
+    ops = calloc(batch, sizeof(*ops));
+    if ( !src_refs || !dst_refs || !ops )
+    {
+        perror("calloc");
+        goto out_free;
+    }
+
+    src = xc_gntshr_share_pages(xgs, domid, pages, src_refs, 0);
+    dst = xc_gntshr_share_pages(xgs, domid, pages, dst_refs, 1);
+    if ( !src || !dst )
+    {
+        perror("xc_gntshr_share_pages");
+        goto out_unshare;
+    }
+
+    for ( i = 0; i < (unsigned long)pages * PAGE_SIZE; i++ )
+        src[i] = i * 7 + 3;
+    memset(dst, 0, (size_t)pages * PAGE_SIZE);
+
+    for ( k = 0; k < batch; k++ )
+    {
+        unsigned int page, frag;
+
+        if ( scatter )
+        {
+            page = k % pages;
+            frag = (k / pages) % per_page;
+        }
+        else
+        {
+            page = (k / per_page) % pages;
+            frag = k % per_page;
+        }
+
+        ops[k].source.u.ref = src_refs[page];
+        ops[k].source.domid = domid;
+        ops[k].source.offset = frag * size;
+        ops[k].dest.u.ref = dst_refs[page];
+        ops[k].dest.domid = domid;
+        ops[k].dest.offset = frag * size;
+        ops[k].len = size;
+        ops[k].flags = GNTCOPY_source_gref | GNTCOPY_dest_gref;
+    }
+
+    start = now();
+    for ( i = 0; i < iterations; i++ )
+    {
+        if ( xc_gnttab_op(xch, GNTTABOP_copy, ops, sizeof(*ops), batch) )
+        {
+            perror("GNTTABOP_copy");
+            goto out_unshare;
+        }
+        for ( k = 0; k < batch; k++ )
+            if ( ops[k].status != GNTST_okay )
+            {
+                fprintf(stderr, "op %u failed: status %d\n",
+                        k, ops[k].status);
+                goto out_unshare;
+            }
+        done += batch;
+    }
+    elapsed = now() - start;
+
+    for ( k = 0; k < batch; k++ )
+    {
+        size_t off = (size_t)(ops[k].dest.offset) +
+            (scatter ? k % pages : (k / per_page) % pages) * PAGE_SIZE;
+
+        if ( memcmp(dst + off, src + off, size) )
+        {
+            fprintf(stderr, "op %u: destination data mismatch\n", k);
+            goto out_unshare;
+        }
+    }
+
+    printf("%lu ops of %u bytes in %.3fs (%s, batch %u): "
+           "%.0f ops/s, %.1f MiB/s\n",
+           done, size, elapsed, scatter ? "scattered" : "sequential",
+           batch, done / elapsed, done * size / elapsed / (1 << 20));
+    rc = 0;
+
+ out_unshare:
+    if ( src )
+        xc_gntshr_munmap(xgs, src, pages);
+    if ( dst )
+        xc_gntshr_munmap(xgs, dst, pages);
+ out_free:
+    free(ops);
+    free(dst_refs);
+    free(src_refs);
+    xc_gntshr_close(xgs);
+ out_xch:
+    xc_interface_close(xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
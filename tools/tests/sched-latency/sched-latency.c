@@ -0,0 +1,361 @@
+/*
+ * sched-latency.c
+ *
+ * Scheduling latency report from xentrace data.  For every vcpu that is
+ * switched in, the hypervisor traces how long it had been runnable
+ * (TRC_SCHED_SWITCH_INFNEXT).  This is split into wakeup latency, when
+ * the vcpu had been woken up (TRC_SCHED_WAKE) since it last ran, and run
+ * delay otherwise, i.e. after a preemption.  Both are reported as
+ * percentiles and, with -H, as log2 histograms.
+ *
+ * To compare schedulers, run the same workload once in a cpupool using
+ * each of them, tracing the scheduler events of that pool's cpus:
+ *
+ *   xl cpupool-create 'name="c2"' 'sched="credit2"' 'cpus=["4-7"]'
+ *   (start the guests in pool c2 and run the workload)
+ *   xentrace -D -e 0x0002f000 -c 0xf0 -T 60 credit2.trace
+ *   ...and the same with a credit pool, then
+ *   sched-latency credit.trace credit2.trace
+ *
+ * The interesting numbers for latency sensitive (I/O) guests running
+ * next to batch ones are the wakeup latency tail percentiles of the I/O
+ * guests; use -d to restrict the report to those.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xen/xen.h>
+#include <xen/trace.h>
+
+#define TRC_MASK_EVENT    0x0fffffff
+#define TRC_EXTRA_SHIFT   28
+#define TRC_EXTRA_MASK    7
+#define TRC_CYCLES_FLAG   (1u << 31)
+
+#define NR_BUCKETS 40          /* log2 buckets of ns: up to ~18 minutes */
+#define MAX_DOMS   (1 << 16)
+
+struct event {
+    uint64_t tsc;
+    uint64_t seq;              /* file order, to keep the sort stable */
+    uint32_t event;
+    uint32_t cpu;
+    uint32_t d[4];
+};
+
+struct events {
+    struct event *ev;
+    size_t nr, max;
+};
+
+struct latency {
+    const char *name;
+    uint64_t *samples;
+    size_t nr, max;
+    uint64_t buckets[NR_BUCKETS];
+};
+
+/* Per-cpu state carried from SWITCH_INFNEXT to the following SWITCH. */
+struct cpu_state {
+    int valid;
+    uint64_t runnable_ns;
+};
+
+static int filter_domid = -1;
+static int histogram;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d domid] [-H] trace-file...\n"
+            "  -d domid       only report vcpus of this domain\n"
+            "  -H             also print log2 histograms\n",
+            prog);
+    exit(2);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if ( p == NULL )
+    {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static void add_event(struct events *evs, const struct event *e)
+{
+    if ( evs->nr == evs->max )
+    {
+        evs->max = evs->max ? evs->max * 2 : 65536;
+        evs->ev = xrealloc(evs->ev, evs->max * sizeof(*evs->ev));
+    }
+    evs->ev[evs->nr++] = *e;
+}
+
+static void add_sample(struct latency *l, uint64_t ns)
+{
+    unsigned int b = 0;
+
+    if ( l->nr == l->max )
+    {
+        l->max = l->max ? l->max * 2 : 4096;
+        l->samples = xrealloc(l->samples, l->max * sizeof(*l->samples));
+    }
+    l->samples[l->nr++] = ns;
+
+    while ( b < NR_BUCKETS - 1 && ns >= (2ull << b) )
+        b++;
+    l->buckets[b]++;
+}
+
+/*
+ * Read the scheduler records of a xentrace file.  The file is a series of
+ * per-cpu windows, each introduced by a TRC_TRACE_CPU_CHANGE record.
+ */
+static int read_trace(const char *file, struct events *evs)
+{
+    FILE *f = fopen(file, "rb");
+    uint32_t hdr, data[2 + 7];
+    uint32_t cpu = 0;
+    uint64_t seq = 0;
+
+    if ( f == NULL )
+    {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while ( fread(&hdr, sizeof(hdr), 1, f) == 1 )
+    {
+        uint32_t event = hdr & TRC_MASK_EVENT;
+        unsigned int extra = (hdr >> TRC_EXTRA_SHIFT) & TRC_EXTRA_MASK;
+        unsigned int words = extra + ((hdr & TRC_CYCLES_FLAG) ? 2 : 0);
+        struct event e;
+
+        if ( words && fread(data, sizeof(uint32_t), words, f) != words )
+            break;
+
+        if ( event == TRC_TRACE_CPU_CHANGE )
+        {
+            cpu = data[0];
+            continue;
+        }
+
+        if ( !(hdr & TRC_CYCLES_FLAG) ||
+             (event != TRC_SCHED_WAKE && event != TRC_SCHED_SWITCH &&
+              event != TRC_SCHED_SWITCH_INFNEXT) )
+            continue;
+
+        memset(&e, 0, sizeof(e));
+        e.tsc = ((uint64_t)data[1] << 32) | data[0];
+        e.seq = seq++;
+        e.event = event;
+        e.cpu = cpu;
+        memcpy(e.d, &data[2], (extra < 4 ? extra : 4) * sizeof(uint32_t));
+        add_event(evs, &e);
+    }
+
+    if ( ferror(f) )
+    {
+        fprintf(stderr, "%s: read error\n", file);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+    const struct event *x = a, *y = b;
+
+    if ( x->tsc != y->tsc )
+        return x->tsc < y->tsc ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const struct latency *l)
+{
+    static const double pct[] = { 50, 90, 99, 99.9 };
+    uint64_t sum = 0;
+    unsigned int i;
+
+    if ( !l->nr )
+    {
+        printf("  %-8s no samples\n", l->name);
+        return;
+    }
+
+    qsort(l->samples, l->nr, sizeof(*l->samples), cmp_u64);
+    for ( i = 0; i < l->nr; i++ )
+        sum += l->samples[i];
+
+    printf("  %-8s %8zu samples, mean %8.1fus", l->name, l->nr,
+           sum / 1000.0 / l->nr);
+    for ( i = 0; i < sizeof(pct) / sizeof(pct[0]); i++ )
+        printf(", p%g %8.1fus", pct[i],
+               l->samples[(size_t)((l->nr - 1) * pct[i] / 100)] / 1000.0);
+    printf(", max %8.1fus\n", l->samples[l->nr - 1] / 1000.0);
+
+    if ( !histogram )
+        return;
+
+    for ( i = 0; i < NR_BUCKETS; i++ )
+    {
+        if ( !l->buckets[i] )
+            continue;
+        printf("    < %10.1fus %10"PRIu64" %6.2f%%\n",
+               (2ull << i) / 1000.0, l->buckets[i],
+               l->buckets[i] * 100.0 / l->nr);
+    }
+}
+
+static int analyse(const char *file)
+{
+    struct events evs = { NULL };
+    struct latency wake = { "wakeup" }, delay = { "delay" };
+    struct cpu_state *cpus = NULL;
+    unsigned int nr_cpus = 0;
+    uint8_t *woken = calloc(MAX_DOMS, 1 << 5);
+    size_t i;
+
+    if ( woken == NULL )
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    if ( read_trace(file, &evs) )
+    {
+        free(woken);
+        return 1;
+    }
+
+    /* Wakeups and switches of a vcpu happen on different cpus. */
+    qsort(evs.ev, evs.nr, sizeof(*evs.ev), cmp_event);
+
+    for ( i = 0; i < evs.nr; i++ )
+    {
+        const struct event *e = &evs.ev[i];
+        unsigned int dom, vcpu;
+        size_t slot;
+
+        if ( e->cpu >= nr_cpus )
+        {
+            cpus = xrealloc(cpus, (e->cpu + 1) * sizeof(*cpus));
+            memset(cpus + nr_cpus, 0, (e->cpu + 1 - nr_cpus) * sizeof(*cpus));
+            nr_cpus = e->cpu + 1;
+        }
+
+        switch ( e->event )
+        {
+        case TRC_SCHED_WAKE:
+            dom = e->d[0];
+            vcpu = e->d[1];
+            if ( dom < MAX_DOMS && vcpu < 256 )
+                woken[(dom << 8 | vcpu) >> 3] |= 1 << (vcpu & 7);
+            break;
+
+        case TRC_SCHED_SWITCH_INFNEXT:
+            cpus[e->cpu].valid = 1;
+            cpus[e->cpu].runnable_ns = e->d[1];
+            break;
+
+        case TRC_SCHED_SWITCH:
+            dom = e->d[2];
+            vcpu = e->d[3];
+            if ( !cpus[e->cpu].valid || dom >= MAX_DOMS || vcpu >= 256 )
+                break;
+            cpus[e->cpu].valid = 0;
+
+            if ( dom == DOMID_IDLE ||
+                 (filter_domid >= 0 && dom != filter_domid) )
+                break;
+
+            slot = (dom << 8 | vcpu) >> 3;
+            if ( woken[slot] & (1 << (vcpu & 7)) )
+            {
+                woken[slot] &= ~(1 << (vcpu & 7));
+                add_sample(&wake, cpus[e->cpu].runnable_ns);
+            }
+            else
+                add_sample(&delay, cpus[e->cpu].runnable_ns);
+            break;
+        }
+    }
+
+    printf("%s:\n", file);
+    report(&wake);
+    report(&delay);
+
+    free(wake.samples);
+    free(delay.samples);
+    free(cpus);
+    free(evs.ev);
+    free(woken);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, rc = 0;
+
+    while ( (c = getopt(argc, argv, "d:H")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'd':
+            filter_domid = strtol(optarg, NULL, 0);
+            break;
+        case 'H':
+            histogram = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( optind == argc )
+        usage(argv[0]);
+
+    for ( ; optind < argc; optind++ )
+        rc |= analyse(argv[optind]);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,143 @@
+/*
+ * Just enough of the hypervisor environment to build xen/common/tasklet.c
+ * as a multi-threaded user-space program, with one thread per emulated CPU.
+ * Interrupts are not emulated: the irq variants of the lock operations are
+ * plain locks, and softirqs only run when the owning thread polls for them.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+#ifndef __TASKLET_STRESS_EMUL_H__
+#define __TASKLET_STRESS_EMUL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sched.h>
+
+typedef int bool_t;
+
+#define NR_CPUS 64
+#define CACHELINE 64
+
+#define __init
+#define __read_mostly
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define BUG() abort()
+#define BUG_ON(p) do { if ( p ) BUG(); } while ( 0 )
+#define ASSERT(p) BUG_ON(!(p))
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+#define prefetch(x) __builtin_prefetch(x)
+#define smp_mb()  __sync_synchronize()
+#define smp_wmb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__ ( "pause" ::: "memory" )
+#else
+#define cpu_relax() __asm__ __volatile__ ( "" ::: "memory" )
+#endif
+
+static inline int test_and_set_bit(int nr, volatile unsigned long *addr)
+{
+    return (__sync_fetch_and_or(addr, 1UL << nr) >> nr) & 1;
+}
+
+static inline void set_bit(int nr, volatile unsigned long *addr)
+{
+    __sync_fetch_and_or(addr, 1UL << nr);
+}
+
+static inline void clear_bit(int nr, volatile unsigned long *addr)
+{
+    __sync_fetch_and_and(addr, ~(1UL << nr));
+}
+
+#include "list.h"
+
+/*
+ * Test-and-set locks.  More threads than host CPUs are allowed, so give
+ * the host scheduler a chance to run a preempted lock holder.
+ */
+typedef struct { volatile int locked; } spinlock_t;
+#define SPIN_LOCK_UNLOCKED             { 0 }
+#define DEFINE_SPINLOCK(l)             spinlock_t l = SPIN_LOCK_UNLOCKED
+#define spin_lock_init(l)              ((l)->locked = 0)
+
+static inline int spin_trylock(spinlock_t *l)
+{
+    return !__sync_lock_test_and_set(&l->locked, 1);
+}
+
+static inline void spin_lock(spinlock_t *l)
+{
+    unsigned int spins = 0;
+
+    while ( !spin_trylock(l) )
+        while ( l->locked )
+        {
+            cpu_relax();
+            if ( !(++spins & 1023) )
+                sched_yield();
+        }
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+    __sync_lock_release(&l->locked);
+}
+
+#define spin_lock_irq(l)               spin_lock(l)
+#define spin_unlock_irq(l)             spin_unlock(l)
+#define spin_lock_irqsave(l, f)        ((f) = 0, spin_lock(l))
+#define spin_unlock_irqrestore(l, f)   ((void)(f), spin_unlock(l))
+#define local_irq_disable()            ((void)0)
+#define local_irq_enable()             ((void)0)
+
+/* Per-CPU variables, each on its own cache line. */
+#define PER_CPU_STRIDE(type) \
+    ((CACHELINE + sizeof(type) - 1) / sizeof(type))
+#define DEFINE_PER_CPU(type, name)                                      \
+    __typeof__(type) per_cpu__##name[NR_CPUS][PER_CPU_STRIDE(type)]     \
+        __attribute__((__aligned__(CACHELINE)))
+#define DECLARE_PER_CPU(type, name)                                     \
+    extern __typeof__(type) per_cpu__##name[NR_CPUS][PER_CPU_STRIDE(type)]
+#define per_cpu(var, cpu)              (per_cpu__##var[cpu][0])
+#define this_cpu(var)                  per_cpu(var, smp_processor_id())
+
+extern __thread unsigned int emul_cpu;
+extern volatile bool_t emul_cpu_online[NR_CPUS];
+#define smp_processor_id()             emul_cpu
+#define cpu_is_offline(cpu)            (!emul_cpu_online[cpu])
+
+#define SCHEDULE_SOFTIRQ 0
+#define TASKLET_SOFTIRQ  1
+void open_softirq(int nr, void (*handler)(void));
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr);
+#define raise_softirq(nr)              cpu_raise_softirq(emul_cpu, nr)
+
+#define sync_local_execstate()         ((void)0)
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *, unsigned long, void *);
+    int priority;
+};
+#define NOTIFY_DONE     0
+#define CPU_UP_PREPARE  1
+#define CPU_UP_CANCELED 2
+#define CPU_DEAD        3
+void register_cpu_notifier(struct notifier_block *nb);
+
+#include "tasklet.h"
+
+#endif /* __TASKLET_STRESS_EMUL_H__ */
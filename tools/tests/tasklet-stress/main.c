@@ -0,0 +1,321 @@
+/*
+ * Stress test and benchmark for the hypervisor's tasklet queues.
+ *
+ * xen/common/tasklet.c is built against emul.h, with one thread per
+ * emulated CPU.  In each round, every CPU schedules tasklets on random
+ * online CPUs, in the way interrupt handlers all over the system do, and
+ * runs those queued on itself from its "softirq" and "idle vcpu" loops.
+ * Between rounds, with all CPUs stopped as stop_machine would, the last
+ * CPU is alternately taken offline, which migrates its tasklets, and
+ * brought back.
+ *
+ * Each tasklet checks that it never runs on two CPUs at once, and at the
+ * end every tasklet must have run after the last time it was scheduled.
+ *
+ * Usage: make run
+ *    or: tasklet-stress [-c cpus] [-n tasklets] [-s schedules] [-r rounds]
+ *
+ * To compare with another implementation, build with
+ * TASKLET_C=/path/to/other/tasklet.c TASKLET_H=/path/to/other/tasklet.h.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "emul.h"
+
+__thread unsigned int emul_cpu;
+volatile bool_t emul_cpu_online[NR_CPUS];
+
+static void (*softirq_handlers[2])(void);
+static DEFINE_PER_CPU(unsigned long, softirq_pending);
+static struct notifier_block *cpu_nfb;
+
+void open_softirq(int nr, void (*handler)(void))
+{
+    softirq_handlers[nr] = handler;
+}
+
+void cpu_raise_softirq(unsigned int cpu, unsigned int nr)
+{
+    set_bit(nr, &per_cpu(softirq_pending, cpu));
+}
+
+void register_cpu_notifier(struct notifier_block *nb)
+{
+    cpu_nfb = nb;
+}
+
+static void cpu_notify(unsigned long action, unsigned int cpu)
+{
+    cpu_nfb->notifier_call(cpu_nfb, action, (void *)(unsigned long)cpu);
+}
+
+struct bench_tasklet {
+    struct tasklet tasklet;
+    volatile unsigned long scheduled;  /* bumped before each schedule */
+    volatile unsigned long seen;       /* value of scheduled when run */
+    volatile int running;
+    unsigned long runs;
+    int overlap;
+} __attribute__((__aligned__(CACHELINE)));
+
+static struct bench_tasklet *tasklets;
+static unsigned int nr_cpus, nr_tasklets = 256;
+static unsigned int schedules = 100000, rounds = 8;
+static pthread_barrier_t barrier;
+static volatile int draining;
+
+struct cpu_stats {
+    uint64_t schedule_ns;
+    unsigned long scheduled;
+} __attribute__((__aligned__(CACHELINE)));
+
+static struct cpu_stats stats[NR_CPUS];
+
+static void bench_fn(unsigned long data)
+{
+    struct bench_tasklet *bt = &tasklets[data];
+
+    if ( __sync_lock_test_and_set(&bt->running, 1) )
+        bt->overlap = 1;
+    bt->seen = bt->scheduled;
+    bt->runs++;
+    __sync_lock_release(&bt->running);
+}
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int test_and_clear_pending(unsigned long *pending, int nr)
+{
+    return (__sync_fetch_and_and(pending, ~(1UL << nr)) >> nr) & 1;
+}
+
+/* Run this CPU's pending softirqs and tasklet work, as the idle loop. */
+static void process_work(void)
+{
+    unsigned int cpu = emul_cpu;
+    unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
+    unsigned long *pending = &per_cpu(softirq_pending, cpu);
+
+    if ( cpu_is_offline(cpu) )
+        return;
+
+    if ( test_and_clear_pending(pending, TASKLET_SOFTIRQ) )
+        softirq_handlers[TASKLET_SOFTIRQ]();
+
+    /* The scheduler picks the idle vcpu while tasklet work is enqueued. */
+    test_and_clear_pending(pending, SCHEDULE_SOFTIRQ);
+    if ( *work_to_do & TASKLET_enqueued )
+    {
+        set_bit(_TASKLET_scheduled, work_to_do);
+        do_tasklet();
+        clear_bit(_TASKLET_scheduled, work_to_do);
+    }
+}
+
+/* Are all queues empty?  Only meaningful with every CPU at the barrier. */
+static int all_idle(void)
+{
+    unsigned int cpu;
+
+    for ( cpu = 0; cpu < nr_cpus; cpu++ )
+        if ( per_cpu(softirq_pending, cpu) ||
+             (per_cpu(tasklet_work_to_do, cpu) & TASKLET_enqueued) )
+            return 0;
+
+    return 1;
+}
+
+static void hotplug(unsigned int round)
+{
+    unsigned int cpu = nr_cpus - 1;
+
+    if ( nr_cpus < 2 )
+        return;
+
+    if ( round & 1 )
+    {
+        cpu_notify(CPU_UP_PREPARE, cpu);
+        emul_cpu_online[cpu] = 1;
+    }
+    else
+    {
+        emul_cpu_online[cpu] = 0;
+        per_cpu(softirq_pending, cpu) = 0;
+        per_cpu(tasklet_work_to_do, cpu) = 0;
+        cpu_notify(CPU_DEAD, cpu);
+    }
+}
+
+static void *cpu_fn(void *arg)
+{
+    unsigned int cpu = (unsigned long)arg, seed = cpu + 1;
+    struct cpu_stats *st = &stats[cpu];
+    unsigned int r, i;
+    uint64_t start;
+
+    emul_cpu = cpu;
+
+    for ( r = 0; r < rounds; r++ )
+    {
+        for ( i = 0; i < schedules && !cpu_is_offline(cpu); i++ )
+        {
+            struct bench_tasklet *bt = &tasklets[rand_r(&seed) % nr_tasklets];
+            unsigned int target;
+
+            do {
+                target = rand_r(&seed) % nr_cpus;
+            } while ( cpu_is_offline(target) );
+
+            __sync_fetch_and_add(&bt->scheduled, 1);
+            start = wall_ns();
+            tasklet_schedule_on_cpu(&bt->tasklet, target);
+            st->schedule_ns += wall_ns() - start;
+            st->scheduled++;
+
+            process_work();
+        }
+
+        /* Drain: requeued tasklets may land on CPUs already done. */
+        do {
+            process_work();
+            pthread_barrier_wait(&barrier);
+            if ( cpu == 0 )
+                draining = !all_idle();
+            pthread_barrier_wait(&barrier);
+        } while ( draining );
+
+        if ( cpu == 0 )
+            hotplug(r);
+        pthread_barrier_wait(&barrier);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[NR_CPUS];
+    unsigned long total = 0, runs = 0;
+    uint64_t schedule_ns = 0, elapsed;
+    unsigned int i, bad = 0;
+    int c;
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( nr_cpus < 4 )
+        nr_cpus = 4;
+
+    while ( (c = getopt(argc, argv, "c:n:s:r:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'c': nr_cpus = strtoul(optarg, NULL, 0); break;
+        case 'n': nr_tasklets = strtoul(optarg, NULL, 0); break;
+        case 's': schedules = strtoul(optarg, NULL, 0); break;
+        case 'r': rounds = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-c cpus] [-n tasklets] "
+                    "[-s schedules] [-r rounds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if ( !nr_cpus || nr_cpus > NR_CPUS || !nr_tasklets || !rounds )
+    {
+        fprintf(stderr, "need 1-%u cpus, and non-zero tasklets and rounds\n",
+                NR_CPUS);
+        return 2;
+    }
+
+    tasklets = calloc(nr_tasklets, sizeof(*tasklets));
+    if ( tasklets == NULL )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    tasklet_subsys_init();
+    for ( i = 1; i < nr_cpus; i++ )
+        cpu_notify(CPU_UP_PREPARE, i);
+    for ( i = 0; i < nr_cpus; i++ )
+        emul_cpu_online[i] = 1;
+
+    /* Half of them run in softirq context, half in idle vcpu context. */
+    for ( i = 0; i < nr_tasklets; i++ )
+        (i & 1 ? softirq_tasklet_init : tasklet_init)(
+            &tasklets[i].tasklet, bench_fn, i);
+
+    printf("%u cpus, %u tasklets, %u rounds of %u schedules per cpu\n",
+           nr_cpus, nr_tasklets, rounds, schedules);
+
+    pthread_barrier_init(&barrier, NULL, nr_cpus);
+    elapsed = wall_ns();
+    for ( i = 0; i < nr_cpus; i++ )
+    {
+        errno = pthread_create(&threads[i], NULL, cpu_fn,
+                               (void *)(unsigned long)i);
+        if ( errno )
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for ( i = 0; i < nr_cpus; i++ )
+        pthread_join(threads[i], NULL);
+    elapsed = wall_ns() - elapsed;
+
+    for ( i = 0; i < nr_cpus; i++ )
+    {
+        total += stats[i].scheduled;
+        schedule_ns += stats[i].schedule_ns;
+    }
+
+    for ( i = 0; i < nr_tasklets; i++ )
+    {
+        struct bench_tasklet *bt = &tasklets[i];
+
+        runs += bt->runs;
+        if ( bt->overlap || bt->seen != bt->scheduled )
+        {
+            if ( bad++ < 10 )
+                fprintf(stderr, "tasklet %u:%s%s\n", i,
+                        bt->overlap ? " ran concurrently" : "",
+                        bt->seen != bt->scheduled ? " missed a schedule" : "");
+        }
+        tasklet_kill(&bt->tasklet);
+    }
+
+    printf("%lu schedules, %lu runs in %.2fs: %.0f schedules/s, "
+           "%.1f ns/schedule\n", total, runs, elapsed / 1e9,
+           total * 1e9 / elapsed, (double)schedule_ns / total);
+
+    if ( bad )
+    {
+        fprintf(stderr, "%u tasklets misbehaved\n", bad);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,162 @@
+/*
+ * Just enough of the hypervisor environment to build xen/common/timer.c
+ * as a single-CPU user-space program.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+#ifndef __TIMER_WHEEL_EMUL_H__
+#define __TIMER_WHEEL_EMUL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+
+typedef int64_t s_time_t;
+typedef int bool_t;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define STIME_MAX ((s_time_t)((uint64_t)~0ull>>1))
+#define PRI_stime PRId64
+
+#define __init
+#define __read_mostly
+#define __cacheline_aligned __attribute__((__aligned__(64)))
+#define integer_param(name, var) extern int integer_param_unused
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define ASSERT(p) assert(p)
+#define BUG() abort()
+#define BUG_ON(p) do { if ( p ) BUG(); } while ( 0 )
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+#define prefetch(x) __builtin_prefetch(x)
+#define smp_wmb() __sync_synchronize()
+#define smp_rmb() __sync_synchronize()
+#define cpu_relax() do { } while ( 0 )
+
+#define read_atomic(p) (*(volatile typeof(*(p)) *)(p))
+#define write_atomic(p, x) (*(volatile typeof(*(p)) *)(p) = (x))
+
+/* Bitmaps. */
+#define BITS_PER_LONG (8 * (int)sizeof(long))
+#define BITS_TO_LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void __set_bit(unsigned int nr, unsigned long *map)
+{
+    map[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(unsigned int nr, unsigned long *map)
+{
+    map[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(unsigned int nr, const unsigned long *map)
+{
+    return (map[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline unsigned int find_next_bit(
+    const unsigned long *map, unsigned int size, unsigned int offset)
+{
+    while ( offset < size )
+    {
+        unsigned long word = map[offset / BITS_PER_LONG] >>
+                             (offset % BITS_PER_LONG);
+
+        if ( word )
+        {
+            offset += __builtin_ctzl(word);
+            return offset < size ? offset : size;
+        }
+        offset = (offset / BITS_PER_LONG + 1) * BITS_PER_LONG;
+    }
+
+    return size;
+}
+
+#define find_first_bit(map, size) find_next_bit(map, size, 0)
+
+#include "list.h"
+
+/* One CPU, no concurrency. */
+typedef int spinlock_t;
+#define spin_lock_init(l)              (*(l) = 0)
+#define spin_lock(l)                   ((void)(l))
+#define spin_unlock(l)                 ((void)(l))
+#define spin_lock_irq(l)               ((void)(l))
+#define spin_unlock_irq(l)             ((void)(l))
+#define spin_lock_irqsave(l, f)        ((void)(l), (f) = 0)
+#define spin_unlock_irqrestore(l, f)   ((void)(l), (void)(f))
+#define local_irq_save(f)              ((f) = 0)
+#define local_irq_restore(f)           ((void)(f))
+
+#define DEFINE_RCU_READ_LOCK(x) int x
+#define rcu_read_lock(x)               ((void)(x))
+#define rcu_read_unlock(x)             ((void)(x))
+
+#define DEFINE_PER_CPU(type, name)     __typeof__(type) per_cpu__##name
+#define DECLARE_PER_CPU(type, name)    extern __typeof__(type) per_cpu__##name
+#define per_cpu(var, cpu)              (*((void)(cpu), &per_cpu__##var))
+#define this_cpu(var)                  per_cpu__##var
+
+#define smp_processor_id()             0
+#define cpu_online(cpu)                ((cpu) == 0)
+#define cpumask_any(mask)              0
+#define for_each_online_cpu(cpu)       for ( (cpu) = 0; (cpu) < 1; (cpu)++ )
+
+#define TIMER_SOFTIRQ 0
+void open_softirq(int nr, void (*handler)(void));
+void raise_softirq(unsigned int nr);
+#define cpu_raise_softirq(cpu, nr)     raise_softirq(nr)
+
+#define perfc_incr(x)                  ((void)0)
+
+#define xmalloc_array(type, nr)        ((type *)malloc(sizeof(type) * (nr)))
+#define xfree(p)                       free(p)
+
+#define printk printf
+
+/* Time, as set by the benchmark. */
+extern s_time_t emul_now;
+#define NOW() (emul_now)
+
+struct keyhandler {
+    bool_t diagnostic;
+    union {
+        void (*fn)(unsigned char);
+    } u;
+    const char *desc;
+};
+#define register_keyhandler(key, h)    ((void)(key), (void)(h))
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *, unsigned long, void *);
+    int priority;
+};
+#define NOTIFY_DONE     0
+#define CPU_UP_PREPARE  1
+#define CPU_UP_CANCELED 2
+#define CPU_DEAD        3
+#define register_cpu_notifier(nb)      ((void)(nb))
+
+#include "timer.h"
+
+#endif /* __TIMER_WHEEL_EMUL_H__ */
@@ -0,0 +1,303 @@
+/*
+ * Benchmark for the hypervisor's per-CPU timer queues.
+ *
+ * xen/common/timer.c is built against emul.h as a single-CPU user-space
+ * program, with NOW() driven by the benchmark. The benchmark arms a set
+ * of timers, re-arms and stops them, and finally lets them all expire,
+ * timing each phase.  Expiry also checks that every timer ran exactly
+ * once and never early.
+ *
+ * A last phase checks timeliness: NOW() only moves to the deadlines the
+ * timer code programs, as it would on idle hardware, and each timer re-arms
+ * itself a few times from its handler.  No timer may run early, or more
+ * than timer_slop late.
+ *
+ * Usage: make run
+ *    or: timer-wheel-bench [-n timers] [-r range_us] [-s step_us] [-i iters]
+ *
+ * To compare with another implementation, build with
+ * TIMER_C=/path/to/other/timer.c.
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include "emul.h"
+
+s_time_t emul_now;
+
+static void (*timer_softirq)(void);
+static int softirq_pending;
+
+void open_softirq(int nr, void (*handler)(void))
+{
+    timer_softirq = handler;
+}
+
+void raise_softirq(unsigned int nr)
+{
+    softirq_pending = 1;
+}
+
+/* Last deadline programmed, 0 for none. */
+static s_time_t programmed;
+
+int reprogram_timer(s_time_t timeout)
+{
+    programmed = timeout;
+    return 1;
+}
+
+static void do_softirq(void)
+{
+    while ( softirq_pending )
+    {
+        softirq_pending = 0;
+        timer_softirq();
+    }
+}
+
+/* The default timer_slop of timer.c. */
+#define TIMER_SLOP 50000
+
+struct bench_timer {
+    struct timer timer;
+    s_time_t expires;
+    unsigned int fired;
+    int early;
+    s_time_t late;
+};
+
+static struct bench_timer *timers;
+static unsigned int nr_timers = 4096;
+static unsigned int range_us = 10000;
+static unsigned int step_us = 50;
+static unsigned int iters = 16;
+
+/* Times each timer re-arms itself in the deadline phase. */
+#define DEADLINE_REARMS 4
+static unsigned int rearms;
+
+static s_time_t random_expiry(void);
+
+static void bench_fn(void *data)
+{
+    struct bench_timer *bt = data;
+
+    bt->fired++;
+    /* A timer is due once NOW() has passed its expiry. */
+    if ( emul_now <= bt->expires )
+        bt->early = 1;
+    else if ( emul_now - bt->expires - 1 > bt->late )
+        bt->late = emul_now - bt->expires - 1;
+
+    if ( bt->fired <= rearms )
+    {
+        bt->expires = random_expiry();
+        set_timer(&bt->timer, bt->expires);
+    }
+}
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static s_time_t random_expiry(void)
+{
+    return emul_now + 1000 + (rand() % range_us) * 1000ll +
+           (rand() % 1000);
+}
+
+static void report(const char *what, uint64_t ops, uint64_t ns)
+{
+    printf("%-8s %10"PRIu64" ops %8.1f ns/op %12.0f ops/s\n",
+           what, ops, (double)ns / ops, ops * 1e9 / ns);
+}
+
+/*
+ * Only move time to the programmed deadlines, and check timeliness.  With
+ * few timers most of them sit in the upper levels, so the deadline has to
+ * account for their cascades.
+ */
+static unsigned int run_deadlines(unsigned int nr)
+{
+    s_time_t late = 0;
+    unsigned int i, bad = 0;
+
+    rearms = DEADLINE_REARMS;
+    for ( i = 0; i < nr; i++ )
+    {
+        timers[i].fired = timers[i].early = timers[i].late = 0;
+        timers[i].expires = random_expiry();
+        set_timer(&timers[i].timer, timers[i].expires);
+    }
+    do_softirq();
+
+    /* The timer interrupt comes just after the deadline. */
+    while ( programmed )
+    {
+        if ( emul_now < programmed + 1 )
+            emul_now = programmed + 1;
+        raise_softirq(TIMER_SOFTIRQ);
+        do_softirq();
+    }
+    rearms = 0;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( timers[i].late > late )
+            late = timers[i].late;
+        if ( timers[i].fired != DEADLINE_REARMS + 1 || timers[i].early ||
+             timers[i].late > TIMER_SLOP )
+        {
+            if ( bad++ < 10 )
+                fprintf(stderr, "timer %u: fired %u times%s, up to %"
+                        PRI_stime"ns late\n", i, timers[i].fired,
+                        timers[i].early ? ", early" : "", timers[i].late);
+        }
+    }
+
+    printf("deadline %10u timers, at most %"PRI_stime"ns late\n",
+           nr, late);
+
+    return bad;
+}
+
+static int run(void)
+{
+    uint64_t start, set_ns = 0, reset_ns = 0, stop_ns = 0, expire_ns = 0;
+    s_time_t end;
+    unsigned int i, j, bad = 0;
+
+    for ( j = 0; j < iters; j++ )
+    {
+        start = wall_ns();
+        for ( i = 0; i < nr_timers; i++ )
+        {
+            timers[i].expires = random_expiry();
+            set_timer(&timers[i].timer, timers[i].expires);
+        }
+        set_ns += wall_ns() - start;
+        do_softirq();
+
+        start = wall_ns();
+        for ( i = 0; i < nr_timers; i++ )
+        {
+            timers[i].expires = random_expiry();
+            set_timer(&timers[i].timer, timers[i].expires);
+        }
+        reset_ns += wall_ns() - start;
+        do_softirq();
+
+        start = wall_ns();
+        for ( i = 0; i < nr_timers; i++ )
+            stop_timer(&timers[i].timer);
+        stop_ns += wall_ns() - start;
+        do_softirq();
+
+        for ( i = 0; i < nr_timers; i++ )
+        {
+            timers[i].fired = timers[i].early = 0;
+            timers[i].expires = random_expiry();
+            set_timer(&timers[i].timer, timers[i].expires);
+        }
+        do_softirq();
+
+        end = emul_now + (range_us + 1) * 1000ll + 1000;
+        start = wall_ns();
+        while ( emul_now < end )
+        {
+            emul_now += step_us * 1000ll;
+            raise_softirq(TIMER_SOFTIRQ);
+            do_softirq();
+        }
+        expire_ns += wall_ns() - start;
+
+        for ( i = 0; i < nr_timers; i++ )
+            if ( timers[i].fired != 1 || timers[i].early )
+            {
+                if ( bad++ < 10 )
+                    fprintf(stderr, "timer %u: fired %u times%s\n", i,
+                            timers[i].fired, timers[i].early ? ", early" : "");
+            }
+    }
+
+    report("set", (uint64_t)nr_timers * iters, set_ns);
+    report("reset", (uint64_t)nr_timers * iters, reset_ns);
+    report("stop", (uint64_t)nr_timers * iters, stop_ns);
+    report("expire", (uint64_t)nr_timers * iters, expire_ns);
+
+    bad += run_deadlines(min(nr_timers, 16u));
+    bad += run_deadlines(nr_timers);
+
+    if ( bad )
+    {
+        fprintf(stderr, "%u timers misbehaved\n", bad);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+    int c;
+
+    while ( (c = getopt(argc, argv, "n:r:s:i:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'n': nr_timers = strtoul(optarg, NULL, 0); break;
+        case 'r': range_us = strtoul(optarg, NULL, 0); break;
+        case 's': step_us = strtoul(optarg, NULL, 0); break;
+        case 'i': iters = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n timers] [-r range_us] "
+                    "[-s step_us] [-i iters]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if ( !nr_timers || !range_us || !step_us || !iters )
+    {
+        fprintf(stderr, "all parameters must be non-zero\n");
+        return 2;
+    }
+
+    timers = calloc(nr_timers, sizeof(*timers));
+    if ( timers == NULL )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    emul_now = 1000000000ll;
+    srand(1);
+    timer_init();
+
+    for ( i = 0; i < nr_timers; i++ )
+        init_timer(&timers[i].timer, bench_fn, &timers[i], 0);
+
+    printf("%u timers over %uus, expiring in %uus steps, %u iterations\n",
+           nr_timers, range_us, step_us, iters);
+
+    return run();
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,277 @@
+/*
+ * xenstore-load-bench.c
+ *
+ * Request throughput of xenstored against the number of clients.  Each
+ * client is a thread with its own connection, reading random nodes out
+ * of /bench/load/<n> as fast as the daemon answers, and optionally doing
+ * a share of writes.  For each client count, the benchmark reports the
+ * requests per second served over all clients.
+ *
+ * Reads outside transactions may be served by xenstored's worker threads
+ * (--threads), so the throughput of a read-mostly load should grow with
+ * the clients up to the number of workers and cpus, while writes are
+ * still served one at a time.
+ *
+ * With -p, each client keeps that many asynchronous reads in flight on
+ * its connection rather than waiting for each reply, and with -S all the
+ * clients share a single connection.  Outside of a Xen host, a private
+ * daemon will do:
+ *
+ *   export XENSTORED_RUNDIR=/tmp/xs XENSTORED_ROOTDIR=/tmp/xs
+ *   mkdir -p /tmp/xs; xenstored -D --internal-db --threads 4
+ *   xenstore-load-bench 1 2 4 8
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenstore.h>
+
+static unsigned int nr_nodes = 1000;
+static unsigned int seconds = 5;
+static unsigned int write_pct;
+static unsigned int pipeline;
+static int share;
+static struct xs_handle *shared;
+
+static volatile int stop;
+
+struct client {
+    pthread_t thread;
+    unsigned int seed;
+    uint64_t reads, writes, errors;
+    /* With -S, replies complete in any client. */
+    unsigned int in_flight;
+    uint64_t async_reads, async_errors;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n nodes] [-s seconds] [-w write_pct] [-p depth] [-S]"
+            " clients...\n"
+            "  -n nodes       nodes read from (default 1000)\n"
+            "  -s seconds     run time per client count (default 5)\n"
+            "  -w write_pct   percentage of writes (default 0)\n"
+            "  -p depth       asynchronous reads in flight per client,"
+            " without -w\n"
+            "  -S             share one connection between all clients\n",
+            prog);
+    exit(2);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void read_done(struct xs_handle *xsh, uint32_t req_id, int err,
+                      void *reply, unsigned int len, void *arg)
+{
+    struct client *c = arg;
+
+    if ( err )
+        __sync_fetch_and_add(&c->async_errors, 1);
+    else
+        __sync_fetch_and_add(&c->async_reads, 1);
+    free(reply);
+    __sync_fetch_and_sub(&c->in_flight, 1);
+}
+
+static void *client_fn(void *arg)
+{
+    struct client *c = arg;
+    struct xs_handle *xsh = shared ? shared : xs_open(0);
+    char path[64], val[32];
+    unsigned int len, n;
+    void *data;
+
+    if ( xsh == NULL )
+    {
+        perror("xs_open");
+        exit(1);
+    }
+
+    while ( !stop )
+    {
+        if ( pipeline )
+        {
+            while ( __sync_fetch_and_add(&c->in_flight, 0) < pipeline )
+            {
+                n = rand_r(&c->seed) % nr_nodes;
+                snprintf(path, sizeof(path), "/bench/load/%u", n);
+                __sync_fetch_and_add(&c->in_flight, 1);
+                if ( !xs_read_async(xsh, XBT_NULL, path, read_done, c) )
+                {
+                    perror("xs_read_async");
+                    exit(1);
+                }
+            }
+            /* With -S, this may complete the reads of other clients. */
+            xs_async_complete(xsh, true);
+            continue;
+        }
+
+        n = rand_r(&c->seed) % nr_nodes;
+        snprintf(path, sizeof(path), "/bench/load/%u", n);
+
+        if ( write_pct && rand_r(&c->seed) % 100 < write_pct )
+        {
+            len = snprintf(val, sizeof(val), "%u", rand_r(&c->seed));
+            if ( xs_write(xsh, XBT_NULL, path, val, len) )
+                c->writes++;
+            else
+                c->errors++;
+            continue;
+        }
+
+        data = xs_read(xsh, XBT_NULL, path, &len);
+        if ( data )
+            c->reads++;
+        else
+            c->errors++;
+        free(data);
+    }
+
+    /* With -S, another client may have them to complete. */
+    while ( __sync_fetch_and_add(&c->in_flight, 0) )
+        xs_async_complete(xsh, true);
+
+    if ( !shared )
+        xs_close(xsh);
+    return NULL;
+}
+
+static int run(unsigned int nr_clients)
+{
+    struct client *clients = calloc(nr_clients, sizeof(*clients));
+    uint64_t start, elapsed, reads = 0, writes = 0, errors = 0;
+    unsigned int i;
+
+    if ( clients == NULL )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    stop = 0;
+    start = now_ns();
+    for ( i = 0; i < nr_clients; i++ )
+    {
+        clients[i].seed = i + 1;
+        errno = pthread_create(&clients[i].thread, NULL, client_fn,
+                               &clients[i]);
+        if ( errno )
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    sleep(seconds);
+    stop = 1;
+
+    for ( i = 0; i < nr_clients; i++ )
+    {
+        pthread_join(clients[i].thread, NULL);
+        reads += clients[i].reads + clients[i].async_reads;
+        writes += clients[i].writes;
+        errors += clients[i].errors + clients[i].async_errors;
+    }
+    elapsed = now_ns() - start;
+
+    printf("%4u clients: %10.0f req/s (%.0f reads/s, %.0f writes/s)\n",
+           nr_clients, (reads + writes) * 1e9 / elapsed,
+           reads * 1e9 / elapsed, writes * 1e9 / elapsed);
+    if ( errors )
+        fprintf(stderr, "%"PRIu64" requests failed\n", errors);
+
+    free(clients);
+    return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct xs_handle *xsh;
+    char path[64], val[32];
+    unsigned int i, len;
+    int c, rc = 0;
+
+    while ( (c = getopt(argc, argv, "n:s:w:p:S")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'n': nr_nodes = strtoul(optarg, NULL, 0); break;
+        case 's': seconds = strtoul(optarg, NULL, 0); break;
+        case 'w': write_pct = strtoul(optarg, NULL, 0); break;
+        case 'p': pipeline = strtoul(optarg, NULL, 0); break;
+        case 'S': share = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( optind == argc || !nr_nodes || !seconds || write_pct > 100 ||
+         (pipeline && write_pct) )
+        usage(argv[0]);
+
+    xsh = xs_open(0);
+    if ( xsh == NULL )
+    {
+        perror("xs_open");
+        return 1;
+    }
+
+    for ( i = 0; i < nr_nodes; i++ )
+    {
+        snprintf(path, sizeof(path), "/bench/load/%u", i);
+        len = snprintf(val, sizeof(val), "%u", i);
+        if ( !xs_write(xsh, XBT_NULL, path, val, len) )
+        {
+            perror(path);
+            return 1;
+        }
+    }
+
+    if ( share )
+        shared = xsh;
+
+    printf("%u nodes, %u%% writes, %us per run%s\n",
+           nr_nodes, write_pct, seconds,
+           share ? ", one connection" : "");
+
+    for ( ; optind < argc; optind++ )
+        rc |= run(strtoul(argv[optind], NULL, 0));
+
+    xs_rm(xsh, XBT_NULL, "/bench/load");
+    xs_close(xsh);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
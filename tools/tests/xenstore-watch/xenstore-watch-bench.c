@@ -0,0 +1,235 @@
+/*
+ * xenstore-watch-bench.c
+ *
+ * Write latency of xenstored against the number of registered watches.
+ * The watches are spread over several connections, one per node in the
+ * way backends watch their frontends: /bench/<n>/state.  For each watch
+ * count, the benchmark times writes to a node nobody watches, which only
+ * costs the daemon its watch lookup, and writes to watched nodes, which
+ * also fire one event each.
+ *
+ * It needs a running xenstored, and writes below /bench.  Outside of a
+ * Xen host, a private daemon will do:
+ *
+ *   export XENSTORED_RUNDIR=/tmp/xs XENSTORED_ROOTDIR=/tmp/xs
+ *   mkdir -p /tmp/xs; xenstored -D --internal-db
+ *   xenstore-watch-bench 0 1000 10000 100000
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenstore.h>
+
+static unsigned int nr_conns = 16;
+static unsigned int nr_writes = 10000;
+
+static struct xs_handle **conns;
+static uint64_t *samples;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c conns] [-n writes] watches...\n"
+            "  -c conns       connections holding the watches (default 16)\n"
+            "  -n writes      writes timed per watch count (default 10000)\n",
+            prog);
+    exit(2);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Throw away the events queued on the watching connections. */
+static void drain(void)
+{
+    unsigned int i;
+    char **ev;
+
+    for ( i = 0; i < nr_conns; i++ )
+        while ( (ev = xs_check_watch(conns[i])) != NULL )
+            free(ev);
+}
+
+static int watch(unsigned int first, unsigned int last, int add)
+{
+    char path[64], token[16];
+    unsigned int i;
+
+    for ( i = first; i < last; i++ )
+    {
+        struct xs_handle *h = conns[i % nr_conns];
+
+        snprintf(path, sizeof(path), "/bench/%u/state", i);
+        snprintf(token, sizeof(token), "%u", i);
+        if ( !(add ? xs_watch(h, path, token) : xs_unwatch(h, path, token)) )
+        {
+            fprintf(stderr, "%s %s: %s\n", add ? "watch" : "unwatch",
+                    path, strerror(errno));
+            return -1;
+        }
+        if ( (i & 1023) == 1023 )
+            drain();
+    }
+    drain();
+
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, unsigned int watches)
+{
+    uint64_t sum = 0;
+    unsigned int i;
+
+    qsort(samples, nr_writes, sizeof(*samples), cmp_u64);
+    for ( i = 0; i < nr_writes; i++ )
+        sum += samples[i];
+
+    printf("%8u watches, %-9s mean %8.1fus, p50 %8.1fus, p99 %8.1fus\n",
+           watches, name, sum / 1000.0 / nr_writes,
+           samples[nr_writes / 2] / 1000.0,
+           samples[(size_t)((nr_writes - 1) * 0.99)] / 1000.0);
+}
+
+static int bench(struct xs_handle *xsh, unsigned int watches)
+{
+    char path[64], val[16];
+    unsigned int i;
+
+    for ( i = 0; i < nr_writes; i++ )
+    {
+        uint64_t start;
+
+        snprintf(val, sizeof(val), "%u", i);
+        start = now_ns();
+        if ( !xs_write(xsh, XBT_NULL, "/bench/unwatched", val, strlen(val)) )
+        {
+            perror("xs_write");
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+    }
+    report("unwatched", watches);
+
+    if ( !watches )
+        return 0;
+
+    for ( i = 0; i < nr_writes; i++ )
+    {
+        uint64_t start;
+
+        snprintf(path, sizeof(path), "/bench/%u/state", rand() % watches);
+        snprintf(val, sizeof(val), "%u", i);
+        start = now_ns();
+        if ( !xs_write(xsh, XBT_NULL, path, val, strlen(val)) )
+        {
+            perror("xs_write");
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+        if ( (i & 1023) == 1023 )
+            drain();
+    }
+    drain();
+    report("watched", watches);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct xs_handle *xsh;
+    unsigned int i, watches = 0;
+    int c, rc = 0;
+
+    while ( (c = getopt(argc, argv, "c:n:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'c': nr_conns = strtoul(optarg, NULL, 0); break;
+        case 'n': nr_writes = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if ( optind == argc || !nr_conns || !nr_writes )
+        usage(argv[0]);
+
+    conns = calloc(nr_conns, sizeof(*conns));
+    samples = calloc(nr_writes, sizeof(*samples));
+    if ( !conns || !samples )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    xsh = xs_open(0);
+    for ( i = 0; xsh && i < nr_conns; i++ )
+        conns[i] = xs_open(0);
+    if ( !xsh || !conns[nr_conns - 1] )
+    {
+        perror("xs_open");
+        return 1;
+    }
+
+    srand(1);
+    for ( ; optind < argc && !rc; optind++ )
+    {
+        unsigned int want = strtoul(argv[optind], NULL, 0);
+
+        /* Watch counts are cumulative: only add or remove the difference. */
+        if ( want > watches )
+            rc = watch(watches, want, 1);
+        else
+            rc = watch(want, watches, 0);
+        if ( !rc )
+        {
+            watches = want;
+            rc = bench(xsh, watches);
+        }
+    }
+
+    watch(0, watches, 0);
+    xs_rm(xsh, XBT_NULL, "/bench");
+    for ( i = 0; i < nr_conns; i++ )
+        xs_close(conns[i]);
+    xs_close(xsh);
+
+    return rc ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
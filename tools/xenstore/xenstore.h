@@ -153,6 +153,13 @@ bool xs_set_permissions(struct xs_handle *h, xs_transaction_t t,
  */
 bool xs_watch(struct xs_handle *h, const char *path, const char *token);
 
+/* Like xs_watch(), but all the changes under path made while an event is
+ * pending give a single event, for path itself: for watchers which rescan
+ * the whole subtree anyway.  Fails with EINVAL if xenstored is too old.
+ */
+bool xs_watch_coalesced(struct xs_handle *h, const char *path,
+			const char *token);
+
 /* Return the FD to poll on to see if a watch has fired. */
 int xs_fileno(struct xs_handle *h);
 
@@ -197,6 +204,76 @@ xs_transaction_t xs_transaction_start(struct xs_handle *h);
 bool xs_transaction_end(struct xs_handle *h, xs_transaction_t t,
 			bool abort);
 
+/* Batch of operations, sent to the daemon in a single message and
+ * applied atomically: in a transaction of their own, or as part of t.
+ *
+ * xs_multi_*() add an operation to the batch, and return its index in
+ * the batch, or -1 on failure (E2BIG if the batch would no longer fit in
+ * a message).  xs_multi_submit() returns false on failure, in which case
+ * the batch had no effect (if not part of t).  After it succeeded,
+ * xs_multi_result() returns the value read by read operation op, like
+ * xs_read().
+ */
+struct xs_multi;
+
+struct xs_multi *xs_multi_new(void);
+void xs_multi_free(struct xs_multi *m);
+
+int xs_multi_read(struct xs_multi *m, const char *path);
+int xs_multi_write(struct xs_multi *m, const char *path,
+		   const void *data, unsigned int len);
+int xs_multi_mkdir(struct xs_multi *m, const char *path);
+int xs_multi_rm(struct xs_multi *m, const char *path);
+int xs_multi_set_permissions(struct xs_multi *m, const char *path,
+			     struct xs_permissions *perms,
+			     unsigned int num_perms);
+
+bool xs_multi_submit(struct xs_handle *h, xs_transaction_t t,
+		     struct xs_multi *m);
+void *xs_multi_result(struct xs_multi *m, int op, unsigned int *len);
+
+/* Asynchronous requests: any number of them can be in flight on a handle
+ * at once, and are served in order.  xs_*_async() send a request, and
+ * return its id, or 0 on failure.
+ *
+ * Once its reply came, xs_async_complete() calls done for it, with err 0
+ * and the reply, malloc'ed and nul terminated, which done should free()
+ * (for a directory, the names of the children, each nul terminated); or
+ * with an errno value in err, and reply NULL.  The requests of a lost
+ * connection complete with EBADF.
+ *
+ * xs_async_complete() completes all the requests whose reply came, and
+ * returns how many it did: with block, it waits for at least one if any
+ * is in flight.  Callers can poll on xs_async_fileno() for it to have
+ * something to do.  done may send requests of its own, or call
+ * xs_async_complete().
+ *
+ * Without threads (libxenstore.a), xs_async_fileno() is the connection
+ * itself: it may become readable for nothing to complete, and replies can
+ * be read off it by synchronous calls, after which xs_async_complete()
+ * should be called before polling again.
+ *
+ * The synchronous calls of other threads do not wait for the replies to
+ * each other's requests, nor to async ones.
+ */
+typedef void xs_async_fn(struct xs_handle *h, uint32_t req_id, int err,
+			 void *reply, unsigned int len, void *arg);
+
+uint32_t xs_read_async(struct xs_handle *h, xs_transaction_t t,
+		       const char *path, xs_async_fn *done, void *arg);
+uint32_t xs_directory_async(struct xs_handle *h, xs_transaction_t t,
+			    const char *path, xs_async_fn *done, void *arg);
+uint32_t xs_write_async(struct xs_handle *h, xs_transaction_t t,
+			const char *path, const void *data, unsigned int len,
+			xs_async_fn *done, void *arg);
+uint32_t xs_mkdir_async(struct xs_handle *h, xs_transaction_t t,
+			const char *path, xs_async_fn *done, void *arg);
+uint32_t xs_rm_async(struct xs_handle *h, xs_transaction_t t,
+		     const char *path, xs_async_fn *done, void *arg);
+
+int xs_async_fileno(struct xs_handle *h);
+int xs_async_complete(struct xs_handle *h, bool block);
+
 /* Introduce a new domain.
  * This tells the store daemon about a shared memory page, event channel and
  * store path associated with a domain: the domain uses these to communicate.
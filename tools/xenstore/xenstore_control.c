@@ -5,18 +5,49 @@
 #include "xenstore.h"
 
 
+/* Print the statistics of all the connections, as many replies as it takes. */
+static int print_stats(struct xs_handle *xsh)
+{
+  char first[16] = "0";
+  char *reply, *more;
+
+  for (;;) {
+    reply = xs_debug_command(xsh, "stats", first, strlen(first) + 1);
+    if (reply == NULL) {
+      perror("stats");
+      return 1;
+    }
+
+    more = strstr(reply, "more ");
+    if (more && (more == reply || more[-1] == '\n')) {
+      snprintf(first, sizeof(first), "%s", more + 5);
+      first[strcspn(first, "\n")] = '\0';
+      *more = '\0';
+    } else
+      more = NULL;
+
+    fputs(reply, stdout);
+    free(reply);
+
+    if (more == NULL)
+      return 0;
+  }
+}
+
 int main(int argc, char **argv)
 {
   struct xs_handle * xsh;
+  int rc = 0;
 
   if (argc < 2 ||
-      strcmp(argv[1], "check"))
+      (strcmp(argv[1], "check") && strcmp(argv[1], "stats")))
   {
     fprintf(stderr,
             "Usage:\n"
             "\n"
             "       %s check\n"
-            "\n", argv[0]);
+            "       %s stats\n"
+            "\n", argv[0], argv[0]);
     return 2;
   }
 
@@ -27,9 +58,12 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  xs_debug_command(xsh, argv[1], NULL, 0);
+  if (!strcmp(argv[1], "stats"))
+    rc = print_stats(xsh);
+  else
+    xs_debug_command(xsh, argv[1], NULL, 0);
 
   xs_daemon_close(xsh);
 
-  return 0;
+  return rc;
 }
@@ -49,17 +49,20 @@
 #include "xenstored_watch.h"
 #include "xenstored_transaction.h"
 #include "xenstored_domain.h"
+#include "xenstored_worker.h"
+#include "xenstored_store.h"
 #include "xenctrl.h"
 #include "tdb.h"
 
-#include "hashtable.h"
-
 extern xc_evtchn *xce_handle; /* in xenstored_domain.c */
 static int xce_pollfd_idx = -1;
 static struct pollfd *fds;
 static unsigned int current_array_size;
 static unsigned int nr_fds;
 
+/* Reads from the ring of a domain per main loop iteration, at most. */
+#define DOMAIN_BATCH 32
+
 #define ROUNDUP(_x, _w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
 
 static bool verbose = false;
@@ -69,8 +72,8 @@ static bool recovery = true;
 static bool remove_local = true;
 static int reopen_log_pipe[2];
 static int reopen_log_pipe0_pollfd_idx = -1;
+static int workers_pollfd_idx = -1;
 static char *tracefile = NULL;
-static TDB_CONTEXT *tdb_ctx = NULL;
 
 static void corrupt(struct connection *conn, const char *fmt, ...);
 static void check_store(void);
@@ -86,26 +89,12 @@ static void check_store(void);
 
 int quota_nb_entry_per_domain = 1000;
 int quota_nb_watch_per_domain = 128;
+int quota_nb_watch_events = 1024;
 int quota_max_entry_size = 2048; /* 2K */
 int quota_max_transaction = 10;
-
-TDB_CONTEXT *tdb_context(struct connection *conn)
-{
-	/* conn = NULL used in manual_node at setup. */
-	if (!conn || !conn->transaction)
-		return tdb_ctx;
-	return tdb_transaction_context(conn->transaction);
-}
-
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb)
-{
-	if (!(tdb_ctx->flags & TDB_INTERNAL))
-		if (rename(newname, xs_daemon_tdb()) != 0)
-			return false;
-	tdb_close(tdb_ctx);
-	tdb_ctx = talloc_steal(talloc_autofree_context(), newtdb);
-	return true;
-}
+static unsigned int snapshot_interval = 10000;
+static bool internal_db;
+static unsigned int nr_threads;
 
 static char *sockmsg_string(enum xsd_sockmsg_type type)
 {
@@ -131,6 +120,7 @@ static char *sockmsg_string(enum xsd_sockmsg_type type)
 	case XS_RESUME: return "RESUME";
 	case XS_SET_TARGET: return "SET_TARGET";
 	case XS_RESET_WATCHES: return "RESET_WATCHES";
+	case XS_MULTI: return "MULTI";
 	default:
 		return "**UNKNOWN**";
 	}
@@ -231,6 +221,21 @@ static void reopen_log(void)
 	}
 }
 
+/* Count a whole message in or out of conn in its statistics. */
+static void account_io(struct connection *conn,
+		       const struct xsd_sockmsg *msg, bool out)
+{
+	if (out) {
+		conn->stats.bytes_out += sizeof(*msg) + msg->len;
+		if (msg->type == XS_WATCH_EVENT)
+			conn->stats.watch_events++;
+	} else {
+		conn->stats.bytes_in += sizeof(*msg) + msg->len;
+		conn->stats.requests[msg->type < XS_TYPE_COUNT ?
+				     msg->type : XS_TYPE_COUNT]++;
+	}
+}
+
 static bool write_messages(struct connection *conn)
 {
 	int ret;
@@ -273,6 +278,7 @@ static bool write_messages(struct connection *conn)
 		return true;
 
 	trace_io(conn, out, 1);
+	account_io(conn, &out->hdr.msg, true);
 
 	list_del(&out->list);
 	talloc_free(out);
@@ -284,6 +290,8 @@ static int destroy_conn(void *_conn)
 {
 	struct connection *conn = _conn;
 
+	worker_cancel(conn);
+
 	/* Flush outgoing if possible, but don't block. */
 	if (!conn->domain) {
 		struct pollfd pfd;
@@ -361,14 +369,18 @@ static void initialize_fds(int sock, int *p_sock_pollfd_idx,
 		xce_pollfd_idx = set_fd(xc_evtchn_fd(xce_handle),
 					POLLIN|POLLPRI);
 
+	if (workers_fd() != -1)
+		workers_pollfd_idx = set_fd(workers_fd(), POLLIN|POLLPRI);
+
+	/* Connections with a request in a worker wait for its replies. */
 	list_for_each_entry(conn, &connections, list) {
 		if (conn->domain) {
-			if (domain_can_read(conn) ||
+			if ((!conn->job && domain_can_read(conn)) ||
 			    (domain_can_write(conn) &&
 			     !list_empty(&conn->out_list)))
 				*ptimeout = 0;
 		} else {
-			short events = POLLIN|POLLPRI;
+			short events = conn->job ? 0 : POLLIN|POLLPRI;
 			if (!list_empty(&conn->out_list))
 				events |= POLLOUT;
 			conn->pollfd_idx = set_fd(conn->fd, events);
@@ -392,85 +404,138 @@ bool is_child(const char *child, const char *parent)
 	return child[len] == '/' || child[len] == '\0';
 }
 
+/*
+ * Access the record of a node: in the connection's transaction if it is
+ * in one, else in the committed store.  conn is NULL during setup.
+ */
+static int fetch_record(struct connection *conn, const void *ctx,
+			const char *name, TDB_DATA *data)
+{
+	if (conn && conn->transaction)
+		return transaction_fetch(conn->transaction, ctx, name, data);
+	return db_fetch(ctx, name, data);
+}
+
+static int store_record(struct connection *conn, const char *name,
+			TDB_DATA data)
+{
+	if (conn && conn->transaction)
+		return transaction_store(conn->transaction, name, data);
+	return db_store(name, data);
+}
+
+static int delete_record(struct connection *conn, const char *name)
+{
+	if (conn && conn->transaction)
+		return transaction_delete(conn->transaction, name);
+	return db_delete(name);
+}
+
 /* If it fails, returns NULL and sets errno. */
 static struct node *read_node(struct connection *conn, const char *name)
 {
-	TDB_DATA key, data;
-	uint32_t *p;
+	TDB_DATA data;
+	struct xs_tdb_record_hdr *hdr;
 	struct node *node;
-	TDB_CONTEXT * context = tdb_context(conn);
 
-	key.dptr = (void *)name;
-	key.dsize = strlen(name);
-	data = tdb_fetch(context, key);
-
-	if (data.dptr == NULL) {
-		if (tdb_error(context) == TDB_ERR_NOEXIST)
-			errno = ENOENT;
-		else {
-			log("TDB error on read: %s", tdb_errorstr(context));
-			errno = EIO;
-		}
+	node = talloc(name, struct node);
+	if (fetch_record(conn, node, name, &data)) {
+		talloc_free(node);
 		return NULL;
 	}
 
-	node = talloc(name, struct node);
 	node->name = talloc_strdup(node, name);
 	node->parent = NULL;
-	node->tdb = tdb_context(conn);
-	talloc_steal(node, data.dptr);
 
-	/* Datalen, childlen, number of permissions */
-	p = (uint32_t *)data.dptr;
-	node->num_perms = p[0];
-	node->datalen = p[1];
-	node->childlen = p[2];
+	/* Datalen, number of permissions */
+	hdr = (void *)data.dptr;
+	node->num_perms = hdr->num_perms;
+	node->datalen = hdr->datalen;
 
 	/* Permissions are struct xs_permissions. */
-	node->perms = (void *)&p[3];
+	node->perms = hdr->perms;
 	/* Data is binary blob (usually ascii, no nul). */
 	node->data = node->perms + node->num_perms;
-	/* Children is strings, nul separated. */
-	node->children = node->data + node->datalen;
+
+	/* The store keeps the children: see read_children(). */
+	node->children = NULL;
+	node->childlen = 0;
 
 	return node;
 }
 
-static bool write_node(struct connection *conn, const struct node *node)
+/* Fill in the children of node: it has none if it doesn't exist (yet). */
+static bool read_children(struct connection *conn, struct node *node)
+{
+	int ret;
+
+	if (conn && conn->transaction)
+		ret = transaction_children(conn->transaction, node,
+					   node->name, &node->children,
+					   &node->childlen);
+	else
+		ret = db_children(node, node->name, &node->children,
+				  &node->childlen);
+
+	if (ret != 0 && errno == ENOENT) {
+		node->children = talloc_strdup(node, "");
+		node->childlen = 0;
+		ret = node->children ? 0 : -1;
+	}
+	return ret == 0;
+}
+
+/* Would node still fit in an entry of an unprivileged domain, with extra
+ * more bytes of children names? */
+static bool entry_fits(struct connection *conn, struct node *node,
+		       unsigned int extra)
+{
+	if (!domain_is_unprivileged(conn))
+		return true;
+
+	if (!node->children && !read_children(conn, node))
+		return false;
+
+	return sizeof(struct xs_tdb_record_hdr)
+		+ node->num_perms*sizeof(node->perms[0])
+		+ node->datalen + node->childlen + extra
+		< quota_max_entry_size;
+}
+
+static bool write_node(struct connection *conn, struct node *node)
 {
 	/*
 	 * conn will be null when this is called from manual_node.
-	 * tdb_context copes with this.
+	 * store_record copes with this.
 	 */
 
-	TDB_DATA key, data;
+	TDB_DATA data;
+	struct xs_tdb_record_hdr *hdr;
 	void *p;
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
-	data.dsize = 3*sizeof(uint32_t)
+	data.dsize = sizeof(*hdr)
 		+ node->num_perms*sizeof(node->perms[0])
-		+ node->datalen + node->childlen;
+		+ node->datalen;
 
-	if (domain_is_unprivileged(conn) && data.dsize >= quota_max_entry_size)
+	/* The children count against the size of an entry, too. */
+	if (!entry_fits(conn, node, 0))
 		goto error;
 
 	data.dptr = talloc_size(node, data.dsize);
-	((uint32_t *)data.dptr)[0] = node->num_perms;
-	((uint32_t *)data.dptr)[1] = node->datalen;
-	((uint32_t *)data.dptr)[2] = node->childlen;
-	p = data.dptr + 3 * sizeof(uint32_t);
+	hdr = (void *)data.dptr;
+	hdr->generation = NO_GENERATION;
+	hdr->num_perms = node->num_perms;
+	hdr->datalen = node->datalen;
+	hdr->childlen = 0;
+	hdr->pad = 0;
+	p = hdr->perms;
 
 	memcpy(p, node->perms, node->num_perms*sizeof(node->perms[0]));
 	p += node->num_perms*sizeof(node->perms[0]);
 	memcpy(p, node->data, node->datalen);
-	p += node->datalen;
-	memcpy(p, node->children, node->childlen);
 
-	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_context(conn), key, data, TDB_REPLACE) != 0) {
-		corrupt(conn, "Write of %s failed", key.dptr);
+	if (store_record(conn, node->name, data) != 0) {
+		corrupt(conn, "Write of %s failed", node->name);
 		goto error;
 	}
 	return true;
@@ -628,27 +693,45 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 		const void *data, unsigned int len)
 {
 	struct buffered_data *bdata;
+	struct xsd_sockmsg msg;
 
 	if ( len > XENSTORE_PAYLOAD_MAX ) {
 		send_error(conn, E2BIG);
 		return;
 	}
 
-	/* Message is a child of the connection context for auto-cleanup. */
-	bdata = new_buffer(conn);
-	bdata->buffer = talloc_array(bdata, char, len);
-
 	/* Echo request header in reply unless this is an async watch event. */
 	if (type != XS_WATCH_EVENT) {
-		memcpy(&bdata->hdr.msg, &conn->in->hdr.msg,
-		       sizeof(struct xsd_sockmsg));
+		memcpy(&msg, &conn->in->hdr.msg, sizeof(struct xsd_sockmsg));
 	} else {
-		memset(&bdata->hdr.msg, 0, sizeof(struct xsd_sockmsg));
+		memset(&msg, 0, sizeof(struct xsd_sockmsg));
+	}
+
+	/* Update relevant header fields. */
+	msg.type = type;
+	msg.len = len;
+
+	/* Skip the queue if it's empty and the ring has room. */
+	if (conn->direct_reply && type != XS_WATCH_EVENT &&
+	    list_empty(&conn->out_list) &&
+	    domain_write_message(conn, &msg, data)) {
+		struct buffered_data out = { .hdr.msg = msg,
+					     .buffer = (char *)data };
+
+		if (verbose)
+			xprintf("Writing msg %s (%.*s) out to %p\n",
+				sockmsg_string(type), len, out.buffer, conn);
+		trace_io(conn, &out, 1);
+		account_io(conn, &msg, true);
+		return;
 	}
 
-	/* Update relevant header fields and fill in the message body. */
-	bdata->hdr.msg.type = type;
-	bdata->hdr.msg.len = len;
+	/* Message is a child of the connection context for auto-cleanup. */
+	bdata = new_buffer(conn);
+	bdata->buffer = talloc_array(bdata, char, len);
+
+	/* Fill in the header and the message body. */
+	bdata->hdr.msg = msg;
 	memcpy(bdata->buffer, data, len);
 
 	/* Queue for later transmission. */
@@ -762,7 +845,7 @@ static void send_directory(struct connection *conn, const char *name)
 
 	name = canonicalize(conn, name);
 	node = get_node(conn, name, XS_PERM_READ);
-	if (!node) {
+	if (!node || !read_children(conn, node)) {
 		send_error(conn, errno);
 		return;
 	}
@@ -786,12 +869,7 @@ static void do_read(struct connection *conn, const char *name)
 
 static void delete_node_single(struct connection *conn, struct node *node)
 {
-	TDB_DATA key;
-
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
-
-	if (tdb_delete(tdb_context(conn), key) != 0) {
+	if (delete_record(conn, node->name) != 0) {
 		corrupt(conn, "Could not delete '%s'", node->name);
 		return;
 	}
@@ -804,35 +882,33 @@ static char *basename(const char *name)
 	return strrchr(name, '/') + 1;
 }
 
+/* The new node, linked to the parents that need creating along with it. */
 static struct node *construct_node(struct connection *conn, const char *name)
 {
-	const char *base;
-	unsigned int baselen;
 	struct node *parent, *node;
-	char *children, *parentname = get_parent(name);
+	char *parentname = get_parent(name);
+	bool new_parent = false;
 
 	/* If parent doesn't exist, create it. */
 	parent = read_node(conn, parentname);
-	if (!parent)
+	if (!parent) {
 		parent = construct_node(conn, parentname);
+		new_parent = true;
+	}
 	if (!parent)
 		return NULL;
 
 	if (domain_entry(conn) >= quota_nb_entry_per_domain)
 		return NULL;
 
-	/* Add child to parent. */
-	base = basename(name);
-	baselen = strlen(base) + 1;
-	children = talloc_array(name, char, parent->childlen + baselen);
-	memcpy(children, parent->children, parent->childlen);
-	memcpy(children + parent->childlen, base, baselen);
-	parent->children = children;
-	parent->childlen += baselen;
+	/* The store adds the child to the parent, but it still counts. */
+	if (!entry_fits(conn, parent, strlen(basename(name)) + 1)) {
+		errno = ENOSPC;
+		return NULL;
+	}
 
 	/* Allocate node */
 	node = talloc(name, struct node);
-	node->tdb = tdb_context(conn);
 	node->name = talloc_strdup(node, name);
 
 	/* Inherit permissions, except unprivileged domains own what they create */
@@ -845,24 +921,29 @@ static struct node *construct_node(struct connection *conn, const char *name)
 	/* No children, no data */
 	node->children = node->data = NULL;
 	node->childlen = node->datalen = 0;
-	node->parent = parent;
+	node->parent = new_parent ? parent : NULL;
 	domain_entry_inc(conn, node);
 	return node;
 }
 
-static int destroy_node(void *_node)
+/* Write node out after its new parents, removing them again if something
+ * goes wrong. */
+static bool write_new_nodes(struct connection *conn, struct node *node)
 {
-	struct node *node = _node;
-	TDB_DATA key;
+	struct node *i;
+	int saved_errno;
 
-	if (streq(node->name, "/"))
-		corrupt(NULL, "Destroying root node!");
+	if (node->parent && !write_new_nodes(conn, node->parent))
+		return false;
 
-	key.dptr = (void *)node->name;
-	key.dsize = strlen(node->name);
+	if (write_node(conn, node))
+		return true;
 
-	tdb_delete(node->tdb, key);
-	return 0;
+	saved_errno = errno;
+	for (i = node->parent; i; i = i->parent)
+		delete_record(conn, i->name);
+	errno = saved_errno;
+	return false;
 }
 
 static struct node *create_node(struct connection *conn, 
@@ -878,19 +959,12 @@ static struct node *create_node(struct connection *conn,
 	node->data = data;
 	node->datalen = datalen;
 
-	/* We write out the nodes down, setting destructor in case
-	 * something goes wrong. */
-	for (i = node; i; i = i->parent) {
-		if (!write_node(conn, i)) {
+	if (!write_new_nodes(conn, node)) {
+		for (i = node; i; i = i->parent)
 			domain_entry_dec(conn, i);
-			return NULL;
-		}
-		talloc_set_destructor(i, destroy_node);
+		return NULL;
 	}
 
-	/* OK, now remove destructors so they stay around */
-	for (i = node; i; i = i->parent)
-		talloc_set_destructor(i, NULL);
 	return node;
 }
 
@@ -967,12 +1041,13 @@ static void delete_node(struct connection *conn, struct node *node)
 {
 	unsigned int i;
 
-	/* Delete self, then delete children.  If we crash, then the worst
-	   that can happen is the children will continue to take up space, but
-	   will otherwise be unreachable. */
-	delete_node_single(conn, node);
+	if (!read_children(conn, node)) {
+		corrupt(conn, "Could not list children of '%s'", node->name);
+		return;
+	}
 
-	/* Delete children, too. */
+	/* Delete children, then self: the store takes the node off its
+	   parent. */
 	for (i = 0; i < node->childlen; i += strlen(node->children+i) + 1) {
 		struct node *child;
 
@@ -985,60 +1060,22 @@ static void delete_node(struct connection *conn, struct node *node)
 		else {
 			trace("delete_node: No child '%s/%s' found!\n",
 			      node->name, node->children + i);
-			/* Skip it, we've already deleted the parent. */
 		}
 	}
-}
 
-
-/* Delete memory using memmove. */
-static void memdel(void *mem, unsigned off, unsigned len, unsigned total)
-{
-	memmove(mem + off, mem + off + len, total - off - len);
-}
-
-
-static bool remove_child_entry(struct connection *conn, struct node *node,
-			       size_t offset)
-{
-	size_t childlen = strlen(node->children + offset);
-	memdel(node->children, offset, childlen + 1, node->childlen);
-	node->childlen -= childlen + 1;
-	return write_node(conn, node);
-}
-
-
-static bool delete_child(struct connection *conn,
-			 struct node *node, const char *childname)
-{
-	unsigned int i;
-
-	for (i = 0; i < node->childlen; i += strlen(node->children+i) + 1) {
-		if (streq(node->children+i, childname)) {
-			return remove_child_entry(conn, node, i);
-		}
-	}
-	corrupt(conn, "Can't find child '%s' in %s", childname, node->name);
-	return false;
+	delete_node_single(conn, node);
 }
 
 
 static int _rm(struct connection *conn, struct node *node, const char *name)
 {
-	/* Delete from parent first, then if we crash, the worst that can
-	   happen is the child will continue to take up space, but will
-	   otherwise be unreachable. */
+	/* The parent must exist, for the node to be taken off it. */
 	struct node *parent = read_node(conn, get_parent(name));
 	if (!parent) {
 		send_error(conn, EINVAL);
 		return 0;
 	}
 
-	if (!delete_child(conn, parent, basename(name))) {
-		send_error(conn, EINVAL);
-		return 0;
-	}
-
 	delete_node(conn, node);
 	return 1;
 }
@@ -1162,6 +1199,92 @@ static void do_set_perms(struct connection *conn, struct buffered_data *in)
 	send_ack(conn, XS_SET_PERMS);
 }
 
+/* The statistics of connection i, the n-th, on one line. */
+static char *stats_line(const void *ctx, struct connection *i,
+			unsigned int n)
+{
+	char *line;
+	unsigned int type;
+
+	if (i->domain)
+		line = talloc_asprintf(ctx, "%u dom%u", n, i->id);
+	else
+		line = talloc_asprintf(ctx, "%u socket%s", n,
+				       i->can_write ? "" : "-ro");
+	if (!line)
+		return NULL;
+
+	line = talloc_asprintf_append(line,
+		" bytes-in=%lu bytes-out=%lu time-us=%llu"
+		" watch-events=%lu coalesced=%lu dropped=%lu"
+		" conflicts=%lu entries=%d watches=%d transactions=%u",
+		i->stats.bytes_in, i->stats.bytes_out, i->stats.time_us,
+		i->stats.watch_events, i->watch_events_coalesced,
+		i->watch_events_dropped, i->stats.conflicts,
+		domain_entry(i), domain_watch(i), i->transaction_started);
+
+	for (type = 0; line && type <= XS_TYPE_COUNT; type++)
+		if (i->stats.requests[type])
+			line = talloc_asprintf_append(line, " %s=%lu",
+				type < XS_TYPE_COUNT ?
+				sockmsg_string(type) : "UNKNOWN",
+				i->stats.requests[type]);
+
+	return line;
+}
+
+/*
+ * Statistics of the connections, one line each, from the first-th on,
+ * after the quotas if first is 0: if they do not all fit, the reply ends
+ * with "more <n>", for the next request to start from the n-th.
+ */
+static void debug_stats(struct connection *conn, unsigned int first)
+{
+	struct connection *i;
+	unsigned int n = 0;
+	char *reply, *line;
+
+	if (first == 0)
+		reply = talloc_asprintf(conn, "quota entries=%d watches=%d "
+				"events=%d transactions=%d entry-size=%d\n",
+				quota_nb_entry_per_domain,
+				quota_nb_watch_per_domain,
+				quota_nb_watch_events, quota_max_transaction,
+				quota_max_entry_size);
+	else
+		reply = talloc_strdup(conn, "");
+	if (!reply)
+		goto nomem;
+
+	list_for_each_entry(i, &connections, list) {
+		if (n++ < first)
+			continue;
+
+		line = stats_line(reply, i, n - 1);
+		if (!line)
+			goto nomem;
+
+		/* Leave room for "more <n>". */
+		if (strlen(reply) + strlen(line) + 1 >
+		    XENSTORE_PAYLOAD_MAX - 32) {
+			reply = talloc_asprintf_append(reply, "more %u\n",
+						       n - 1);
+			break;
+		}
+		reply = talloc_asprintf_append(reply, "%s\n", line);
+		if (!reply)
+			goto nomem;
+	}
+	if (!reply)
+		goto nomem;
+
+	send_reply(conn, XS_DEBUG, reply, strlen(reply) + 1);
+	return;
+
+nomem:
+	send_error(conn, ENOMEM);
+}
+
 static void do_debug(struct connection *conn, struct buffered_data *in)
 {
 	int num;
@@ -1184,20 +1307,196 @@ static void do_debug(struct connection *conn, struct buffered_data *in)
 	if (streq(in->buffer, "check"))
 		check_store();
 
+	if (streq(in->buffer, "stats")) {
+		debug_stats(conn, num < 2 ? 0 :
+			    atoi(in->buffer + get_string(in, 0)));
+		return;
+	}
+
 	send_ack(conn, XS_DEBUG);
 }
 
+/* Serve a request which may be part of a XS_MULTI batch. */
+static bool do_multi_op(struct connection *conn, struct buffered_data *in)
+{
+	switch (in->hdr.msg.type) {
+	case XS_DIRECTORY:
+		send_directory(conn, onearg(in));
+		break;
+
+	case XS_READ:
+		do_read(conn, onearg(in));
+		break;
+
+	case XS_WRITE:
+		do_write(conn, in);
+		break;
+
+	case XS_MKDIR:
+		do_mkdir(conn, onearg(in));
+		break;
+
+	case XS_RM:
+		do_rm(conn, onearg(in));
+		break;
+
+	case XS_GET_PERMS:
+		do_get_perms(conn, onearg(in));
+		break;
+
+	case XS_SET_PERMS:
+		do_set_perms(conn, in);
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * A batch of requests, each a struct xsd_sockmsg followed by its payload,
+ * served in order in a transaction of their own, unless the batch is part
+ * of a transaction already.  The reply is the batch of their replies, or
+ * the first error, in which case nothing the batch did is committed.
+ */
+static void do_multi(struct connection *conn, struct buffered_data *in)
+{
+	struct buffered_data *batch_in = conn->in, *sub, *reply, *next;
+	struct transaction *own = NULL;
+	struct xsd_sockmsg hdr;
+	struct list_head *last;
+	LIST_HEAD(replies);
+	unsigned int off, len = 0;
+	bool direct_reply = conn->direct_reply, ok;
+	char *out;
+	int err;
+
+	if (!conn->transaction) {
+		own = transaction_new(in);
+		if (!own) {
+			send_error(conn, ENOMEM);
+			return;
+		}
+		conn->transaction = own;
+	}
+
+	for (off = 0; off < in->used; off += hdr.len) {
+		if (in->used - off < sizeof(hdr)) {
+			err = EINVAL;
+			goto fail;
+		}
+		memcpy(&hdr, in->buffer + off, sizeof(hdr));
+		off += sizeof(hdr);
+		if (hdr.len > in->used - off) {
+			err = EINVAL;
+			goto fail;
+		}
+
+		/* Replies echo the header of the batch, with their own type. */
+		sub = new_buffer(in);
+		if (!sub) {
+			err = ENOMEM;
+			goto fail;
+		}
+		sub->hdr.msg = in->hdr.msg;
+		sub->hdr.msg.type = hdr.type;
+		sub->hdr.msg.len = sub->used = hdr.len;
+		sub->buffer = talloc_memdup(sub, in->buffer + off, hdr.len);
+		if (!sub->buffer) {
+			err = ENOMEM;
+			goto fail;
+		}
+
+		/* Have the reply queued, to take it back below. */
+		last = conn->out_list.prev;
+		conn->in = sub;
+		conn->direct_reply = false;
+		ok = do_multi_op(conn, sub);
+		conn->direct_reply = direct_reply;
+		conn->in = batch_in;
+		if (!ok) {
+			err = EINVAL;
+			goto fail;
+		}
+
+		/* Take the reply back from the output queue. */
+		if (last->next == &conn->out_list) {
+			err = EIO;
+			goto fail;
+		}
+		reply = list_entry(last->next, struct buffered_data, list);
+		if (reply->hdr.msg.type == XS_ERROR) {
+			/* This is the reply to the batch. */
+			list_for_each_entry_safe(reply, next, &replies, list) {
+				list_del(&reply->list);
+				talloc_free(reply);
+			}
+			conn->transaction = NULL;
+			return;
+		}
+		list_move_tail(&reply->list, &replies);
+		len += sizeof(hdr) + reply->hdr.msg.len;
+	}
+
+	if (len > XENSTORE_PAYLOAD_MAX) {
+		err = E2BIG;
+		goto fail;
+	}
+	out = talloc_array(in, char, len);
+	if (!out) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	len = 0;
+	list_for_each_entry_safe(reply, next, &replies, list) {
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.type = reply->hdr.msg.type;
+		hdr.len = reply->hdr.msg.len;
+		memcpy(out + len, &hdr, sizeof(hdr));
+		memcpy(out + len + sizeof(hdr), reply->buffer, hdr.len);
+		len += sizeof(hdr) + hdr.len;
+		list_del(&reply->list);
+		talloc_free(reply);
+	}
+
+	if (own) {
+		conn->transaction = NULL;
+		err = transaction_commit(conn, own);
+		if (err) {
+			send_error(conn, err);
+			return;
+		}
+	}
+	send_reply(conn, XS_MULTI, out, len);
+	return;
+
+fail:
+	list_for_each_entry_safe(reply, next, &replies, list) {
+		list_del(&reply->list);
+		talloc_free(reply);
+	}
+	if (own)
+		conn->transaction = NULL;
+	send_error(conn, err);
+}
+
 /* Process "in" for conn: "in" will vanish after this conversation, so
  * we can talloc off it for temporary variables.  May free "conn".
  */
-static void process_message(struct connection *conn, struct buffered_data *in)
+void process_message(struct connection *conn, struct buffered_data *in)
 {
 	struct transaction *trans;
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
 
 	trans = transaction_lookup(conn, in->hdr.msg.tx_id);
 	if (IS_ERR(trans)) {
 		send_error(conn, -PTR_ERR(trans));
-		return;
+		goto out;
 	}
 
 	assert(conn->transaction == NULL);
@@ -1280,6 +1579,10 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 		do_reset_watches(conn);
 		break;
 
+	case XS_MULTI:
+		do_multi(conn, in);
+		break;
+
 	default:
 		eprintf("Client unknown operation %i", in->hdr.msg.type);
 		send_error(conn, ENOSYS);
@@ -1287,6 +1590,11 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 	}
 
 	conn->transaction = NULL;
+
+out:
+	gettimeofday(&end, NULL);
+	conn->stats.time_us += (end.tv_sec - start.tv_sec) * 1000000ULL +
+			       end.tv_usec - start.tv_usec;
 }
 
 static void consider_message(struct connection *conn)
@@ -1296,15 +1604,26 @@ static void consider_message(struct connection *conn)
 			sockmsg_string(conn->in->hdr.msg.type),
 			conn->in->hdr.msg.len, conn);
 
+	if (worker_submit(conn))
+		return;
+
+	/* Everything else sees the effects of all the requests before it. */
+	workers_drain();
+	conn->direct_reply = conn->domain != NULL;
 	process_message(conn, conn->in);
+	conn->direct_reply = false;
+	finish_message(conn);
+}
 
+void finish_message(struct connection *conn)
+{
 	talloc_free(conn->in);
 	conn->in = new_buffer(conn);
 }
 
 /* Errors in reading or allocating here mean we get out of sync, so we
- * drop the whole client connection. */
-static void handle_input(struct connection *conn)
+ * drop the whole client connection, and return false. */
+static bool handle_input(struct connection *conn)
 {
 	int bytes;
 	struct buffered_data *in = conn->in;
@@ -1317,7 +1636,7 @@ static void handle_input(struct connection *conn)
 			goto bad_client;
 		in->used += bytes;
 		if (in->used != sizeof(in->hdr))
-			return;
+			return true;
 
 		if (in->hdr.msg.len > XENSTORE_PAYLOAD_MAX) {
 			syslog(LOG_ERR, "Client tried to feed us %i",
@@ -1339,21 +1658,26 @@ static void handle_input(struct connection *conn)
 
 	in->used += bytes;
 	if (in->used != in->hdr.msg.len)
-		return;
+		return true;
 
 	trace_io(conn, in, 0);
+	account_io(conn, &in->hdr.msg, false);
 	consider_message(conn);
-	return;
+	return true;
 
 bad_client:
 	/* Kill it. */
 	talloc_free(conn);
+	return false;
 }
 
-static void handle_output(struct connection *conn)
+static bool handle_output(struct connection *conn)
 {
-	if (!write_messages(conn))
+	if (!write_messages(conn)) {
 		talloc_free(conn);
+		return false;
+	}
+	return true;
 }
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
@@ -1447,10 +1771,8 @@ static void accept_connection(int sock, bool canwrite)
 }
 #endif
 
-static int tdb_flags;
-
 /* We create initial nodes manually. */
-static void manual_node(const char *name, const char *child)
+static void manual_node(const char *name)
 {
 	struct node *node;
 	struct xs_permissions perms = { .id = 0, .perms = XS_PERM_NONE };
@@ -1459,9 +1781,6 @@ static void manual_node(const char *name, const char *child)
 	node->name = name;
 	node->perms = &perms;
 	node->num_perms = 1;
-	node->children = (char *)child;
-	if (child)
-		node->childlen = strlen(child) + 1;
 
 	if (!write_node(NULL, node))
 		barf_perror("Could not create initial node %s", name);
@@ -1470,13 +1789,7 @@ static void manual_node(const char *name, const char *child)
 
 static void setup_structure(void)
 {
-	char *tdbname;
-	tdbname = talloc_strdup(talloc_autofree_context(), xs_daemon_tdb());
-
-	if (!(tdb_flags & TDB_INTERNAL))
-		tdb_ctx = tdb_open(tdbname, 0, tdb_flags, O_RDWR, 0);
-
-	if (tdb_ctx) {
+	if (db_open(internal_db ? NULL : xs_daemon_tdb(), snapshot_interval)) {
 		/* XXX When we make xenstored able to restart, this will have
 		   to become cleverer, checking for existing domains and not
 		   removing the corresponding entries, but for now xenstored
@@ -1505,180 +1818,23 @@ static void setup_structure(void)
 		talloc_free(tlocal);
 	}
 	else {
-		tdb_ctx = tdb_open(tdbname, 7919, tdb_flags, O_RDWR|O_CREAT,
-				   0640);
-		if (!tdb_ctx)
-			barf_perror("Could not create tdb file %s", tdbname);
-
-		manual_node("/", "tool");
-		manual_node("/tool", "xenstored");
-		manual_node("/tool/xenstored", NULL);
+		manual_node("/");
+		manual_node("/tool");
+		manual_node("/tool/xenstored");
 
 		check_store();
 	}
-}
-
-
-static unsigned int hash_from_key_fn(void *k)
-{
-	char *str = k;
-	unsigned int hash = 5381;
-	char c;
-
-	while ((c = *str++))
-		hash = ((hash << 5) + hash) + (unsigned int)c;
-
-	return hash;
-}
-
-
-static int keys_equal_fn(void *key1, void *key2)
-{
-	return 0 == strcmp((char *)key1, (char *)key2);
-}
-
-
-static char *child_name(const char *s1, const char *s2)
-{
-	if (strcmp(s1, "/")) {
-		return talloc_asprintf(NULL, "%s/%s", s1, s2);
-	}
-	else {
-		return talloc_asprintf(NULL, "/%s", s2);
-	}
-}
-
-
-static void remember_string(struct hashtable *hash, const char *str)
-{
-	char *k = malloc(strlen(str) + 1);
-	strcpy(k, str);
-	hashtable_insert(hash, k, (void *)1);
-}
-
-
-/**
- * A node has a children field that names the children of the node, separated
- * by NULs.  We check whether there are entries in there that are duplicated
- * (and if so, delete the second one), and whether there are any that do not
- * have a corresponding child node (and if so, delete them).  Each valid child
- * is then recursively checked.
- *
- * No deleting is performed if the recovery flag is cleared (i.e. -R was
- * passed on the command line).
- *
- * As we go, we record each node in the given reachable hashtable.  These
- * entries will be used later in clean_store.
- */
-static void check_store_(const char *name, struct hashtable *reachable)
-{
-	struct node *node = read_node(NULL, name);
-
-	if (node) {
-		size_t i = 0;
-
-		struct hashtable * children =
-			create_hashtable(16, hash_from_key_fn, keys_equal_fn);
-
-		remember_string(reachable, name);
-
-		while (i < node->childlen) {
-			size_t childlen = strlen(node->children + i);
-			char * childname = child_name(node->name,
-						      node->children + i);
-			struct node *childnode = read_node(NULL, childname);
-			
-			if (childnode) {
-				if (hashtable_search(children, childname)) {
-					log("check_store: '%s' is duplicated!",
-					    childname);
-
-					if (recovery) {
-						remove_child_entry(NULL, node,
-								   i);
-						i -= childlen + 1;
-					}
-				}
-				else {
-					remember_string(children, childname);
-					check_store_(childname, reachable);
-				}
-			}
-			else {
-				log("check_store: No child '%s' found!\n",
-				    childname);
-
-				if (recovery) {
-					remove_child_entry(NULL, node, i);
-					i -= childlen + 1;
-				}
-			}
-
-			talloc_free(childnode);
-			talloc_free(childname);
-			i += childlen + 1;
-		}
-
-		hashtable_destroy(children, 0 /* Don't free values (they are
-						 all (void *)1) */);
-		talloc_free(node);
-	}
-	else {
-		/* Impossible, because no database should ever be without the
-		   root, and otherwise, we've just checked in our caller
-		   (which made a recursive call to get here). */
-		   
-		log("check_store: No child '%s' found: impossible!", name);
-	}
-}
-
-
-/**
- * Helper to clean_store below.
- */
-static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
-			void *private)
-{
-	struct hashtable *reachable = private;
-	char * name = talloc_strndup(NULL, key.dptr, key.dsize);
 
-	if (!hashtable_search(reachable, name)) {
-		log("clean_store: '%s' is orphaned!", name);
-		if (recovery) {
-			tdb_delete(tdb, key);
-		}
-	}
-
-	talloc_free(name);
-
-	return 0;
-}
-
-
-/**
- * Given the list of reachable nodes, iterate over the whole store, and
- * remove any that were not reached.
- */
-static void clean_store(struct hashtable *reachable)
-{
-	tdb_traverse(tdb_ctx, &clean_store_, reachable);
+	/* Start over from a snapshot of what we have now. */
+	db_snapshot();
 }
 
 
 static void check_store(void)
 {
-	char * root = talloc_strdup(NULL, "/");
-	struct hashtable * reachable =
-		create_hashtable(16, hash_from_key_fn, keys_equal_fn);
- 
 	log("Checking store ...");
-	check_store_(root, reachable);
-	clean_store(reachable);
+	db_check(recovery);
 	log("Checking store complete.");
-
-	hashtable_destroy(reachable, 0 /* Don't free values (they are all
-					  (void *)1) */);
-	talloc_free(root);
 }
 
 
@@ -1696,6 +1852,10 @@ static void corrupt(struct connection *conn, const char *fmt, ...)
 	log("corruption detected by connection %i: err %s: %s",
 	    conn ? (int)conn->id : -1, strerror(saved_errno), str);
 
+	if (in_worker()) {
+		worker_check_store();
+		return;
+	}
 	check_store();
 }
 
@@ -1781,10 +1941,16 @@ static void usage(void)
 "  --entry-nb <nb>     limit the number of entries per domain,\n"
 "  --entry-size <size> limit the size of entry per domain, and\n"
 "  --watch-nb <nb>     limit the number of watches per domain,\n"
+"  --watch-events <nb> number of watch events queued per connection above\n"
+"                      which each watch only sends one for its own path,\n"
 "  --transaction <nb>  limit the number of transaction allowed per domain,\n"
+"  --threads <nb>      number of threads serving read requests besides the\n"
+"                      main one (default 0),\n"
 "  --no-recovery       to request that no recovery should be attempted when\n"
 "                      the store is corrupted (debug only),\n"
 "  --internal-db       store database in memory, not on disk\n"
+"  --snapshot-interval <nb> changes to the store journaled on disk, at\n"
+"                      least, before they are folded into a new snapshot,\n"
 "  --preserve-local    to request that /local is preserved on start-up,\n"
 "  --verbose           to request verbose execution.\n");
 }
@@ -1803,11 +1969,14 @@ static struct option options[] = {
 	{ "entry-size", 1, NULL, 'S' },
 	{ "trace-file", 1, NULL, 'T' },
 	{ "transaction", 1, NULL, 't' },
+	{ "threads", 1, NULL, 'M' },
 	{ "no-recovery", 0, NULL, 'R' },
 	{ "preserve-local", 0, NULL, 'L' },
 	{ "internal-db", 0, NULL, 'I' },
+	{ "snapshot-interval", 1, NULL, 'J' },
 	{ "verbose", 0, NULL, 'V' },
 	{ "watch-nb", 1, NULL, 'W' },
+	{ "watch-events", 1, NULL, 'Q' },
 	{ NULL, 0, NULL, 0 } };
 
 extern void dump_conn(struct connection *conn); 
@@ -1861,8 +2030,14 @@ int main(int argc, char *argv[])
 		case 'T':
 			tracefile = optarg;
 			break;
+		case 'M':
+			nr_threads = strtol(optarg, NULL, 10);
+			break;
 		case 'I':
-			tdb_flags = TDB_INTERNAL|TDB_NOLOCK;
+			internal_db = true;
+			break;
+		case 'J':
+			snapshot_interval = strtol(optarg, NULL, 10);
 			break;
 		case 'V':
 			verbose = true;
@@ -1870,6 +2045,9 @@ int main(int argc, char *argv[])
 		case 'W':
 			quota_nb_watch_per_domain = strtol(optarg, NULL, 10);
 			break;
+		case 'Q':
+			quota_nb_watch_events = strtol(optarg, NULL, 10);
+			break;
 		case 'e':
 			dom0_event = strtol(optarg, NULL, 10);
 			break;
@@ -1898,8 +2076,11 @@ int main(int argc, char *argv[])
 	if (pidfile)
 		write_pidfile(pidfile);
 
-	/* Talloc leak reports go to stderr, which is closed if we fork. */
-	if (!dofork)
+	/*
+	 * Talloc leak reports go to stderr, which is closed if we fork.  They
+	 * track every allocation in a shared list, which threads can't do.
+	 */
+	if (!dofork && !nr_threads)
 		talloc_enable_leak_report_full();
 
 	/* Don't kill us with SIGPIPE. */
@@ -1911,6 +2092,8 @@ int main(int argc, char *argv[])
 	/* Setup the database */
 	setup_structure();
 
+	workers_init(nr_threads);
+
 	/* Listen to hypervisor. */
 	if (!no_domain_init)
 		domain_init();
@@ -1939,6 +2122,7 @@ int main(int argc, char *argv[])
 	/* Main loop. */
 	for (;;) {
 		struct connection *conn, *next;
+		unsigned int n;
 
 		if (poll(fds, nr_fds, timeout) < 0) {
 			if (errno == EINTR)
@@ -1992,6 +2176,21 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		if (workers_pollfd_idx != -1) {
+			if (fds[workers_pollfd_idx].revents & ~POLLIN) {
+				barf_perror("worker pipe poll failed");
+				break;
+			} else if (fds[workers_pollfd_idx].revents & POLLIN) {
+				workers_complete();
+				workers_pollfd_idx = -1;
+			}
+		}
+
+		if (workers_check_store_pending()) {
+			workers_drain();
+			check_store();
+		}
+
 		next = list_entry(connections.next, typeof(*conn), list);
 		if (&next->list != &connections)
 			talloc_increase_ref_count(next);
@@ -2004,15 +2203,20 @@ int main(int argc, char *argv[])
 				talloc_increase_ref_count(next);
 
 			if (conn->domain) {
-				if (domain_can_read(conn))
-					handle_input(conn);
+				/* Serve what is in the ring, and fill the
+				 * other one: the domain is notified once. */
+				for (n = 0; n < DOMAIN_BATCH && !conn->job &&
+					    domain_can_read(conn); n++)
+					if (!handle_input(conn))
+						break;
 				if (talloc_free(conn) == 0)
 					continue;
 
 				talloc_increase_ref_count(conn);
-				if (domain_can_write(conn) &&
-				    !list_empty(&conn->out_list))
-					handle_output(conn);
+				while (domain_can_write(conn) &&
+				       !list_empty(&conn->out_list))
+					if (!handle_output(conn))
+						break;
 				if (talloc_free(conn) == 0)
 					continue;
 			} else {
@@ -2044,6 +2248,8 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		domain_notify();
+
 		initialize_fds(*sock, &sock_pollfd_idx, *ro_sock,
 			       &ro_sock_pollfd_idx, &timeout);
 	}
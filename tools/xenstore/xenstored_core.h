@@ -50,7 +50,20 @@ struct buffered_data
 	char *buffer;
 };
 
+/* What a connection had xenstored do, for "xenstore-control stats". */
+struct conn_stats {
+	/* Requests by type, the last for unknown types. */
+	unsigned long requests[XS_TYPE_COUNT + 1];
+	unsigned long bytes_in, bytes_out;
+	unsigned long watch_events;
+	/* Transactions which failed to commit with EAGAIN. */
+	unsigned long conflicts;
+	/* Time spent serving requests. */
+	unsigned long long time_us;
+};
+
 struct connection;
+struct worker_job;
 typedef int connwritefn_t(struct connection *, const void *, unsigned int);
 typedef int connreadfn_t(struct connection *, void *, unsigned int);
 
@@ -72,6 +85,13 @@ struct connection
 	/* Buffered incoming data. */
 	struct buffered_data *in;
 
+	/* Request being served by a worker thread, if any. */
+	struct worker_job *job;
+
+	/* Can replies to the request being served go straight to the
+	 * domain's ring, rather than through out_list? */
+	bool direct_reply;
+
 	/* Buffered output data */
 	struct list_head out_list;
 
@@ -92,18 +112,42 @@ struct connection
 	/* My watches. */
 	struct list_head watches;
 
+	/* Watch events in out_list, and how many changes were merged into
+	 * one of those, in all or because there were too many queued. */
+	unsigned int nr_watch_events;
+	unsigned long watch_events_coalesced;
+	unsigned long watch_events_dropped;
+
+	struct conn_stats stats;
+
 	/* Methods for communicating over this connection: write can be NULL */
 	connwritefn_t *write;
 	connreadfn_t *read;
 };
 extern struct list_head connections;
 
+/*
+ * Layout of a node record, as in the snapshots of the store, keyed by the
+ * node's path.  Keep in sync with xs_tdb_dump.c.
+ */
+struct xs_tdb_record_hdr {
+	/* Value of the store generation count when last written. */
+	uint64_t generation;
+	uint32_t num_perms;
+	uint32_t datalen;
+	uint32_t childlen;
+	/* So that perms start at sizeof(struct xs_tdb_record_hdr). */
+	uint32_t pad;
+	struct xs_permissions perms[0];
+	/* Followed by data, then nul-separated children. */
+};
+
+/* Generation of a record, or NO_GENERATION for a node which does not exist. */
+#define NO_GENERATION	0
+
 struct node {
 	const char *name;
 
-	/* Database I came from */
-	TDB_CONTEXT *tdb;
-
 	/* Parent (optional) */
 	struct node *parent;
 
@@ -115,7 +159,7 @@ struct node {
 	unsigned int datalen;
 	void *data;
 
-	/* Children, each nul-terminated. */
+	/* Children, each nul-terminated: NULL until looked up. */
 	unsigned int childlen;
 	char *children;
 };
@@ -147,17 +191,12 @@ struct node *get_node(struct connection *conn,
 		      const char *name,
 		      enum xs_perm_type perm);
 
-/* Get TDB context for this connection */
-TDB_CONTEXT *tdb_context(struct connection *conn);
-
-/* Destructor for tdbs: required for transaction code */
-int destroy_tdb(void *_tdb);
-
-/* Replace the tdb: required for transaction code */
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb);
-
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read);
 
+/* Serve the request in, and get conn ready for the next one. */
+void process_message(struct connection *conn, struct buffered_data *in);
+void finish_message(struct connection *conn);
+
 
 /* Is this a valid node name? */
 bool is_valid_nodename(const char *node);
@@ -74,6 +74,9 @@ struct domain
 
 	/* number of watch for this domain */
 	int nbwatch;
+
+	/* Have we moved data in the rings since we last notified it? */
+	bool notify;
 };
 
 static LIST_HEAD(domains);
@@ -129,11 +132,51 @@ static int writechn(struct connection *conn,
 	xen_mb();
 	intf->rsp_prod += len;
 
-	xc_evtchn_notify(xce_handle, conn->domain->port);
+	if (len)
+		conn->domain->notify = true;
 
 	return len;
 }
 
+/* Copy len bytes of data into a ring at prod, wrapping around its end. */
+static XENSTORE_RING_IDX ring_copy(char *ring, XENSTORE_RING_IDX prod,
+				   const void *data, unsigned int len)
+{
+	unsigned int off = MASK_XENSTORE_IDX(prod);
+	unsigned int chunk = XENSTORE_RING_SIZE - off;
+
+	if (chunk > len)
+		chunk = len;
+	memcpy(ring + off, data, chunk);
+	memcpy(ring, (const char *)data + chunk, len - chunk);
+	return prod + len;
+}
+
+bool domain_write_message(struct connection *conn,
+			  const struct xsd_sockmsg *msg, const void *data)
+{
+	struct xenstore_domain_interface *intf = conn->domain->interface;
+	XENSTORE_RING_IDX cons, prod;
+
+	/* Must read indexes once, and before anything else, and verified. */
+	cons = intf->rsp_cons;
+	prod = intf->rsp_prod;
+	xen_mb();
+
+	if (!check_indexes(cons, prod) ||
+	    XENSTORE_RING_SIZE - (prod - cons) < sizeof(*msg) + msg->len)
+		return false;
+
+	prod = ring_copy(intf->rsp, prod, msg, sizeof(*msg));
+	prod = ring_copy(intf->rsp, prod, data, msg->len);
+	xen_mb();
+	intf->rsp_prod = prod;
+
+	conn->domain->notify = true;
+
+	return true;
+}
+
 static int readchn(struct connection *conn, void *data, unsigned int len)
 {
 	uint32_t avail;
@@ -159,7 +202,8 @@ static int readchn(struct connection *conn, void *data, unsigned int len)
 	xen_mb();
 	intf->req_cons += len;
 
-	xc_evtchn_notify(xce_handle, conn->domain->port);
+	if (len)
+		conn->domain->notify = true;
 
 	return len;
 }
@@ -250,6 +294,18 @@ void handle_event(void)
 		barf_perror("Failed to write to event fd");
 }
 
+void domain_notify(void)
+{
+	struct domain *domain;
+
+	list_for_each_entry(domain, &domains, list) {
+		if (domain->notify) {
+			domain->notify = false;
+			xc_evtchn_notify(xce_handle, domain->port);
+		}
+	}
+}
+
 bool domain_can_read(struct connection *conn)
 {
 	struct xenstore_domain_interface *intf = conn->domain->interface;
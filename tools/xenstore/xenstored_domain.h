@@ -55,6 +55,13 @@ void restore_existing_connections(void);
 bool domain_can_read(struct connection *conn);
 bool domain_can_write(struct connection *conn);
 
+/* Put a whole message straight in the ring, if there is room for it. */
+bool domain_write_message(struct connection *conn,
+			  const struct xsd_sockmsg *msg, const void *data);
+
+/* Reading and writing the rings only notify domains once this is called. */
+void domain_notify(void);
+
 bool domain_is_unprivileged(struct connection *conn);
 
 /* Quota manipulation */
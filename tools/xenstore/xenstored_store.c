@@ -0,0 +1,756 @@
+/*
+    Node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "talloc.h"
+#include "list.h"
+#include "utils.h"
+#include "hashtable.h"
+#include "xenstored_core.h"
+#include "xenstored_store.h"
+#include "xenstored_worker.h"
+
+#define log(...)							\
+	do {								\
+		char *s = talloc_asprintf(NULL, __VA_ARGS__);		\
+		trace("%s\n", s);					\
+		syslog(LOG_ERR, "%s",  s);				\
+		talloc_free(s);						\
+	} while (0)
+
+struct db_node
+{
+	/* On the children list of the parent. */
+	struct list_head sibling;
+
+	/* Children, in the order they were created, and the length of
+	 * their names, each nul-terminated. */
+	struct list_head children;
+	unsigned int childlen;
+
+	/* NULL for the root. */
+	struct db_node *parent;
+
+	char *name;
+
+	/* The record, with no children in it. */
+	TDB_DATA data;
+};
+
+/* All nodes, by name. */
+static struct hashtable *db_nodes;
+
+/* Stamped on each record written, to detect transaction conflicts. */
+static uint64_t generation = NO_GENERATION;
+
+/*
+ * Each change to the store is appended to the journal before being made,
+ * so that the snapshot and the journal replayed on top of it give the
+ * store back after xenstored is restarted.  The journal is not synced:
+ * the store does not outlive the domains it describes anyway.
+ */
+struct journal_entry
+{
+	/* Followed by the nul-terminated name, then the record unless the
+	 * node was deleted. */
+	uint32_t namelen;
+	uint32_t datalen;
+};
+
+/* NULL if the store only lives in memory. */
+static char *snapshot_name;
+static char *journal_name;
+static int journal_fd = -1;
+static off_t journal_size;
+static unsigned int journal_entries;
+static unsigned int snapshot_interval;
+
+static unsigned int hash_from_key_fn(void *k)
+{
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int keys_equal_fn(void *key1, void *key2)
+{
+	return 0 == strcmp((char *)key1, (char *)key2);
+}
+
+static TDB_DATA name_key(const char *name)
+{
+	TDB_DATA key;
+
+	key.dptr = (void *)name;
+	key.dsize = strlen(name);
+	return key;
+}
+
+/* Is data a node record, ending with childlen bytes of children? */
+static bool record_ok(TDB_DATA data)
+{
+	const struct xs_tdb_record_hdr *hdr = (void *)data.dptr;
+	const char *children;
+
+	if (data.dsize < sizeof(*hdr) || hdr->num_perms == 0 ||
+	    data.dsize != sizeof(*hdr)
+			  + (uint64_t)hdr->num_perms * sizeof(hdr->perms[0])
+			  + hdr->datalen + hdr->childlen)
+		return false;
+
+	children = (char *)data.dptr + data.dsize - hdr->childlen;
+	return hdr->childlen == 0 || children[hdr->childlen - 1] == '\0';
+}
+
+static struct db_node *find_db_node(const char *name)
+{
+	return db_nodes ? hashtable_search(db_nodes, (void *)name) : NULL;
+}
+
+/* Last component of the name of a node other than the root. */
+static const char *db_basename(const char *name)
+{
+	return strrchr(name, '/') + 1;
+}
+
+/* The parent a new node goes under: NULL, with errno set, if none. */
+static struct db_node *find_db_parent(const char *name)
+{
+	const char *slash = strrchr(name, '/');
+	struct db_node *parent;
+	char *parent_name;
+
+	if (slash == name)
+		parent_name = talloc_strdup(NULL, "/");
+	else
+		parent_name = talloc_strndup(NULL, name, slash - name);
+	if (!parent_name) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	parent = find_db_node(parent_name);
+	talloc_free(parent_name);
+	if (!parent)
+		errno = ENOENT;
+	return parent;
+}
+
+/* A change to the children of node is a change to node. */
+static void touch_db_node(struct db_node *node)
+{
+	if (node->data.dptr)
+		((struct xs_tdb_record_hdr *)node->data.dptr)->generation =
+			++generation;
+}
+
+/* A node with no record yet, linked to its parent. */
+static struct db_node *new_db_node(const char *name, struct db_node *parent)
+{
+	struct db_node *node;
+	char *key;
+
+	if (!db_nodes) {
+		db_nodes = create_hashtable(1024, hash_from_key_fn,
+					    keys_equal_fn);
+		if (!db_nodes) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	node = talloc_zero(NULL, struct db_node);
+	key = strdup(name);
+	if (!node || !key || !(node->name = talloc_strdup(node, name)) ||
+	    !hashtable_insert(db_nodes, key, node)) {
+		free(key);
+		talloc_free(node);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&node->children);
+	node->parent = parent;
+	if (parent) {
+		list_add_tail(&node->sibling, &parent->children);
+		parent->childlen += strlen(db_basename(name)) + 1;
+		touch_db_node(parent);
+	} else
+		INIT_LIST_HEAD(&node->sibling);
+	return node;
+}
+
+/* Unlink node from its parent, and free it and everything below it. */
+static void free_db_node(struct db_node *node)
+{
+	struct db_node *child, *next;
+
+	list_for_each_entry_safe(child, next, &node->children, sibling)
+		free_db_node(child);
+
+	if (node->parent) {
+		list_del(&node->sibling);
+		node->parent->childlen -= strlen(db_basename(node->name)) + 1;
+		touch_db_node(node->parent);
+	}
+	hashtable_remove(db_nodes, node->name);
+	talloc_free(node);
+}
+
+/* Fill in the names of the children of node. */
+static void get_db_children(struct db_node *node, char *p)
+{
+	struct db_node *child;
+	const char *base;
+	size_t len;
+
+	list_for_each_entry(child, &node->children, sibling) {
+		base = db_basename(child->name);
+		len = strlen(base) + 1;
+		memcpy(p, base, len);
+		p += len;
+	}
+}
+
+/* Record a change about to be made: data.dptr is NULL for a deletion. */
+static int journal_append(const char *name, TDB_DATA data)
+{
+	struct journal_entry entry;
+	char *buf;
+	size_t len;
+	ssize_t ret;
+
+	if (journal_fd < 0)
+		return 0;
+
+	entry.namelen = strlen(name) + 1;
+	entry.datalen = data.dptr ? data.dsize : 0;
+	len = sizeof(entry) + entry.namelen + entry.datalen;
+
+	buf = talloc_size(NULL, len);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(buf, &entry, sizeof(entry));
+	memcpy(buf + sizeof(entry), name, entry.namelen);
+	memcpy(buf + sizeof(entry) + entry.namelen, data.dptr, entry.datalen);
+
+	ret = write(journal_fd, buf, len);
+	talloc_free(buf);
+	if (ret != len) {
+		log("Writing to journal %s failed: %s", journal_name,
+		    ret < 0 ? strerror(errno) : "short write");
+		/* Don't leave half an entry for the next one to follow. */
+		if (ret > 0 && ftruncate(journal_fd, journal_size) != 0)
+			log("Truncating journal %s failed: %s", journal_name,
+			    strerror(errno));
+		errno = ENOSPC;
+		return -1;
+	}
+
+	journal_size += len;
+	journal_entries++;
+	return 0;
+}
+
+/* Write node and everything below it, the children back in the records. */
+static int snapshot_db_node(TDB_CONTEXT *tdb, struct db_node *node)
+{
+	struct xs_tdb_record_hdr *hdr;
+	struct db_node *child;
+	TDB_DATA data;
+	int ret;
+
+	data.dsize = node->data.dsize + node->childlen;
+	data.dptr = talloc_size(node, data.dsize);
+	if (!data.dptr) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(data.dptr, node->data.dptr, node->data.dsize);
+	hdr = (void *)data.dptr;
+	hdr->childlen = node->childlen;
+	get_db_children(node, (char *)data.dptr + node->data.dsize);
+
+	ret = tdb_store(tdb, name_key(node->name), data, TDB_REPLACE);
+	talloc_free(data.dptr);
+	if (ret != 0) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	list_for_each_entry(child, &node->children, sibling)
+		if (snapshot_db_node(tdb, child))
+			return -1;
+	return 0;
+}
+
+static int take_snapshot(void)
+{
+	struct db_node *root = find_db_node("/");
+	TDB_CONTEXT *tdb;
+	char *tmpname;
+	int ret = -1;
+
+	if (!snapshot_name)
+		return 0;
+
+	/* Try again after as many changes if this fails. */
+	journal_entries = 0;
+
+	tmpname = talloc_asprintf(NULL, "%s.new", snapshot_name);
+	if (!tmpname) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	unlink(tmpname);
+	tdb = tdb_open(tmpname, 7919, TDB_NOLOCK, O_RDWR|O_CREAT|O_EXCL,
+		       0640);
+	if (tdb) {
+		ret = root ? snapshot_db_node(tdb, root) : 0;
+		tdb_close(tdb);
+	}
+	if (ret == 0 && rename(tmpname, snapshot_name) != 0)
+		ret = -1;
+	if (ret != 0) {
+		log("Writing snapshot %s failed: %s", snapshot_name,
+		    strerror(errno));
+		unlink(tmpname);
+		goto out;
+	}
+
+	/* All the journal says is in the snapshot now. */
+	if (ftruncate(journal_fd, 0) != 0)
+		log("Truncating journal %s failed: %s", journal_name,
+		    strerror(errno));
+	else
+		journal_size = 0;
+
+ out:
+	talloc_free(tmpname);
+	return ret;
+}
+
+/*
+ * Fold the journal into a new snapshot once it has grown long enough,
+ * and no sooner than it has as many entries as the store has nodes, so
+ * that taking snapshots costs no more than journaling the changes.
+ */
+static void journal_written(void)
+{
+	if (snapshot_interval && journal_entries >= snapshot_interval &&
+	    journal_entries >= hashtable_count(db_nodes))
+		take_snapshot();
+}
+
+/* Store a copy of data as the record of name, creating the node. */
+static int store_db_node(const char *name, TDB_DATA data, bool journal)
+{
+	struct db_node *node, *parent = NULL;
+	bool created = false;
+	void *copy;
+
+	node = find_db_node(name);
+	if (!node) {
+		if (!streq(name, "/") && !(parent = find_db_parent(name)))
+			return -1;
+		node = new_db_node(name, parent);
+		if (!node)
+			return -1;
+		created = true;
+	}
+
+	copy = talloc_memdup(node, data.dptr, data.dsize);
+	if (!copy || (journal && journal_append(name, data))) {
+		if (!copy)
+			errno = ENOMEM;
+		talloc_free(copy);
+		if (created)
+			free_db_node(node);
+		return -1;
+	}
+
+	talloc_free(node->data.dptr);
+	node->data.dptr = copy;
+	node->data.dsize = data.dsize;
+	return 0;
+}
+
+int db_fetch(const void *ctx, const char *name, TDB_DATA *data)
+{
+	struct db_node *node;
+	int ret = -1;
+
+	store_lock();
+	node = find_db_node(name);
+	if (!node) {
+		errno = ENOENT;
+		goto out;
+	}
+
+	/* Callers get their own copy, to change as they like. */
+	data->dsize = node->data.dsize;
+	data->dptr = talloc_memdup(ctx, node->data.dptr, node->data.dsize);
+	if (!data->dptr) {
+		errno = ENOMEM;
+		goto out;
+	}
+	ret = 0;
+out:
+	store_unlock();
+	return ret;
+}
+
+int db_store(const char *name, TDB_DATA data)
+{
+	struct xs_tdb_record_hdr *hdr = (void *)data.dptr;
+	int ret;
+
+	store_lock();
+	hdr->generation = ++generation;
+	hdr->childlen = 0;
+	ret = store_db_node(name, data, true);
+	if (ret == 0)
+		journal_written();
+	store_unlock();
+	return ret;
+}
+
+int db_delete(const char *name)
+{
+	struct db_node *node;
+	int ret = -1;
+
+	store_lock();
+	node = find_db_node(name);
+	if (!node)
+		errno = ENOENT;
+	else if (!node->parent)
+		errno = EINVAL;
+	else if (journal_append(name, tdb_null) == 0) {
+		free_db_node(node);
+		journal_written();
+		ret = 0;
+	}
+	store_unlock();
+	return ret;
+}
+
+uint64_t db_generation(const char *name)
+{
+	struct db_node *node;
+	uint64_t gen = NO_GENERATION;
+
+	store_lock();
+	node = find_db_node(name);
+	if (node)
+		gen = ((struct xs_tdb_record_hdr *)node->data.dptr)->generation;
+	store_unlock();
+	return gen;
+}
+
+int db_children(const void *ctx, const char *name,
+		char **children, unsigned int *len)
+{
+	struct db_node *node;
+	int ret = -1;
+
+	store_lock();
+	node = find_db_node(name);
+	if (!node) {
+		errno = ENOENT;
+		goto out;
+	}
+
+	*children = talloc_size(ctx, node->childlen + 1);
+	if (!*children) {
+		errno = ENOMEM;
+		goto out;
+	}
+	get_db_children(node, *children);
+	*len = node->childlen;
+	ret = 0;
+out:
+	store_unlock();
+	return ret;
+}
+
+/* Load name and what is below it from a snapshot: returns how many. */
+static unsigned int load_db_node(TDB_CONTEXT *tdb, const char *name,
+				 struct db_node *parent)
+{
+	struct xs_tdb_record_hdr *hdr;
+	struct db_node *node;
+	TDB_DATA data;
+	unsigned int i, nr = 0;
+	char *children, *child;
+
+	if (find_db_node(name)) {
+		log("Loading snapshot: '%s' is duplicated!", name);
+		return 0;
+	}
+
+	data = tdb_fetch(tdb, name_key(name));
+	if (!data.dptr) {
+		log("Loading snapshot: No node '%s' found!", name);
+		return 0;
+	}
+	hdr = (void *)data.dptr;
+	if (!record_ok(data)) {
+		log("Loading snapshot: '%s' is corrupted!", name);
+		goto out;
+	}
+
+	node = new_db_node(name, parent);
+	if (!node)
+		barf_perror("Could not load node %s", name);
+	nr++;
+
+	children = (char *)data.dptr + data.dsize - hdr->childlen;
+	node->data.dsize = data.dsize - hdr->childlen;
+	node->data.dptr = talloc_memdup(node, data.dptr, node->data.dsize);
+	if (!node->data.dptr)
+		barf_perror("Could not load node %s", name);
+	((struct xs_tdb_record_hdr *)node->data.dptr)->childlen = 0;
+
+	/* Never hand out a generation found in the snapshot again. */
+	if (hdr->generation > generation)
+		generation = hdr->generation;
+
+	for (i = 0; i < hdr->childlen; i += strlen(children + i) + 1) {
+		child = streq(name, "/")
+			? talloc_asprintf(NULL, "/%s", children + i)
+			: talloc_asprintf(NULL, "%s/%s", name, children + i);
+		if (child && is_valid_nodename(child) &&
+		    !strchr(children + i, '/'))
+			nr += load_db_node(tdb, child, node);
+		else
+			log("Loading snapshot: '%s' has a bad child!", name);
+		talloc_free(child);
+	}
+
+ out:
+	talloc_free(data.dptr);
+	return nr;
+}
+
+static void load_snapshot(void)
+{
+	TDB_CONTEXT *tdb;
+	int nr_records;
+	unsigned int nr;
+
+	tdb = tdb_open(snapshot_name, 0, TDB_NOLOCK, O_RDONLY, 0);
+	if (!tdb) {
+		if (errno != ENOENT)
+			barf_perror("Could not open snapshot %s",
+				    snapshot_name);
+		return;
+	}
+
+	nr_records = tdb_traverse(tdb, NULL, NULL);
+	nr = load_db_node(tdb, "/", NULL);
+	if (nr_records > 0 && nr < (unsigned int)nr_records)
+		log("Loading snapshot: %u orphaned nodes dropped!",
+		    nr_records - nr);
+	tdb_close(tdb);
+}
+
+static void replay_journal(void)
+{
+	struct journal_entry entry;
+	struct db_node *node;
+	struct stat st;
+	TDB_DATA data;
+	char *buf, *name;
+	off_t off = 0;
+	ssize_t ret;
+
+	if (fstat(journal_fd, &st) != 0)
+		barf_perror("Could not stat journal %s", journal_name);
+	if (st.st_size == 0)
+		return;
+
+	buf = talloc_size(NULL, st.st_size);
+	if (!buf)
+		barf_perror("Could not read journal %s", journal_name);
+	while (off < st.st_size) {
+		ret = pread(journal_fd, buf + off, st.st_size - off, off);
+		if (ret <= 0)
+			barf_perror("Could not read journal %s",
+				    journal_name);
+		off += ret;
+	}
+
+	for (off = 0; st.st_size - off >= sizeof(entry); ) {
+		memcpy(&entry, buf + off, sizeof(entry));
+		if (entry.namelen > st.st_size - off - sizeof(entry) ||
+		    entry.datalen > st.st_size - off - sizeof(entry)
+				    - entry.namelen)
+			break;
+
+		name = buf + off + sizeof(entry);
+		data.dsize = entry.datalen;
+		data.dptr = entry.datalen
+			? talloc_memdup(buf, name + entry.namelen, data.dsize)
+			: NULL;
+		if (entry.namelen == 0 || name[entry.namelen - 1] != '\0' ||
+		    !is_valid_nodename(name) ||
+		    (entry.datalen && (!data.dptr || !record_ok(data)))) {
+			log("Replaying journal: bad entry at %lu!",
+			    (unsigned long)off);
+			break;
+		}
+
+		if (data.dptr) {
+			struct xs_tdb_record_hdr *hdr = (void *)data.dptr;
+
+			if (hdr->generation > generation)
+				generation = hdr->generation;
+			if (store_db_node(name, data, false) != 0)
+				log("Replaying journal: writing '%s': %s",
+				    name, strerror(errno));
+			talloc_free(data.dptr);
+		} else if ((node = find_db_node(name)) && node->parent)
+			free_db_node(node);
+
+		off += sizeof(entry) + entry.namelen + entry.datalen;
+		journal_entries++;
+	}
+
+	if (off != st.st_size) {
+		log("Replaying journal: %lu trailing bytes dropped!",
+		    (unsigned long)(st.st_size - off));
+		if (ftruncate(journal_fd, off) != 0)
+			barf_perror("Could not truncate journal %s",
+				    journal_name);
+	}
+	journal_size = off;
+	talloc_free(buf);
+}
+
+bool db_open(const char *path, unsigned int interval)
+{
+	snapshot_interval = interval;
+	if (!path)
+		return false;
+
+	snapshot_name = talloc_strdup(NULL, path);
+	journal_name = talloc_asprintf(NULL, "%s.journal", path);
+	if (!snapshot_name || !journal_name)
+		barf_perror("Could not open store");
+
+	load_snapshot();
+
+	journal_fd = open(journal_name, O_RDWR|O_CREAT|O_APPEND, 0640);
+	if (journal_fd < 0)
+		barf_perror("Could not open journal %s", journal_name);
+	fcntl(journal_fd, F_SETFD, FD_CLOEXEC);
+	replay_journal();
+
+	return find_db_node("/") != NULL;
+}
+
+int db_snapshot(void)
+{
+	int ret;
+
+	store_lock();
+	ret = take_snapshot();
+	store_unlock();
+	return ret;
+}
+
+/* Check node and what is below it: returns how many nodes there are. */
+static unsigned int check_db_node(struct db_node *node, bool repair)
+{
+	struct db_node *child, *next;
+	unsigned int nr = 1, childlen = 0;
+
+	list_for_each_entry_safe(child, next, &node->children, sibling) {
+		if (!record_ok(child->data) ||
+		    ((struct xs_tdb_record_hdr *)child->data.dptr)->childlen) {
+			log("check_store: '%s' is corrupted!", child->name);
+			if (repair && journal_append(child->name, tdb_null) == 0) {
+				free_db_node(child);
+				continue;
+			}
+		}
+		if (child->parent != node || find_db_node(child->name) != child)
+			log("check_store: '%s' is misplaced!", child->name);
+		childlen += strlen(db_basename(child->name)) + 1;
+		nr += check_db_node(child, repair);
+	}
+
+	if (childlen != node->childlen) {
+		log("check_store: children of '%s' miscounted!", node->name);
+		node->childlen = childlen;
+	}
+	return nr;
+}
+
+void db_check(bool repair)
+{
+	struct db_node *root;
+	unsigned int nr;
+
+	store_lock();
+	root = find_db_node("/");
+	if (!root || !record_ok(root->data)) {
+		/* Impossible, because no store should ever be without the
+		   root. */
+		log("check_store: No root node found: impossible!");
+		goto out;
+	}
+
+	nr = check_db_node(root, repair);
+	if (nr != hashtable_count(db_nodes))
+		log("check_store: %u nodes are orphaned!",
+		    hashtable_count(db_nodes) - nr);
+	journal_written();
+ out:
+	store_unlock();
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -0,0 +1,80 @@
+/*
+    Node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _XENSTORED_STORE_H
+#define _XENSTORED_STORE_H
+
+#include "xenstored_core.h"
+
+/*
+ * The committed store lives in memory, as a tree of nodes each indexing
+ * its own children.  Node records are as struct xs_tdb_record_hdr, but
+ * without the children, which the store keeps track of itself: storing a
+ * new node links it into its parent, deleting one unlinks it (and deletes
+ * whatever is left below it), and either counts as a change of the parent
+ * for transaction conflicts.
+ *
+ * The store can be backed by a snapshot, a tdb of the records with their
+ * children as xenstored always wrote them so that xs_tdb_dump can read
+ * it, and a journal of the changes made since, which is folded into a new
+ * snapshot every so often.
+ */
+
+/*
+ * Access node records in the committed store, bypassing any transaction.
+ * db_store() stamps the record with a new generation, and fails with
+ * ENOENT if the parent of a new node does not exist.  All return 0, or
+ * -1 with errno set; fetched records are allocated off ctx.
+ */
+int db_fetch(const void *ctx, const char *name, TDB_DATA *data);
+int db_store(const char *name, TDB_DATA data);
+int db_delete(const char *name);
+
+/* Generation of a node in the committed store, NO_GENERATION if absent. */
+uint64_t db_generation(const char *name);
+
+/* Names of the children of a node, each nul-terminated, off ctx. */
+int db_children(const void *ctx, const char *name,
+		char **children, unsigned int *len);
+
+/*
+ * Back the store with the snapshot at path and its journal, and load
+ * what they hold: returns false if there was nothing.  With a NULL path,
+ * the store only lives in memory.  A new snapshot is taken after interval
+ * changes, or as many as there are nodes if more, or only by db_snapshot()
+ * if interval is 0.
+ */
+bool db_open(const char *path, unsigned int interval);
+
+/* Write a snapshot of the store, and start over with an empty journal. */
+int db_snapshot(void);
+
+/* Check the store is consistent: with repair, drop what is not. */
+void db_check(bool repair);
+
+#endif /* _XENSTORED_STORE_H */
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
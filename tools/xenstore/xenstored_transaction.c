@@ -33,9 +33,35 @@
 #include "xenstored_transaction.h"
 #include "xenstored_watch.h"
 #include "xenstored_domain.h"
+#include "xenstored_store.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 
+/*
+ * A transaction keeps no copy of the store.  Instead it records each node
+ * it accesses, with the generation the node had when first seen, and
+ * keeps the nodes it writes or deletes to itself until it is committed.
+ * The commit only fails, with EAGAIN, if one of the accessed nodes has
+ * been written, created or deleted by someone else since.
+ */
+struct accessed_node
+{
+	/* List of all nodes accessed in the context of this transaction. */
+	struct list_head list;
+
+	/* The name of the node. */
+	char *node;
+
+	/* Generation when first accessed, NO_GENERATION if it didn't exist. */
+	uint64_t generation;
+
+	/* Written or deleted in this transaction? */
+	bool modified;
+
+	/* If modified, its new record: NULL dptr if deleted. */
+	TDB_DATA data;
+};
+
 struct changed_node
 {
 	/* List of all changed nodes in the context of this transaction. */
@@ -68,12 +94,8 @@ struct transaction
 	/* Connection-local identifier for this transaction. */
 	uint32_t id;
 
-	/* Generation when transaction started. */
-	unsigned int generation;
-
-	/* TDB to work on, and filename */
-	TDB_CONTEXT *tdb;
-	char *tdb_name;
+	/* List of accessed nodes. */
+	struct list_head accessed;
 
 	/* List of changed nodes. */
 	struct list_head changes;
@@ -83,12 +105,248 @@ struct transaction
 };
 
 extern int quota_max_transaction;
-static unsigned int generation;
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans)
+static struct accessed_node *find_accessed_node(struct transaction *trans,
+						const char *name)
+{
+	struct accessed_node *i;
+
+	list_for_each_entry(i, &trans->accessed, list)
+		if (streq(i->node, name))
+			return i;
+
+	return NULL;
+}
+
+static struct accessed_node *add_accessed_node(struct transaction *trans,
+					       const char *name,
+					       uint64_t generation)
+{
+	struct accessed_node *i;
+
+	i = talloc_zero(trans, struct accessed_node);
+	if (!i)
+		return NULL;
+	i->node = talloc_strdup(i, name);
+	if (!i->node) {
+		talloc_free(i);
+		return NULL;
+	}
+	i->generation = generation;
+	list_add_tail(&i->list, &trans->accessed);
+	return i;
+}
+
+static struct accessed_node *access_node(struct transaction *trans,
+					 const char *name)
+{
+	struct accessed_node *i = find_accessed_node(trans, name);
+
+	return i ? i : add_accessed_node(trans, name, db_generation(name));
+}
+
+int transaction_fetch(struct transaction *trans, const void *ctx,
+		      const char *name, TDB_DATA *data)
+{
+	struct accessed_node *i = find_accessed_node(trans, name);
+
+	if (i && i->modified) {
+		if (!i->data.dptr) {
+			errno = ENOENT;
+			return -1;
+		}
+		data->dsize = i->data.dsize;
+		data->dptr = talloc_memdup(ctx, i->data.dptr, i->data.dsize);
+		if (!data->dptr) {
+			errno = ENOMEM;
+			return -1;
+		}
+		return 0;
+	}
+
+	if (db_fetch(ctx, name, data)) {
+		if (errno == ENOENT && !i &&
+		    !add_accessed_node(trans, name, NO_GENERATION))
+			errno = ENOMEM;
+		return -1;
+	}
+
+	if (!i && !add_accessed_node(trans, name,
+			((struct xs_tdb_record_hdr *)data->dptr)->generation)) {
+		talloc_free(data->dptr);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+static int transaction_modify(struct transaction *trans, const char *name,
+			      TDB_DATA data)
+{
+	struct accessed_node *i = access_node(trans, name);
+
+	if (!i) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	talloc_free(i->data.dptr);
+	i->data.dsize = data.dsize;
+	i->data.dptr = NULL;
+	if (data.dptr) {
+		i->data.dptr = talloc_memdup(i, data.dptr, data.dsize);
+		if (!i->data.dptr) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	i->modified = true;
+	return 0;
+}
+
+int transaction_store(struct transaction *trans, const char *name,
+		      TDB_DATA data)
+{
+	return transaction_modify(trans, name, data);
+}
+
+int transaction_delete(struct transaction *trans, const char *name)
+{
+	struct accessed_node *i = find_accessed_node(trans, name);
+
+	if (i ? (i->modified && !i->data.dptr)
+	      : db_generation(name) == NO_GENERATION) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return transaction_modify(trans, name, tdb_null);
+}
+
+/* Name of node relative to dir, NULL if it is not a child of dir. */
+static const char *child_of(const char *node, const char *dir)
+{
+	size_t len = streq(dir, "/") ? 0 : strlen(dir);
+
+	if (strncmp(node, dir, len) != 0 || node[len] != '/' ||
+	    node[len + 1] == '\0' || strchr(node + len + 1, '/'))
+		return NULL;
+	return node + len + 1;
+}
+
+int transaction_children(struct transaction *trans, const void *ctx,
+			 const char *name, char **children, unsigned int *len)
+{
+	struct accessed_node *i;
+	const char *base;
+	unsigned int off, baselen;
+	char *p;
+
+	/* The committed children: the node was accessed reading it, so any
+	 * change to them makes the transaction fail. */
+	if (db_children(ctx, name, children, len)) {
+		if (errno != ENOENT)
+			return -1;
+		*children = NULL;
+		*len = 0;
+	}
+
+	/* Then those the transaction created or deleted. */
+	list_for_each_entry(i, &trans->accessed, list) {
+		if (!i->modified || !(base = child_of(i->node, name)))
+			continue;
+
+		baselen = strlen(base) + 1;
+		for (off = 0; off < *len; off += strlen(*children + off) + 1)
+			if (streq(*children + off, base))
+				break;
+
+		if (i->data.dptr && off == *len) {
+			p = talloc_realloc(ctx, *children, char,
+					   *len + baselen);
+			if (!p) {
+				errno = ENOMEM;
+				return -1;
+			}
+			memcpy(p + *len, base, baselen);
+			*children = p;
+			*len += baselen;
+		} else if (!i->data.dptr && off < *len) {
+			memmove(*children + off, *children + off + baselen,
+				*len - off - baselen);
+			*len -= baselen;
+		}
+	}
+
+	if (!*children) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+/* Have any of the nodes the transaction looked at changed since? */
+static bool transaction_conflicts(struct transaction *trans)
 {
-	return trans->tdb;
+	struct accessed_node *i;
+
+	list_for_each_entry(i, &trans->accessed, list)
+		if (db_generation(i->node) != i->generation)
+			return true;
+
+	return false;
+}
+
+/*
+ * The store wants parents created before their children, and deleting a
+ * node deletes its children: deletions go first, deepest first, then
+ * writes, shallowest first.  A parent's name is shorter than its child's.
+ */
+static int apply_order(const void *a, const void *b)
+{
+	const struct accessed_node *x = *(struct accessed_node **)a;
+	const struct accessed_node *y = *(struct accessed_node **)b;
+	size_t xlen = strlen(x->node), ylen = strlen(y->node);
+
+	if (!x->data.dptr != !y->data.dptr)
+		return x->data.dptr ? 1 : -1;
+	if (xlen == ylen)
+		return 0;
+	return (xlen < ylen) == !x->data.dptr ? 1 : -1;
+}
+
+/* Write the transaction's changes to the store: can't be undone. */
+static void transaction_apply(struct transaction *trans)
+{
+	struct accessed_node *i, **changes;
+	unsigned int nr = 0, n;
+
+	list_for_each_entry(i, &trans->accessed, list)
+		if (i->modified)
+			nr++;
+	if (nr == 0)
+		return;
+
+	changes = talloc_array(trans, struct accessed_node *, nr);
+	if (!changes) {
+		eprintf("> Committing failed: %s\n", strerror(ENOMEM));
+		return;
+	}
+
+	n = 0;
+	list_for_each_entry(i, &trans->accessed, list)
+		if (i->modified)
+			changes[n++] = i;
+	qsort(changes, nr, sizeof(*changes), apply_order);
+
+	for (n = 0; n < nr; n++) {
+		i = changes[n];
+		if (i->data.dptr ? db_store(i->node, i->data)
+				 : db_delete(i->node) && errno != ENOENT)
+			eprintf("> Committing %s failed: %s\n",
+				i->node, strerror(errno));
+	}
+	talloc_free(changes);
 }
 
 /* Callers get a change node (which can fail) and only commit after they've
@@ -97,11 +355,9 @@ void add_change_node(struct transaction *trans, const char *node, bool recurse)
 {
 	struct changed_node *i;
 
-	if (!trans) {
-		/* They're changing the global database. */
-		generation++;
+	/* Changes to the global database are tracked by generation. */
+	if (!trans)
 		return;
-	}
 
 	list_for_each_entry(i, &trans->changes, list)
 		if (streq(i->node, node))
@@ -118,9 +374,6 @@ static int destroy_transaction(void *_transaction)
 	struct transaction *trans = _transaction;
 
 	trace_destroy(trans, "transaction");
-	if (trans->tdb)
-		tdb_close(trans->tdb);
-	unlink(trans->tdb_name);
 	return 0;
 }
 
@@ -156,18 +409,13 @@ void do_transaction_start(struct connection *conn, struct buffered_data *in)
 
 	/* Attach transaction to input for autofree until it's complete */
 	trans = talloc(in, struct transaction);
-	INIT_LIST_HEAD(&trans->changes);
-	INIT_LIST_HEAD(&trans->changed_domains);
-	trans->generation = generation;
-	trans->tdb_name = talloc_asprintf(trans, "%s.%p",
-					  xs_daemon_tdb(), trans);
-	trans->tdb = tdb_copy(tdb_context(conn), trans->tdb_name);
-	if (!trans->tdb) {
-		send_error(conn, errno);
+	if (!trans) {
+		send_error(conn, ENOMEM);
 		return;
 	}
-	/* Make it close if we go away. */
-	talloc_steal(trans, trans->tdb);
+	INIT_LIST_HEAD(&trans->accessed);
+	INIT_LIST_HEAD(&trans->changes);
+	INIT_LIST_HEAD(&trans->changed_domains);
 
 	/* Pick an unused transaction identifier. */
 	do {
@@ -185,11 +433,47 @@ void do_transaction_start(struct connection *conn, struct buffered_data *in)
 	send_reply(conn, XS_TRANSACTION_START, id_str, strlen(id_str)+1);
 }
 
-void do_transaction_end(struct connection *conn, const char *arg)
+struct transaction *transaction_new(const void *ctx)
+{
+	struct transaction *trans;
+
+	trans = talloc_zero(ctx, struct transaction);
+	if (!trans)
+		return NULL;
+	INIT_LIST_HEAD(&trans->list);
+	INIT_LIST_HEAD(&trans->accessed);
+	INIT_LIST_HEAD(&trans->changes);
+	INIT_LIST_HEAD(&trans->changed_domains);
+
+	return trans;
+}
+
+int transaction_commit(struct connection *conn, struct transaction *trans)
 {
 	struct changed_node *i;
 	struct changed_domain *d;
+
+	if (transaction_conflicts(trans)) {
+		conn->stats.conflicts++;
+		return EAGAIN;
+	}
+	transaction_apply(trans);
+
+	/* fix domain entry for each changed domain */
+	list_for_each_entry(d, &trans->changed_domains, list)
+		domain_entry_fix(d->domid, d->nbentry);
+
+	/* Fire off the watches for everything that changed. */
+	list_for_each_entry(i, &trans->changes, list)
+		fire_watches(conn, i->node, i->recurse);
+
+	return 0;
+}
+
+void do_transaction_end(struct connection *conn, const char *arg)
+{
 	struct transaction *trans;
+	int err;
 
 	if (!arg || (!streq(arg, "T") && !streq(arg, "F"))) {
 		send_error(conn, EINVAL);
@@ -209,26 +493,11 @@ void do_transaction_end(struct connection *conn, const char *arg)
 	talloc_steal(arg, trans);
 
 	if (streq(arg, "T")) {
-		/* FIXME: Merge, rather failing on any change. */
-		if (trans->generation != generation) {
-			send_error(conn, EAGAIN);
+		err = transaction_commit(conn, trans);
+		if (err) {
+			send_error(conn, err);
 			return;
 		}
-		if (!replace_tdb(trans->tdb_name, trans->tdb)) {
-			send_error(conn, errno);
-			return;
-		}
-		/* Don't close this: we won! */
-		trans->tdb = NULL;
-
-		/* fix domain entry for each changed domain */
-		list_for_each_entry(d, &trans->changed_domains, list)
-			domain_entry_fix(d->domid, d->nbentry);
-
-		/* Fire off the watches for everything that changed. */
-		list_for_each_entry(i, &trans->changes, list)
-			fire_watches(conn, i->node, i->recurse);
-		generation++;
 	}
 	send_ack(conn, XS_TRANSACTION_END);
 }
@@ -35,8 +35,20 @@ void transaction_entry_dec(struct transaction *trans, unsigned int domid);
 void add_change_node(struct transaction *trans, const char *node,
                      bool recurse);
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans);
+/* Access a node record in the context of trans: see db_fetch() etc. */
+int transaction_fetch(struct transaction *trans, const void *ctx,
+		      const char *name, TDB_DATA *data);
+int transaction_store(struct transaction *trans, const char *name,
+		      TDB_DATA data);
+int transaction_delete(struct transaction *trans, const char *name);
+int transaction_children(struct transaction *trans, const void *ctx,
+			 const char *name, char **children, unsigned int *len);
+
+/* A transaction of the daemon's own, the client doesn't know about. */
+struct transaction *transaction_new(const void *ctx);
+
+/* Commit trans and fire its watches: EAGAIN if it conflicts. */
+int transaction_commit(struct connection *conn, struct transaction *trans);
 
 void conn_delete_all_transactions(struct connection *conn);
 
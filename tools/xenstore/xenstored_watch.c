@@ -24,30 +24,212 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <string.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 #include "xenstored_domain.h"
 
 extern int quota_nb_watch_per_domain;
+extern int quota_nb_watch_events;
+
+/*
+ * Watches are indexed by a tree of the watched paths and their ancestors,
+ * so that a change only visits the watches on its own path, its parents
+ * and, when removing, its children.  Special "@" paths hang off "/", as
+ * a watch on "/" sees everything.
+ */
+struct watch_node
+{
+	/* Watched path, or parent of one. */
+	char *path;
+
+	struct watch_node *parent;
+
+	/* Entry in the parent's list of children. */
+	struct list_head sibling;
+	struct list_head children;
+
+	/* Watches on exactly this path. */
+	struct list_head watches;
+
+	/* Watches and children, the node goes away when there are none. */
+	unsigned int refs;
+};
 
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on the same path */
+	struct list_head node_list;
+	struct watch_node *watch_node;
+	struct connection *conn;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
 	/* Is this relative to connnection's implicit path? */
 	const char *relative_path;
 
+	/* Only send one event, for node itself, until it has been sent? */
+	bool coalesce;
+
 	char *token;
 	char *node;
 };
 
+/*
+ * An event not sent yet: a change to the same path meanwhile needs no
+ * event of its own, the client will see it when handling this one.
+ * Lives as long as the message in the connection's output queue.
+ */
+struct watch_event
+{
+	/* Events of the watch. */
+	struct list_head list;
+
+	/* NULL once the watch is gone. */
+	struct watch *watch;
+
+	/* Path as sent. */
+	char *path;
+};
+
+/* All watch_nodes, by path. */
+static struct hashtable *watch_nodes;
+
+static unsigned int hash_from_key_fn(void *k)
+{
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int keys_equal_fn(void *key1, void *key2)
+{
+	return 0 == strcmp((char *)key1, (char *)key2);
+}
+
+/* Parent of a path in the watch tree, NULL for "/". */
+static char *watch_parent(const void *ctx, const char *path)
+{
+	char *slash;
+
+	if (streq(path, "/"))
+		return NULL;
+	slash = strrchr(path, '/');
+	if (!slash || slash == path)
+		return talloc_strdup(ctx, "/");
+	return talloc_strndup(ctx, path, slash - path);
+}
+
+static struct watch_node *find_watch_node(const char *path)
+{
+	return watch_nodes ? hashtable_search(watch_nodes, (void *)path) : NULL;
+}
+
+static void put_watch_node(struct watch_node *wn)
+{
+	struct watch_node *parent;
+
+	for (; wn && --wn->refs == 0; wn = parent) {
+		parent = wn->parent;
+		hashtable_remove(watch_nodes, wn->path);
+		list_del(&wn->sibling);
+		talloc_free(wn);
+	}
+}
+
+/* Get (a reference to) the node of path, creating it and its parents. */
+static struct watch_node *get_watch_node(const char *path)
+{
+	struct watch_node *wn, *parent = NULL;
+	char *parent_path, *key;
+
+	wn = find_watch_node(path);
+	if (wn) {
+		wn->refs++;
+		return wn;
+	}
+
+	if (!watch_nodes) {
+		watch_nodes = create_hashtable(16, hash_from_key_fn,
+					       keys_equal_fn);
+		if (!watch_nodes)
+			return NULL;
+	}
+
+	parent_path = watch_parent(NULL, path);
+	if (parent_path) {
+		parent = get_watch_node(parent_path);
+		talloc_free(parent_path);
+		if (!parent)
+			return NULL;
+	}
+
+	wn = talloc_zero(NULL, struct watch_node);
+	key = strdup(path);
+	if (!wn || !key || !(wn->path = talloc_strdup(wn, path)) ||
+	    !hashtable_insert(watch_nodes, key, wn)) {
+		free(key);
+		talloc_free(wn);
+		put_watch_node(parent);
+		return NULL;
+	}
+
+	wn->parent = parent;
+	wn->refs = 1;
+	INIT_LIST_HEAD(&wn->children);
+	INIT_LIST_HEAD(&wn->watches);
+	if (parent)
+		list_add_tail(&wn->sibling, &parent->children);
+	else
+		INIT_LIST_HEAD(&wn->sibling);
+	return wn;
+}
+
+static int destroy_watch_event(void *_event)
+{
+	struct watch_event *event = _event;
+
+	if (event->watch) {
+		list_del(&event->list);
+		event->watch->conn->nr_watch_events--;
+	}
+	return 0;
+}
+
+/* Path of an event on name, as the watch sees it. */
+static const char *event_path(struct watch *watch, const char *name)
+{
+	if (watch->relative_path) {
+		name += strlen(watch->relative_path);
+		if (*name == '/') /* Could be "" */
+			name++;
+	}
+	return name;
+}
+
+static struct watch_event *find_event(struct watch *watch, const char *path)
+{
+	struct watch_event *event;
+
+	list_for_each_entry(event, &watch->events, list)
+		if (streq(event->path, path))
+			return event;
+	return NULL;
+}
+
 static void add_event(struct connection *conn,
 		      struct watch *watch,
 		      const char *name)
@@ -55,6 +237,9 @@ static void add_event(struct connection *conn,
 	/* Data to send (node\0token\0). */
 	unsigned int len;
 	char *data;
+	struct buffered_data *bdata;
+	struct watch_event *event;
+	bool coalesce;
 
 	if (!check_event_node(name)) {
 		/* Can this conn load node, or see that it doesn't exist? */
@@ -72,10 +257,26 @@ static void add_event(struct connection *conn,
 			return;
 	}
 
-	if (watch->relative_path) {
-		name += strlen(watch->relative_path);
-		if (*name == '/') /* Could be "" */
-			name++;
+	coalesce = watch->coalesce;
+	if (coalesce)
+		name = watch->node;
+	name = event_path(watch, name);
+
+	/* Too many events queued: one for the watched path stands for all. */
+	if (conn->nr_watch_events >= quota_nb_watch_events) {
+		if (!streq(name, event_path(watch, watch->node))) {
+			if (!conn->watch_events_dropped)
+				trace("WATCH %p events queue full\n", conn);
+			conn->watch_events_dropped++;
+			name = event_path(watch, watch->node);
+		}
+		coalesce = true;
+	}
+
+	/* Otherwise every change gets its own event. */
+	if (coalesce && find_event(watch, name)) {
+		conn->watch_events_coalesced++;
+		return;
 	}
 
 	len = strlen(name) + 1 + strlen(watch->token) + 1;
@@ -84,30 +285,77 @@ static void add_event(struct connection *conn,
 	strcpy(data + strlen(name) + 1, watch->token);
 	send_reply(conn, XS_WATCH_EVENT, data, len);
 	talloc_free(data);
+
+	bdata = list_entry(conn->out_list.prev, struct buffered_data, list);
+	if (&bdata->list == &conn->out_list ||
+	    bdata->hdr.msg.type != XS_WATCH_EVENT)
+		return;
+	event = talloc(bdata, struct watch_event);
+	if (!event)
+		return;
+	event->watch = watch;
+	event->path = bdata->buffer;
+	list_add_tail(&event->list, &watch->events);
+	conn->nr_watch_events++;
+	talloc_set_destructor(event, destroy_watch_event);
+}
+
+/* Fire the watches on the children of wn, and their children. */
+static void fire_child_watches(struct watch_node *wn)
+{
+	struct watch_node *child;
+	struct watch *watch;
+
+	list_for_each_entry(child, &wn->children, sibling) {
+		list_for_each_entry(watch, &child->watches, node_list)
+			add_event(watch->conn, watch, watch->node);
+		fire_child_watches(child);
+	}
 }
 
 void fire_watches(struct connection *conn, const char *name, bool recurse)
 {
-	struct connection *i;
+	struct watch_node *wn, *i;
 	struct watch *watch;
+	char *path, *parent;
 
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, watch, watch->node);
-		}
+	/* Find the closest watched path: only its parents can have watches. */
+	path = talloc_strdup(NULL, name);
+	while (path && !(wn = find_watch_node(path))) {
+		parent = watch_parent(NULL, path);
+		talloc_free(path);
+		path = parent;
 	}
+	talloc_free(path);
+	if (!path)
+		return;
+
+	/* Create an event for each watch. */
+	for (i = wn; i; i = i->parent)
+		list_for_each_entry(watch, &i->watches, node_list)
+			add_event(watch->conn, watch, name);
+
+	if (recurse && streq(wn->path, name))
+		fire_child_watches(wn);
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+	struct watch_event *event, *next;
+
+	list_for_each_entry_safe(event, next, &watch->events, list) {
+		list_del(&event->list);
+		event->watch = NULL;
+		watch->conn->nr_watch_events--;
+	}
+
+	list_del(&watch->node_list);
+	put_watch_node(watch->watch_node);
 	trace_destroy(_watch, "watch");
 	return 0;
 }
@@ -115,10 +363,14 @@ static int destroy_watch(void *_watch)
 void do_watch(struct connection *conn, struct buffered_data *in)
 {
 	struct watch *watch;
-	char *vec[2];
-	bool relative;
-
-	if (get_strings(in, vec, ARRAY_SIZE(vec)) != ARRAY_SIZE(vec)) {
+	char *vec[3];
+	unsigned int num;
+	bool relative, coalesce = false;
+
+	num = get_strings(in, vec, ARRAY_SIZE(vec));
+	if (num == 3 && streq(vec[2], "coalesce"))
+		coalesce = true;
+	else if (num != 2) {
 		send_error(conn, EINVAL);
 		return;
 	}
@@ -156,6 +408,14 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 	watch = talloc(conn, struct watch);
 	watch->node = talloc_strdup(watch, vec[0]);
 	watch->token = talloc_strdup(watch, vec[1]);
+	watch->conn = conn;
+	watch->coalesce = coalesce;
+	watch->watch_node = get_watch_node(watch->node);
+	if (!watch->watch_node) {
+		talloc_free(watch);
+		send_error(conn, ENOMEM);
+		return;
+	}
 	if (relative)
 		watch->relative_path = get_implicit_path(conn);
 	else
@@ -165,6 +425,7 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
+	list_add_tail(&watch->node_list, &watch->watch_node->watches);
 	trace_create(watch, "watch");
 	talloc_set_destructor(watch, destroy_watch);
 	send_ack(conn, XS_WATCH);
@@ -0,0 +1,378 @@
+/*
+    Worker threads for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "talloc.h"
+#include "list.h"
+#include "utils.h"
+#include "xenstored_core.h"
+#include "xenstored_worker.h"
+
+#ifdef USE_PTHREAD
+
+#define MAX_WORKERS 64
+
+/*
+ * A request being served by a worker.  The worker answers on a private
+ * copy of the connection, with a private copy of the request, so that the
+ * request handlers and send_reply() work unchanged and the main loop can
+ * go on using the connection meanwhile.
+ */
+struct worker_job
+{
+	/* On queued_jobs, then on done_jobs. */
+	struct list_head list;
+
+	/* The connection the request came from, NULL once it is gone. */
+	struct connection *conn;
+
+	/* What the worker serves the request on. */
+	struct connection *shadow;
+};
+
+static unsigned int nr_workers;
+static pthread_t main_thread;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(queued_jobs);
+static LIST_HEAD(done_jobs);
+/* Jobs queued or being served. */
+static unsigned int jobs_in_flight;
+/* A worker found the store corrupted: check it from the main loop. */
+static bool check_store_pending;
+
+/* Written to when done_jobs stops being empty. */
+static int done_pipe[2] = { -1, -1 };
+
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *worker_main(void *arg)
+{
+	struct worker_job *job;
+	bool wake;
+	ssize_t ret;
+
+	for (;;) {
+		pthread_mutex_lock(&job_lock);
+		while (list_empty(&queued_jobs))
+			pthread_cond_wait(&job_cond, &job_lock);
+		job = list_entry(queued_jobs.next, struct worker_job, list);
+		list_del(&job->list);
+		pthread_mutex_unlock(&job_lock);
+
+		process_message(job->shadow, job->shadow->in);
+
+		pthread_mutex_lock(&job_lock);
+		wake = list_empty(&done_jobs);
+		list_add_tail(&job->list, &done_jobs);
+		if (--jobs_in_flight == 0)
+			pthread_cond_broadcast(&idle_cond);
+		pthread_mutex_unlock(&job_lock);
+
+		/* A full pipe wakes the main loop up just as well. */
+		if (wake) {
+			ret = write(done_pipe[1], "", 1);
+			(void)ret;
+		}
+	}
+
+	return NULL;
+}
+
+void workers_init(unsigned int nr)
+{
+	sigset_t all, old;
+	pthread_t thread;
+	unsigned int i;
+
+	if (nr == 0)
+		return;
+	if (nr > MAX_WORKERS)
+		nr = MAX_WORKERS;
+
+	if (pipe(done_pipe) != 0)
+		barf_perror("Failed to create worker pipe");
+	fcntl(done_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(done_pipe[1], F_SETFL, O_NONBLOCK);
+	fcntl(done_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(done_pipe[1], F_SETFD, FD_CLOEXEC);
+
+	main_thread = pthread_self();
+
+	/* Signals are for the main loop. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	for (i = 0; i < nr; i++) {
+		errno = pthread_create(&thread, NULL, worker_main, NULL);
+		if (errno)
+			barf_perror("Failed to create worker thread");
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	nr_workers = nr;
+}
+
+static bool can_serve(const struct buffered_data *in)
+{
+	if (in->hdr.msg.tx_id != 0)
+		return false;
+
+	switch (in->hdr.msg.type) {
+	case XS_READ:
+	case XS_DIRECTORY:
+	case XS_GET_PERMS:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool worker_submit(struct connection *conn)
+{
+	struct worker_job *job;
+	struct connection *shadow;
+	struct buffered_data *in;
+
+	if (!nr_workers || !can_serve(conn->in))
+		return false;
+
+	job = talloc(NULL, struct worker_job);
+	if (!job)
+		return false;
+	job->conn = conn;
+
+	job->shadow = shadow = talloc_zero(job, struct connection);
+	if (!shadow)
+		goto nomem;
+	shadow->fd = -1;
+	shadow->pollfd_idx = -1;
+	shadow->id = conn->id;
+	shadow->can_write = conn->can_write;
+	shadow->domain = conn->domain;
+	shadow->target = conn->target;
+	INIT_LIST_HEAD(&shadow->out_list);
+	INIT_LIST_HEAD(&shadow->transaction_list);
+	INIT_LIST_HEAD(&shadow->watches);
+
+	shadow->in = in = talloc(shadow, struct buffered_data);
+	if (!in)
+		goto nomem;
+	*in = *conn->in;
+	INIT_LIST_HEAD(&in->list);
+	in->buffer = talloc_memdup(in, conn->in->buffer, conn->in->used);
+	if (!in->buffer)
+		goto nomem;
+
+	conn->job = job;
+
+	pthread_mutex_lock(&job_lock);
+	list_add_tail(&job->list, &queued_jobs);
+	jobs_in_flight++;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+
+	return true;
+
+nomem:
+	talloc_free(job);
+	return false;
+}
+
+void workers_complete(void)
+{
+	LIST_HEAD(done);
+	struct worker_job *job, *next;
+	struct buffered_data *out, *tmp;
+	struct connection *conn;
+	char buf[64];
+
+	if (!nr_workers)
+		return;
+
+	while (read(done_pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&job_lock);
+	list_splice_init(&done_jobs, &done);
+	pthread_mutex_unlock(&job_lock);
+
+	list_for_each_entry_safe(job, next, &done, list) {
+		conn = job->conn;
+		if (conn) {
+			list_for_each_entry_safe(out, tmp,
+						 &job->shadow->out_list, list) {
+				talloc_steal(conn, out);
+				list_move_tail(&out->list, &conn->out_list);
+			}
+			conn->job = NULL;
+			conn->stats.time_us += job->shadow->stats.time_us;
+			finish_message(conn);
+		}
+		list_del(&job->list);
+		talloc_free(job);
+	}
+}
+
+void workers_drain(void)
+{
+	if (!nr_workers)
+		return;
+
+	pthread_mutex_lock(&job_lock);
+	while (jobs_in_flight)
+		pthread_cond_wait(&idle_cond, &job_lock);
+	pthread_mutex_unlock(&job_lock);
+
+	workers_complete();
+}
+
+void worker_cancel(struct connection *conn)
+{
+	if (!conn->job)
+		return;
+
+	pthread_mutex_lock(&job_lock);
+	conn->job->conn = NULL;
+	pthread_mutex_unlock(&job_lock);
+	conn->job = NULL;
+
+	/* The worker may still look at the domain and target of conn. */
+	workers_drain();
+}
+
+void worker_check_store(void)
+{
+	pthread_mutex_lock(&job_lock);
+	check_store_pending = true;
+	pthread_mutex_unlock(&job_lock);
+}
+
+bool workers_check_store_pending(void)
+{
+	bool pending;
+
+	if (!nr_workers)
+		return false;
+
+	pthread_mutex_lock(&job_lock);
+	pending = check_store_pending;
+	check_store_pending = false;
+	pthread_mutex_unlock(&job_lock);
+
+	return pending;
+}
+
+int workers_fd(void)
+{
+	return nr_workers ? done_pipe[0] : -1;
+}
+
+bool in_worker(void)
+{
+	return nr_workers && !pthread_equal(pthread_self(), main_thread);
+}
+
+void store_lock(void)
+{
+	if (nr_workers)
+		pthread_mutex_lock(&store_mutex);
+}
+
+void store_unlock(void)
+{
+	if (nr_workers)
+		pthread_mutex_unlock(&store_mutex);
+}
+
+#else /* !defined(USE_PTHREAD) */
+
+void workers_init(unsigned int nr)
+{
+	if (nr)
+		barf("Worker threads are not supported");
+}
+
+bool worker_submit(struct connection *conn)
+{
+	return false;
+}
+
+void workers_drain(void)
+{
+}
+
+void worker_cancel(struct connection *conn)
+{
+}
+
+void worker_check_store(void)
+{
+}
+
+bool workers_check_store_pending(void)
+{
+	return false;
+}
+
+int workers_fd(void)
+{
+	return -1;
+}
+
+void workers_complete(void)
+{
+}
+
+bool in_worker(void)
+{
+	return false;
+}
+
+void store_lock(void)
+{
+}
+
+void store_unlock(void)
+{
+}
+
+#endif /* USE_PTHREAD */
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -0,0 +1,73 @@
+/*
+    Worker threads for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _XENSTORED_WORKER_H
+#define _XENSTORED_WORKER_H
+
+#include "xenstored_core.h"
+
+/*
+ * Read-only requests outside transactions may be served by a pool of
+ * worker threads, everything else is served by the main loop once the
+ * workers are idle.  A connection with a request in a worker is not
+ * read from until its replies have been queued, so each connection still
+ * sees its requests served in order.
+ */
+
+/* Start nr worker threads: with none, all requests are served inline. */
+void workers_init(unsigned int nr);
+
+/* Hand the complete request of conn to a worker, if one can serve it. */
+bool worker_submit(struct connection *conn);
+
+/* Wait for the workers to be idle, and queue the replies they made. */
+void workers_drain(void);
+
+/* conn is going away: forget about the request it has in a worker. */
+void worker_cancel(struct connection *conn);
+
+/* From a worker: the store needs checking, which the main loop does. */
+void worker_check_store(void);
+
+/* Has a worker asked for the store to be checked?  Clears the request. */
+bool workers_check_store_pending(void);
+
+/* File descriptor readable when workers have replies to queue, or -1. */
+int workers_fd(void);
+
+/* Queue the replies of the requests the workers are done with. */
+void workers_complete(void);
+
+/* Is the caller a worker thread? */
+bool in_worker(void);
+
+/* Serialise access to the store. */
+void store_lock(void);
+void store_unlock(void);
+
+#endif /* _XENSTORED_WORKER_H */
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
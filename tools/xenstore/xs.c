@@ -42,6 +42,17 @@ struct xs_stored_msg {
 	char *body;
 };
 
+/* An asynchronous request, from when it is sent until it is completed. */
+struct xs_async {
+	struct list_head list;
+	uint32_t req_id;
+	enum xsd_sockmsg_type type;
+	xs_async_fn *done;
+	void *arg;
+	/* The reply once it came, or NULL if the connection was lost. */
+	struct xs_stored_msg *reply;
+};
+
 #ifdef USE_PTHREAD
 
 #include <pthread.h>
@@ -71,23 +82,38 @@ struct xs_handle {
 	bool unwatch_filter;
 
 	/*
-         * A list of replies. Currently only one will ever be outstanding
-         * because we serialise requests. The requester can wait on the
-         * conditional variable for its response.
+         * A list of replies to the requests in flight, which may be any
+         * number: each requester waits on the conditional variable for
+         * the response with its request id. Replies to asynchronous
+         * requests are moved from async_list to async_done_list instead.
          */
 	struct list_head reply_list;
+	struct list_head async_list;
+	struct list_head async_done_list;
 	pthread_mutex_t reply_mutex;
 	pthread_cond_t reply_condvar;
 
-	/* One request at a time. */
+	/*
+         * Without a read thread, one of the requesters waiting for their
+         * response reads messages off the comms channel for all of them.
+         */
+	bool reading;
+
+	/* Clients can select() on this pipe to wait for async replies. */
+	int async_pipe[2];
+
+	/* Writing requests, one at a time, with their ids. */
 	pthread_mutex_t request_mutex;
+	uint32_t req_id;
 
 	/* Lock discipline:
-	 *  Only holder of the request lock may write to h->fd.
-	 *  Only holder of the request lock may access read_thr_exists.
-	 *  If read_thr_exists==0, only holder of request lock may read h->fd;
+	 *  Only holder of the request lock may write to h->fd or req_id.
+	 *  Only holder of the reply lock may access read_thr_exists.
+	 *  If read_thr_exists==0, only the holder of the reply lock which
+	 *  set reading may read h->fd, after dropping the lock;
 	 *  If read_thr_exists==1, only the read thread may read h->fd.
-	 *  Only holder of the reply lock may access reply_list.
+	 *  Only holder of the reply lock may access reply_list, async_list,
+	 *  async_done_list and reading.
 	 *  Only holder of the watch lock may access watch_list.
 	 * Lock hierarchy:
 	 *  The order in which to acquire locks is
@@ -100,6 +126,7 @@ struct xs_handle {
 #define mutex_lock(m)		pthread_mutex_lock(m)
 #define mutex_unlock(m)		pthread_mutex_unlock(m)
 #define condvar_signal(c)	pthread_cond_signal(c)
+#define condvar_broadcast(c)	pthread_cond_broadcast(c)
 #define condvar_wait(c,m)	pthread_cond_wait(c,m)
 #define cleanup_push(f, a)	\
     pthread_cleanup_push((void (*)(void *))(f), (void *)(a))
@@ -124,16 +151,22 @@ static void *read_thread(void *arg);
 struct xs_handle {
 	int fd;
 	struct list_head reply_list;
+	struct list_head async_list;
+	struct list_head async_done_list;
 	struct list_head watch_list;
 	/* Clients can select() on this pipe to wait for a watch to fire. */
 	int watch_pipe[2];
+	/* Unused: callers poll fd itself for async replies. */
+	int async_pipe[2];
 	/* Filtering watch event in unwatch function? */
 	bool unwatch_filter;
+	uint32_t req_id;
 };
 
 #define mutex_lock(m)		((void)0)
 #define mutex_unlock(m)		((void)0)
 #define condvar_signal(c)	((void)0)
+#define condvar_broadcast(c)	((void)0)
 #define condvar_wait(c,m)	((void)0)
 #define cleanup_push(f, a)	((void)0)
 #define cleanup_pop(run)	((void)0)
@@ -250,11 +283,16 @@ static struct xs_handle *get_handle(const char *connect_to)
 	h->fd = fd;
 
 	INIT_LIST_HEAD(&h->reply_list);
+	INIT_LIST_HEAD(&h->async_list);
+	INIT_LIST_HEAD(&h->async_done_list);
 	INIT_LIST_HEAD(&h->watch_list);
 
 	/* Watch pipe is allocated on demand in xs_fileno(). */
 	h->watch_pipe[0] = h->watch_pipe[1] = -1;
 
+	/* Async pipe is allocated on demand in xs_async_fileno(). */
+	h->async_pipe[0] = h->async_pipe[1] = -1;
+
 	h->unwatch_filter = false;
 
 #ifdef USE_PTHREAD
@@ -303,6 +341,18 @@ struct xs_handle *xs_open(unsigned long flags)
 	return xsh;
 }
 
+static void close_free_async(struct list_head *list) {
+	struct xs_async *async, *tasync;
+
+	list_for_each_entry_safe(async, tasync, list, list) {
+		if (async->reply) {
+			free(async->reply->body);
+			free(async->reply);
+		}
+		free(async);
+	}
+}
+
 static void close_free_msgs(struct xs_handle *h) {
 	struct xs_stored_msg *msg, *tmsg;
 
@@ -311,6 +361,9 @@ static void close_free_msgs(struct xs_handle *h) {
 		free(msg);
 	}
 
+	close_free_async(&h->async_list);
+	close_free_async(&h->async_done_list);
+
 	list_for_each_entry_safe(msg, tmsg, &h->watch_list, list) {
 		free(msg->body);
 		free(msg);
@@ -323,6 +376,11 @@ static void close_fds_free(struct xs_handle *h) {
 		close(h->watch_pipe[1]);
 	}
 
+	if (h->async_pipe[0] != -1) {
+		close(h->async_pipe[0]);
+		close(h->async_pipe[1]);
+	}
+
         close(h->fd);
         
 	free(h);
@@ -419,33 +477,96 @@ static int get_error(const char *errorstring)
 	return xsd_errors[i].errnum;
 }
 
-/* Adds extra nul terminator, because we generally (always?) hold strings. */
-static void *read_reply(
-	struct xs_handle *h, enum xsd_sockmsg_type *type, unsigned int *len)
+/* Find the reply to request req_id: caller holds the reply lock. */
+static struct xs_stored_msg *find_reply(struct xs_handle *h, uint32_t req_id)
 {
 	struct xs_stored_msg *msg;
-	char *body;
-	int read_from_thread;
 
-	read_from_thread = read_thread_exists(h);
+	list_for_each_entry(msg, &h->reply_list, list)
+		if (msg->hdr.req_id == req_id)
+			return msg;
+	return NULL;
+}
 
-	/* Read from comms channel ourselves if there is no reader thread. */
-	if (!read_from_thread && (read_message(h, 0) == -1))
-		return NULL;
+/* Find async request req_id: caller holds the reply lock. */
+static struct xs_async *find_async(struct xs_handle *h, uint32_t req_id)
+{
+	struct xs_async *async;
+
+	list_for_each_entry(async, &h->async_list, list)
+		if (async->req_id == req_id)
+			return async;
+	return NULL;
+}
+
+/* Hand async over to xs_async_complete(): caller holds the reply lock. */
+static void complete_async(struct xs_handle *h, struct xs_async *async)
+{
+	char c = 0;
+
+	/* Kick users out of their select() loop. */
+	if (list_empty(&h->async_done_list) && (h->async_pipe[1] != -1))
+		while (write(h->async_pipe[1], &c, 1) != 1)
+			continue;
+
+	list_move_tail(&async->list, &h->async_done_list);
+}
+
+/* The connection is lost: so are the replies to all async requests. */
+static void fail_async(struct xs_handle *h)
+{
+	while (!list_empty(&h->async_list))
+		complete_async(h, list_top(&h->async_list,
+					   struct xs_async, list));
+}
+
+/* Adds extra nul terminator, because we generally (always?) hold strings. */
+static void *read_reply(struct xs_handle *h, uint32_t req_id,
+			enum xsd_sockmsg_type *type, unsigned int *len)
+{
+	struct xs_stored_msg *msg;
+	char *body;
+	int ret, saved_errno;
 
 	mutex_lock(&h->reply_mutex);
+	while (!(msg = find_reply(h, req_id))) {
 #ifdef USE_PTHREAD
-	while (list_empty(&h->reply_list) && read_from_thread && h->fd != -1)
-		condvar_wait(&h->reply_condvar, &h->reply_mutex);
+		if (h->fd == -1)
+			break;
+		if (read_thread_exists(h) || h->reading) {
+			condvar_wait(&h->reply_condvar, &h->reply_mutex);
+			continue;
+		}
+		h->reading = true;
 #endif
-	if (list_empty(&h->reply_list)) {
+		/* Read from comms channel ourselves if nobody else does. */
+		mutex_unlock(&h->reply_mutex);
+		ret = read_message(h, 0);
+		saved_errno = errno;
+		mutex_lock(&h->reply_mutex);
+#ifdef USE_PTHREAD
+		h->reading = false;
+		/* Someone else may have to read now, or got their reply. */
+		condvar_broadcast(&h->reply_condvar);
+#endif
+		if (ret == -1) {
+			/* Further communication is unsafe, as in read_thread. */
+			if (h->fd != -1) {
+				close(h->fd);
+				h->fd = -1;
+			}
+			fail_async(h);
+			mutex_unlock(&h->reply_mutex);
+			errno = saved_errno;
+			return NULL;
+		}
+	}
+	if (!msg) {
 		mutex_unlock(&h->reply_mutex);
 		errno = EINVAL;
 		return NULL;
 	}
-	msg = list_top(&h->reply_list, struct xs_stored_msg, list);
 	list_del(&msg->list);
-	assert(list_empty(&h->reply_list));
 	mutex_unlock(&h->reply_mutex);
 
 	*type = msg->hdr.type;
@@ -458,29 +579,26 @@ static void *read_reply(
 	return body;
 }
 
-/* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
-static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
-		      enum xsd_sockmsg_type type,
-		      const struct iovec *iovec,
-		      unsigned int num_vecs,
-		      unsigned int *len)
+/*
+ * Send a request with a new id, filling in the rest of its header.  If
+ * async, it is registered first, so that its reply finds it.  Returns
+ * false and sets errno on error.
+ */
+static bool xs_send(struct xs_handle *h, struct xsd_sockmsg *msg,
+		    const struct iovec *iovec, unsigned int num_vecs,
+		    struct xs_async *async)
 {
-	struct xsd_sockmsg msg;
-	void *ret = NULL;
 	int saved_errno;
 	unsigned int i;
 	struct sigaction ignorepipe, oldact;
 
-	msg.tx_id = t;
-	msg.req_id = 0;
-	msg.type = type;
-	msg.len = 0;
+	msg->len = 0;
 	for (i = 0; i < num_vecs; i++)
-		msg.len += iovec[i].iov_len;
+		msg->len += iovec[i].iov_len;
 
-	if (msg.len > XENSTORE_PAYLOAD_MAX) {
+	if (msg->len > XENSTORE_PAYLOAD_MAX) {
 		errno = E2BIG;
-		return 0;
+		return false;
 	}
 
 	ignorepipe.sa_handler = SIG_IGN;
@@ -490,20 +608,68 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 
 	mutex_lock(&h->request_mutex);
 
-	if (!xs_write_all(h->fd, &msg, sizeof(msg)))
+	/* 0 is left for failures of the async calls. */
+	if (++h->req_id == 0)
+		h->req_id = 1;
+	msg->req_id = h->req_id;
+
+	if (async) {
+		async->req_id = msg->req_id;
+		async->type = msg->type;
+		async->reply = NULL;
+		mutex_lock(&h->reply_mutex);
+		list_add_tail(&async->list, &h->async_list);
+		mutex_unlock(&h->reply_mutex);
+	}
+
+	if (!xs_write_all(h->fd, msg, sizeof(*msg)))
 		goto fail;
 
 	for (i = 0; i < num_vecs; i++)
 		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
 			goto fail;
 
-	ret = read_reply(h, &msg.type, len);
-	if (!ret)
-		goto fail;
-
 	mutex_unlock(&h->request_mutex);
+	sigaction(SIGPIPE, &oldact, NULL);
+	return true;
 
+fail:
+	/* We're in a bad state, so close fd. */
+	saved_errno = errno;
+	if (async) {
+		mutex_lock(&h->reply_mutex);
+		list_del(&async->list);
+		mutex_unlock(&h->reply_mutex);
+	}
+	close(h->fd);
+	h->fd = -1;
+	mutex_unlock(&h->request_mutex);
 	sigaction(SIGPIPE, &oldact, NULL);
+	errno = saved_errno;
+	return false;
+}
+
+/* Send message to xs, get malloc'ed reply.  NULL and set errno on error. */
+static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
+		      enum xsd_sockmsg_type type,
+		      const struct iovec *iovec,
+		      unsigned int num_vecs,
+		      unsigned int *len)
+{
+	struct xsd_sockmsg msg;
+	void *ret = NULL;
+	int saved_errno;
+
+	msg.tx_id = t;
+	msg.type = type;
+
+	if (!xs_send(h, &msg, iovec, num_vecs, NULL))
+		return NULL;
+
+	ret = read_reply(h, msg.req_id, &msg.type, len);
+	if (!ret)
+		return NULL;
+
 	if (msg.type == XS_ERROR) {
 		saved_errno = get_error(ret);
 		free(ret);
@@ -513,21 +679,12 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 
 	if (msg.type != type) {
 		free(ret);
-		saved_errno = EBADF;
-		goto close_fd;
+		close(h->fd);
+		h->fd = -1;
+		errno = EBADF;
+		return NULL;
 	}
 	return ret;
-
-fail:
-	/* We're in a bad state, so close fd. */
-	saved_errno = errno;
-	mutex_unlock(&h->request_mutex);
-	sigaction(SIGPIPE, &oldact, NULL);
-close_fd:
-	close(h->fd);
-	h->fd = -1;
-	errno = saved_errno;
-	return NULL;
 }
 
 /* free(), but don't change errno. */
@@ -714,15 +871,9 @@ bool xs_restrict(struct xs_handle *h, unsigned domid)
 	return xs_bool(xs_single(h, XBT_NULL, XS_RESTRICT, buf, NULL));
 }
 
-/* Watch a node for changes (poll on fd to detect, or call read_watch()).
- * When the node (or any child) changes, fd will become readable.
- * Token is returned when watch is read, to allow matching.
- * Returns false on failure.
- */
-bool xs_watch(struct xs_handle *h, const char *path, const char *token)
+/* Have a reader thread pull messages off the comms channel, if we can. */
+static bool read_thread_start(struct xs_handle *h)
 {
-	struct iovec iov[2];
-
 #ifdef USE_PTHREAD
 #define DEFAULT_THREAD_STACKSIZE (16 * 1024)
 #define READ_THREAD_STACKSIZE 					\
@@ -730,18 +881,21 @@ bool xs_watch(struct xs_handle *h, const char *path, const char *token)
 	PTHREAD_STACK_MIN : DEFAULT_THREAD_STACKSIZE)
 
 	/* We dynamically create a reader thread on demand. */
-	mutex_lock(&h->request_mutex);
+	mutex_lock(&h->reply_mutex);
+	/* It takes over from any requester reading for itself. */
+	while (h->reading)
+		condvar_wait(&h->reply_condvar, &h->reply_mutex);
 	if (!h->read_thr_exists) {
 		sigset_t set, old_set;
 		pthread_attr_t attr;
 
 		if (pthread_attr_init(&attr) != 0) {
-			mutex_unlock(&h->request_mutex);
+			mutex_unlock(&h->reply_mutex);
 			return false;
 		}
 		if (pthread_attr_setstacksize(&attr, READ_THREAD_STACKSIZE) != 0) {
 			pthread_attr_destroy(&attr);
-			mutex_unlock(&h->request_mutex);
+			mutex_unlock(&h->reply_mutex);
 			return false;
 		}
 
@@ -751,23 +905,54 @@ bool xs_watch(struct xs_handle *h, const char *path, const char *token)
 		if (pthread_create(&h->read_thr, &attr, read_thread, h) != 0) {
 			pthread_sigmask(SIG_SETMASK, &old_set, NULL);
 			pthread_attr_destroy(&attr);
-			mutex_unlock(&h->request_mutex);
+			mutex_unlock(&h->reply_mutex);
 			return false;
 		}
 		h->read_thr_exists = 1;
 		pthread_sigmask(SIG_SETMASK, &old_set, NULL);
 		pthread_attr_destroy(&attr);
 	}
-	mutex_unlock(&h->request_mutex);
+	mutex_unlock(&h->reply_mutex);
 #endif
 
+	return true;
+}
+
+static bool xs_watch_flags(struct xs_handle *h, const char *path,
+			   const char *token, const char *flags)
+{
+	struct iovec iov[3];
+
+	if (!read_thread_start(h))
+		return false;
+
 	iov[0].iov_base = (void *)path;
 	iov[0].iov_len = strlen(path) + 1;
 	iov[1].iov_base = (void *)token;
 	iov[1].iov_len = strlen(token) + 1;
+	if (flags) {
+		iov[2].iov_base = (void *)flags;
+		iov[2].iov_len = strlen(flags) + 1;
+	}
 
 	return xs_bool(xs_talkv(h, XBT_NULL, XS_WATCH, iov,
-				ARRAY_SIZE(iov), NULL));
+				flags ? 3 : 2, NULL));
+}
+
+/* Watch a node for changes (poll on fd to detect, or call read_watch()).
+ * When the node (or any child) changes, fd will become readable.
+ * Token is returned when watch is read, to allow matching.
+ * Returns false on failure.
+ */
+bool xs_watch(struct xs_handle *h, const char *path, const char *token)
+{
+	return xs_watch_flags(h, path, token, NULL);
+}
+
+bool xs_watch_coalesced(struct xs_handle *h, const char *path,
+			const char *token)
+{
+	return xs_watch_flags(h, path, token, "coalesce");
 }
 
 
@@ -978,6 +1163,352 @@ bool xs_transaction_end(struct xs_handle *h, xs_transaction_t t,
 	return xs_bool(xs_single(h, t, XS_TRANSACTION_END, abortstr, NULL));
 }
 
+struct xs_multi {
+	/* The requests, each a header followed by its payload. */
+	char req[XENSTORE_PAYLOAD_MAX];
+	unsigned int len;
+	unsigned int nr_ops;
+
+	/* The replies, in the same format, once submitted. */
+	char *reply;
+	unsigned int reply_len;
+};
+
+struct xs_multi *xs_multi_new(void)
+{
+	return calloc(1, sizeof(struct xs_multi));
+}
+
+void xs_multi_free(struct xs_multi *m)
+{
+	if (!m)
+		return;
+	free(m->reply);
+	free(m);
+}
+
+static int xs_multi_add(struct xs_multi *m, enum xsd_sockmsg_type type,
+			const struct iovec *iovec, unsigned int num_vecs)
+{
+	struct xsd_sockmsg msg;
+	unsigned int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	for (i = 0; i < num_vecs; i++)
+		msg.len += iovec[i].iov_len;
+
+	if (sizeof(msg) + msg.len > XENSTORE_PAYLOAD_MAX - m->len) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	memcpy(m->req + m->len, &msg, sizeof(msg));
+	m->len += sizeof(msg);
+	for (i = 0; i < num_vecs; i++) {
+		memcpy(m->req + m->len, iovec[i].iov_base, iovec[i].iov_len);
+		m->len += iovec[i].iov_len;
+	}
+
+	return m->nr_ops++;
+}
+
+static int xs_multi_single(struct xs_multi *m, enum xsd_sockmsg_type type,
+			   const char *string)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)string;
+	iovec.iov_len = strlen(string) + 1;
+	return xs_multi_add(m, type, &iovec, 1);
+}
+
+int xs_multi_read(struct xs_multi *m, const char *path)
+{
+	return xs_multi_single(m, XS_READ, path);
+}
+
+int xs_multi_write(struct xs_multi *m, const char *path,
+		   const void *data, unsigned int len)
+{
+	struct iovec iovec[2];
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = (void *)data;
+	iovec[1].iov_len = len;
+
+	return xs_multi_add(m, XS_WRITE, iovec, ARRAY_SIZE(iovec));
+}
+
+int xs_multi_mkdir(struct xs_multi *m, const char *path)
+{
+	return xs_multi_single(m, XS_MKDIR, path);
+}
+
+int xs_multi_rm(struct xs_multi *m, const char *path)
+{
+	return xs_multi_single(m, XS_RM, path);
+}
+
+int xs_multi_set_permissions(struct xs_multi *m, const char *path,
+			     struct xs_permissions *perms,
+			     unsigned int num_perms)
+{
+	char buffer[num_perms][MAX_STRLEN(unsigned int)+1];
+	struct iovec iov[1+num_perms];
+	unsigned int i;
+
+	iov[0].iov_base = (void *)path;
+	iov[0].iov_len = strlen(path) + 1;
+
+	for (i = 0; i < num_perms; i++) {
+		if (!xs_perm_to_string(&perms[i], buffer[i], sizeof(buffer[i])))
+			return -1;
+		iov[i+1].iov_base = buffer[i];
+		iov[i+1].iov_len = strlen(buffer[i]) + 1;
+	}
+
+	return xs_multi_add(m, XS_SET_PERMS, iov, 1+num_perms);
+}
+
+bool xs_multi_submit(struct xs_handle *h, xs_transaction_t t,
+		     struct xs_multi *m)
+{
+	struct iovec iovec;
+
+	free(m->reply);
+	m->reply_len = 0;
+
+	iovec.iov_base = m->req;
+	iovec.iov_len = m->len;
+	m->reply = xs_talkv(h, t, XS_MULTI, &iovec, 1, &m->reply_len);
+
+	return m->reply != NULL;
+}
+
+void *xs_multi_result(struct xs_multi *m, int op, unsigned int *len)
+{
+	struct xsd_sockmsg msg;
+	unsigned int off = 0;
+	char *ret;
+
+	if (!m->reply || op < 0 || op >= m->nr_ops)
+		goto inval;
+
+	for (;;) {
+		if (m->reply_len - off < sizeof(msg))
+			goto inval;
+		memcpy(&msg, m->reply + off, sizeof(msg));
+		off += sizeof(msg);
+		if (msg.len > m->reply_len - off)
+			goto inval;
+		if (op-- == 0)
+			break;
+		off += msg.len;
+	}
+
+	if (msg.type != XS_READ)
+		goto inval;
+
+	/* Add a nul terminator, like xs_read(). */
+	ret = malloc(msg.len + 1);
+	if (!ret)
+		return NULL;
+	memcpy(ret, m->reply + off, msg.len);
+	ret[msg.len] = '\0';
+	if (len)
+		*len = msg.len;
+	return ret;
+
+inval:
+	errno = EINVAL;
+	return NULL;
+}
+
+static uint32_t xs_async_talkv(struct xs_handle *h, xs_transaction_t t,
+			       enum xsd_sockmsg_type type,
+			       const struct iovec *iovec,
+			       unsigned int num_vecs,
+			       xs_async_fn *done, void *arg)
+{
+	struct xs_async *async;
+	struct xsd_sockmsg msg;
+
+	/* Someone has to read the reply while the caller gets on. */
+	if (!read_thread_start(h))
+		return 0;
+
+	async = malloc(sizeof(*async));
+	if (!async)
+		return 0;
+	async->done = done;
+	async->arg = arg;
+
+	msg.tx_id = t;
+	msg.type = type;
+	if (!xs_send(h, &msg, iovec, num_vecs, async)) {
+		free_no_errno(async);
+		return 0;
+	}
+
+	return msg.req_id;
+}
+
+static uint32_t xs_async_single(struct xs_handle *h, xs_transaction_t t,
+				enum xsd_sockmsg_type type,
+				const char *string,
+				xs_async_fn *done, void *arg)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)string;
+	iovec.iov_len = strlen(string) + 1;
+	return xs_async_talkv(h, t, type, &iovec, 1, done, arg);
+}
+
+uint32_t xs_read_async(struct xs_handle *h, xs_transaction_t t,
+		       const char *path, xs_async_fn *done, void *arg)
+{
+	return xs_async_single(h, t, XS_READ, path, done, arg);
+}
+
+uint32_t xs_directory_async(struct xs_handle *h, xs_transaction_t t,
+			    const char *path, xs_async_fn *done, void *arg)
+{
+	return xs_async_single(h, t, XS_DIRECTORY, path, done, arg);
+}
+
+uint32_t xs_write_async(struct xs_handle *h, xs_transaction_t t,
+			const char *path, const void *data, unsigned int len,
+			xs_async_fn *done, void *arg)
+{
+	struct iovec iovec[2];
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = (void *)data;
+	iovec[1].iov_len = len;
+
+	return xs_async_talkv(h, t, XS_WRITE, iovec, ARRAY_SIZE(iovec),
+			      done, arg);
+}
+
+uint32_t xs_mkdir_async(struct xs_handle *h, xs_transaction_t t,
+			const char *path, xs_async_fn *done, void *arg)
+{
+	return xs_async_single(h, t, XS_MKDIR, path, done, arg);
+}
+
+uint32_t xs_rm_async(struct xs_handle *h, xs_transaction_t t,
+		     const char *path, xs_async_fn *done, void *arg)
+{
+	return xs_async_single(h, t, XS_RM, path, done, arg);
+}
+
+int xs_async_fileno(struct xs_handle *h)
+{
+#ifdef USE_PTHREAD
+	char c = 0;
+
+	if (!read_thread_start(h))
+		return -1;
+
+	mutex_lock(&h->reply_mutex);
+
+	if ((h->async_pipe[0] == -1) && (pipe(h->async_pipe) != -1)) {
+		/* Kick things off if replies are already waiting. */
+		if (!list_empty(&h->async_done_list))
+			while (write(h->async_pipe[1], &c, 1) != 1)
+				continue;
+	}
+
+	mutex_unlock(&h->reply_mutex);
+
+	return h->async_pipe[0];
+#else
+	/* Replies are only read in xs_async_complete(). */
+	return h->fd;
+#endif
+}
+
+/* Call done for an async request, with its reply or error. */
+static void call_async(struct xs_handle *h, struct xs_async *async)
+{
+	struct xs_stored_msg *msg = async->reply;
+	void *reply = NULL;
+	unsigned int len = 0;
+	int err = 0;
+
+	if (!msg)
+		err = EBADF;
+	else if (msg->hdr.type == XS_ERROR)
+		err = get_error(msg->body);
+	else if (msg->hdr.type != async->type)
+		err = EBADF;
+	else {
+		reply = msg->body;
+		len = msg->hdr.len;
+	}
+
+	if (msg) {
+		if (!reply)
+			free(msg->body);
+		free(msg);
+	}
+
+	async->done(h, async->req_id, err, reply, len, async->arg);
+	free(async);
+}
+
+int xs_async_complete(struct xs_handle *h, bool block)
+{
+	LIST_HEAD(done);
+	struct xs_async *async, *tasync;
+	char c;
+	int n = 0;
+
+#ifndef USE_PTHREAD
+	/* Read from comms channel ourselves, as there is no reader thread:
+	 * whatever is there, and waiting for a reply if blocking. */
+	while (!list_empty(&h->async_list)) {
+		if (read_message(h, !block || !list_empty(&h->async_done_list))
+		    == -1) {
+			if (errno == EAGAIN)
+				break;
+			if (h->fd != -1) {
+				close(h->fd);
+				h->fd = -1;
+			}
+			fail_async(h);
+		}
+	}
+#endif
+
+	mutex_lock(&h->reply_mutex);
+#ifdef USE_PTHREAD
+	while (block && list_empty(&h->async_done_list) &&
+	       !list_empty(&h->async_list))
+		condvar_wait(&h->reply_condvar, &h->reply_mutex);
+#endif
+	if (!list_empty(&h->async_done_list)) {
+		list_splice_init(&h->async_done_list, &done);
+		if (h->async_pipe[0] != -1)
+			while (read(h->async_pipe[0], &c, 1) != 1)
+				continue;
+	}
+	mutex_unlock(&h->reply_mutex);
+
+	/* done may send more requests, or complete them. */
+	list_for_each_entry_safe(async, tasync, &done, list) {
+		list_del(&async->list);
+		call_async(h, async);
+		n++;
+	}
+
+	return n;
+}
+
 /* Introduce a new domain.
  * This tells the store daemon about a shared memory page and event channel
  * associated with a domain: the domain uses these to communicate.
@@ -1127,9 +1658,9 @@ char *xs_debug_command(struct xs_handle *h, const char *cmd,
 
 static int read_message(struct xs_handle *h, int nonblocking)
 {
-	/* IMPORTANT: It is forbidden to call this function without
-	 * acquiring the request lock and checking that h->read_thr_exists
-	 * is false.  See "Lock discipline" in struct xs_handle, above. */
+	/* IMPORTANT: It is forbidden to call this function but from the
+	 * read thread, or after setting h->reading with h->read_thr_exists
+	 * false.  See "Lock discipline" in struct xs_handle, above. */
 
 	/* If nonblocking==1, this function will always read either
 	 * nothing, returning -1 and setting errno==EAGAIN, or we read
@@ -1186,19 +1717,22 @@ static int read_message(struct xs_handle *h, int nonblocking)
 
 		cleanup_pop(1);
 	} else {
+		struct xs_async *async;
+
 		mutex_lock(&h->reply_mutex);
+		cleanup_push(pthread_mutex_unlock, &h->reply_mutex);
 
-		/* There should only ever be one response pending! */
-		if (!list_empty(&h->reply_list)) {
-			mutex_unlock(&h->reply_mutex);
-			saved_errno = EEXIST;
-			goto error_freebody;
-		}
+		async = find_async(h, msg->hdr.req_id);
+		if (async) {
+			async->reply = msg;
+			complete_async(h, async); /* Cancellation point */
+		} else
+			list_add_tail(&msg->list, &h->reply_list);
 
-		list_add_tail(&msg->list, &h->reply_list);
-		condvar_signal(&h->reply_condvar);
+		/* Requesters wait for different replies. */
+		condvar_broadcast(&h->reply_condvar);
 
-		mutex_unlock(&h->reply_mutex);
+		cleanup_pop(1);
 	}
 
 	ret = 0;
@@ -1233,8 +1767,10 @@ static void *read_thread(void *arg)
 
 	/* wake up all waiters */
 	pthread_mutex_lock(&h->reply_mutex);
+	cleanup_push(pthread_mutex_unlock, &h->reply_mutex);
+	fail_async(h); /* Cancellation point */
 	pthread_cond_broadcast(&h->reply_condvar);
-	pthread_mutex_unlock(&h->reply_mutex);
+	cleanup_pop(1);
 
 	pthread_mutex_lock(&h->watch_mutex);
 	pthread_cond_broadcast(&h->watch_condvar);
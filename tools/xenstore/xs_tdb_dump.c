@@ -11,10 +11,13 @@
 #include "talloc.h"
 #include "utils.h"
 
+/* As struct xs_tdb_record_hdr in xenstored_core.h. */
 struct record_hdr {
+	uint64_t generation;
 	uint32_t num_perms;
 	uint32_t datalen;
 	uint32_t childlen;
+	uint32_t pad;
 	struct xs_permissions perms[0];
 };
 
@@ -0,0 +1,249 @@
+/******************************************************************************
+ * tools/xentrace/lz4.c
+ *
+ * LZ4 compressed output stream, for xentrace to compress trace data on
+ * the fly.  xen/common/lz4 only has the decompressor; this is the
+ * matching greedy, single-pass compressor for the LZ4 block format.
+ *
+ * The stream is a 32-bit magic number followed by chunks of at most
+ * LZ4_CHUNK_SIZE input bytes, each a 32-bit compressed size and an LZ4
+ * block.  All numbers are little endian.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lz4.h"
+
+#define LZ4_MAGIC          0x184C2102
+#define LZ4_CHUNK_SIZE     (1 << 20)   /* Legacy format allows up to 8MB */
+
+#define LZ4_MIN_MATCH      4
+#define LZ4_LAST_LITERALS  5           /* The last 5 bytes are literals */
+#define LZ4_MFLIMIT        12          /* No match starts in the last 12 */
+#define LZ4_MAX_DISTANCE   65535
+#define LZ4_HASH_BITS      16
+
+#define LZ4_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16)
+
+static struct {
+    int fd;
+    unsigned char *in, *out;
+    size_t in_len;
+    uint32_t *table;             /* Input offsets, by hash of 4 bytes */
+} lz4 = { .fd = -1 };
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void write_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static unsigned int hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *op, size_t len)
+{
+    for ( ; len >= 255; len -= 255 )
+        *op++ = 255;
+    *op++ = len;
+
+    return op;
+}
+
+/*
+ * Token and literals of a sequence; the offset and the rest of the match
+ * length follow unless this is the last sequence of the block.
+ */
+static unsigned char *put_sequence(unsigned char *op,
+                                   const unsigned char *literals,
+                                   size_t nr_literals, size_t match_len)
+{
+    unsigned char *token = op++;
+
+    *token = ((nr_literals < 15 ? nr_literals : 15) << 4) |
+             (match_len < 15 ? match_len : 15);
+    if ( nr_literals >= 15 )
+        op = put_length(op, nr_literals - 15);
+    memcpy(op, literals, nr_literals);
+    op += nr_literals;
+
+    return op;
+}
+
+/* Compress @len bytes at @src into @dst, which holds the compress bound. */
+static size_t compress_block(const unsigned char *src, size_t len,
+                             unsigned char *dst)
+{
+    const unsigned char *ip = src, *anchor = src, *end = src + len;
+    unsigned char *op = dst;
+
+    memset(lz4.table, 0, sizeof(*lz4.table) << LZ4_HASH_BITS);
+
+    if ( len > LZ4_MFLIMIT )
+    {
+        const unsigned char *mflimit = end - LZ4_MFLIMIT;
+        const unsigned char *matchlimit = end - LZ4_LAST_LITERALS;
+        unsigned int misses = 0;
+
+        while ( ip <= mflimit )
+        {
+            uint32_t seq = read32(ip);
+            unsigned int h = hash32(seq);
+            const unsigned char *ref = src + lz4.table[h];
+            const unsigned char *mp, *rp;
+            size_t match_len, offset;
+
+            lz4.table[h] = ip - src;
+
+            if ( ref >= ip || ip - ref > LZ4_MAX_DISTANCE ||
+                 read32(ref) != seq )
+            {
+                /* Skip faster through data which does not compress. */
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            mp = ip + LZ4_MIN_MATCH;
+            rp = ref + LZ4_MIN_MATCH;
+            while ( mp < matchlimit && *mp == *rp )
+            {
+                mp++;
+                rp++;
+            }
+
+            match_len = mp - ip - LZ4_MIN_MATCH;
+            offset = ip - ref;
+
+            op = put_sequence(op, anchor, ip - anchor, match_len);
+            *op++ = offset;
+            *op++ = offset >> 8;
+            if ( match_len >= 15 )
+                op = put_length(op, match_len - 15);
+
+            ip = anchor = mp;
+        }
+    }
+
+    return put_sequence(op, anchor, end - anchor, 0) - dst;
+}
+
+static int write_all(const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    while ( size )
+    {
+        ssize_t written = write(lz4.fd, p, size);
+
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+static int flush_chunk(void)
+{
+    size_t size;
+
+    if ( !lz4.in_len )
+        return 0;
+
+    size = compress_block(lz4.in, lz4.in_len, lz4.out + 4);
+    write_le32(lz4.out, size);
+    lz4.in_len = 0;
+
+    return write_all(lz4.out, size + 4);
+}
+
+int lz4_stream_open(int fd)
+{
+    unsigned char magic[4];
+
+    lz4.in = malloc(LZ4_CHUNK_SIZE);
+    lz4.out = malloc(4 + LZ4_COMPRESS_BOUND(LZ4_CHUNK_SIZE));
+    lz4.table = malloc(sizeof(*lz4.table) << LZ4_HASH_BITS);
+    if ( !lz4.in || !lz4.out || !lz4.table )
+    {
+        free(lz4.in);
+        free(lz4.out);
+        free(lz4.table);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    lz4.fd = fd;
+    lz4.in_len = 0;
+    write_le32(magic, LZ4_MAGIC);
+
+    return write_all(magic, sizeof(magic));
+}
+
+int lz4_stream_write(const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    while ( size )
+    {
+        size_t n = LZ4_CHUNK_SIZE - lz4.in_len;
+
+        if ( n > size )
+            n = size;
+        memcpy(lz4.in + lz4.in_len, p, n);
+        lz4.in_len += n;
+        p += n;
+        size -= n;
+
+        if ( lz4.in_len == LZ4_CHUNK_SIZE && flush_chunk() )
+            return -1;
+    }
+
+    return 0;
+}
+
+int lz4_stream_close(void)
+{
+    int rc = flush_chunk();
+
+    free(lz4.in);
+    free(lz4.out);
+    free(lz4.table);
+    lz4.in = lz4.out = NULL;
+    lz4.table = NULL;
+    lz4.fd = -1;
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,21 @@
+/******************************************************************************
+ * tools/xentrace/lz4.h
+ *
+ * LZ4 compressed output stream.
+ */
+
+#ifndef __XENTRACE_LZ4_H__
+#define __XENTRACE_LZ4_H__
+
+#include <stddef.h>
+
+/*
+ * The stream is in the LZ4 legacy format, as used for compressed kernels
+ * and read by xen/common/unlz4.c and "lz4 -d".  All return 0 on success,
+ * -1 with errno set on failure.
+ */
+int lz4_stream_open(int fd);
+int lz4_stream_write(const void *data, size_t size);
+int lz4_stream_close(void);
+
+#endif /* __XENTRACE_LZ4_H__ */
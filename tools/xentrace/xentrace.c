@@ -25,12 +25,15 @@
 #include <assert.h>
 #include <sys/poll.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
 
 #include <xen/xen.h>
 #include <xen/trace.h>
 
 #include <xenctrl.h>
 
+#include "lz4.h"
+
 #define PERROR(_m, _a...)                                       \
 do {                                                            \
     int __saved_errno = errno;                                  \
@@ -59,7 +62,8 @@ typedef struct settings_st {
     unsigned long memory_buffer;
     uint8_t discard:1,
         disable_tracing:1,
-        start_disabled:1;
+        start_disabled:1,
+        compress:1;
 } settings_t;
 
 struct t_struct {
@@ -275,6 +279,14 @@ void membuf_write(void *start, unsigned long size) {
     }
 }
 
+static int membuf_dump_write(char *start, int size)
+{
+    if ( opts.compress )
+        return lz4_stream_write(start, size) ? -1 : size;
+
+    return write(outfd, start, size);
+}
+
 void membuf_dump(void) {
     /* Dump circular memory buffer */
     int cons, prod, wsize, written;
@@ -291,7 +303,7 @@ void membuf_dump(void) {
         wstart = membuf.buf + cons;
         wsize = prod - cons;
 
-        written = write(outfd, wstart, wsize);
+        written = membuf_dump_write(wstart, wsize);
         if ( written != wsize )
             goto fail;
     }
@@ -301,7 +313,7 @@ void membuf_dump(void) {
         wstart = membuf.buf + cons;
         wsize = membuf.size - cons;
 
-        written = write(outfd, wstart, wsize);
+        written = membuf_dump_write(wstart, wsize);
         if ( written != wsize )
         {
             fprintf(stderr, "Write failed! (size %d, returned %d)\n",
@@ -312,7 +324,7 @@ void membuf_dump(void) {
         wstart = membuf.buf;
         wsize = prod;
 
-        written = write(outfd, wstart, wsize);
+        written = membuf_dump_write(wstart, wsize);
         if ( written != wsize )
         {
             fprintf(stderr, "Write failed! (size %d, returned %d)\n",
@@ -329,22 +341,52 @@ fail:
     return;
 }
 
+/* Write out all of @iov, possibly in several writev() calls. */
+static int writev_all(struct iovec *iov, int iovcnt)
+{
+    while ( iovcnt )
+    {
+        ssize_t written = writev(outfd, iov, iovcnt);
+
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        for ( ; iovcnt && written >= iov->iov_len; iov++, iovcnt-- )
+            written -= iov->iov_len;
+        if ( iovcnt )
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
 /**
- * write_buffer - write a section of the trace buffer
+ * write_buffer - write a window of the trace buffer
  * @cpu      - source buffer CPU ID
- * @start
- * @size     - size of write (may be less than total window size)
- * @total_size - total size of the window (0 on 2nd write of wrapped windows)
- * @out      - output stream
+ * @start    - start of the window
+ * @size     - size of the window up to the end of the buffer
+ * @start2   - start of the buffer, for windows which wrap
+ * @size2    - size of the window from the start of the buffer, or 0
  *
- * Outputs the trace buffer to a filestream, prepending the CPU and size
- * of the buffer write.
+ * Outputs the trace buffer window to a filestream, prepending the CPU and
+ * size of the window.  Unless it goes to the memory buffer or through the
+ * compressor, the data is written straight from the mapped trace buffer,
+ * with a single system call.
  */
 static void write_buffer(unsigned int cpu, unsigned char *start, int size,
-                         int total_size)
+                         unsigned char *start2, int size2)
 {
     struct statvfs stat;
-    size_t written = 0;
+    struct cpu_change_record rec;
+    struct iovec iov[3];
+    int total_size = size + size2;
     
     if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 )
     {
@@ -359,10 +401,7 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
 
         freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
 
-        if ( total_size )
-            freespace -= total_size;
-        else
-            freespace -= size;
+        freespace -= total_size;
 
         freespace >>= 20; /* Convert to MB */
 
@@ -373,48 +412,39 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
         }
     }
 
-    /* Write a CPU_BUF record on each buffer "window" written.  Wrapped
-     * windows may involve two writes, so only write the record on the
-     * first write. */
-    if ( total_size != 0 )
-    {
-        if ( opts.memory_buffer )
-        {
-            membuf_reserve_window(cpu, total_size);
-        }
-        else
-        {
-            struct cpu_change_record rec;
-
-            rec.header = CPU_CHANGE_HEADER;
-            rec.data.cpu = cpu;
-            rec.data.window_size = total_size;
-
-            written = write(outfd, &rec, sizeof(rec));
-            if ( written != sizeof(rec) )
-            {
-                fprintf(stderr, "Cannot write cpu change (write returned %zd)\n",
-                        written);
-                goto fail;
-            }
-        }
-    }
-
     if ( opts.memory_buffer )
     {
+        membuf_reserve_window(cpu, total_size);
         membuf_write(start, size);
+        if ( size2 )
+            membuf_write(start2, size2);
+        return;
     }
-    else
+
+    /* Write a CPU_BUF record on each buffer "window" written. */
+    rec.header = CPU_CHANGE_HEADER;
+    rec.data.cpu = cpu;
+    rec.data.window_size = total_size;
+
+    if ( opts.compress )
     {
-        written = write(outfd, start, size);
-        if ( written != size )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %zd)\n",
-                    size, written);
+        if ( lz4_stream_write(&rec, sizeof(rec)) ||
+             lz4_stream_write(start, size) ||
+             (size2 && lz4_stream_write(start2, size2)) )
             goto fail;
-        }
+        return;
     }
 
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = start;
+    iov[1].iov_len = size;
+    iov[2].iov_base = start2;
+    iov[2].iov_len = size2;
+
+    if ( writev_all(iov, size2 ? 3 : 2) )
+        goto fail;
+
     return;
 
 fail:
@@ -422,6 +452,37 @@ fail:
     exit(EXIT_FAILURE);
 }
 
+/* Report the records Xen dropped because the buffers were full. */
+static void report_lost_records(void)
+{
+    static const char *const names[TRC_NR_CLASSES] = {
+        [0] = "gen", [1] = "sched", [2] = "dom0op", [3] = "hvm",
+        [4] = "mem", [5] = "pv", [6] = "shadow", [7] = "hw", [8] = "arm",
+        [11] = "guest",
+    };
+    uint64_t lost[TRC_NR_CLASSES];
+    int i, any = 0;
+
+    if ( xc_tbuf_get_lost(xc_handle, lost) )
+        return;
+
+    for ( i = 0; i < TRC_NR_CLASSES; i++ )
+    {
+        if ( !lost[i] )
+            continue;
+        if ( names[i] )
+            fprintf(stderr, "%s %s %"PRIu64, any ? "," : "Lost records:",
+                    names[i], lost[i]);
+        else
+            fprintf(stderr, "%s class %#x %"PRIu64,
+                    any ? "," : "Lost records:",
+                    (1u << i) << TRC_CLS_SHIFT, lost[i]);
+        any = 1;
+    }
+    if ( any )
+        fprintf(stderr, "\n");
+}
+
 static void disable_tbufs(void)
 {
     xc_interface *xc_handle = xc_interface_open(0,0,0);
@@ -705,9 +766,8 @@ static int monitor_tbufs(void)
             if ( end_offset > start_offset )
             {
                 /* If window does not wrap, write in one big chunk */
-                write_buffer(i, data[i]+start_offset,
-                             window_size,
-                             window_size);
+                write_buffer(i, data[i] + start_offset, window_size,
+                             NULL, 0);
             }
             else
             {
@@ -717,10 +777,7 @@ static int monitor_tbufs(void)
                  */
                 write_buffer(i, data[i] + start_offset,
                              data_size - start_offset,
-                             window_size);
-                write_buffer(i, data[i],
-                             end_offset,
-                             0);
+                             data[i], end_offset);
             }
 
             xen_mb(); /* read buffer, then update cons. */
@@ -748,6 +805,14 @@ static int monitor_tbufs(void)
     if ( opts.memory_buffer )
         membuf_dump();
 
+    if ( opts.compress && lz4_stream_close() )
+    {
+        PERROR("Failed to write trace data");
+        exit(EXIT_FAILURE);
+    }
+
+    report_lost_records();
+
     /* cleanup */
     free(meta);
     free(data);
@@ -802,6 +867,8 @@ static void usage(void)
 "  -r  --reserve-disk-space=n Before writing trace records to disk, check to see\n" \
 "                          that after the write there will be at least n space\n" \
 "                          left on the disk.\n" \
+"  -z  --compress          Compress the output on the fly, in the LZ4 legacy\n" \
+"                          format (decompress with \"lz4 -d\").\n" \
 "\n" \
 "This tool is used to capture trace buffer data from Xen. The\n" \
 "data is output in a binary format, in the following order:\n" \
@@ -897,6 +964,8 @@ static int parse_evtmask(char *arg)
         opts.evt_mask |= TRC_DOM0OP;
     } else if(strcmp(arg, "hvm") == 0){ 
         opts.evt_mask |= TRC_HVM;
+    } else if(strcmp(arg, "arm") == 0){ 
+        opts.evt_mask |= TRC_ARM;
     } else if(strcmp(arg, "all") == 0){ 
         opts.evt_mask |= TRC_ALL;
     } else {
@@ -922,12 +991,13 @@ static void parse_args(int argc, char **argv)
         { "discard-buffers", no_argument,      0, 'D' },
         { "dont-disable-tracing", no_argument, 0, 'x' },
         { "start-disabled", no_argument,       0, 'X' },
+        { "compress",       no_argument,       0, 'z' },
         { "help",           no_argument,       0, '?' },
         { "version",        no_argument,       0, 'V' },
         { 0, 0, 0, 0 }
     };
 
-    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxX?V",
+    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxXz?V",
                     long_options, NULL)) != -1) 
     {
         switch ( option )
@@ -977,6 +1047,10 @@ static void parse_args(int argc, char **argv)
             opts.memory_buffer = sargtol(optarg, 0);
             break;
 
+        case 'z': /* Compress the output */
+            opts.compress = 1;
+            break;
+
         default:
             usage();
         }
@@ -1046,6 +1120,12 @@ int main(int argc, char **argv)
     if ( opts.memory_buffer > 0 )
         membuf_alloc(opts.memory_buffer);
 
+    if ( opts.compress && lz4_stream_open(outfd) )
+    {
+        perror("Could not start compressed output");
+        exit(EXIT_FAILURE);
+    }
+
     /* ensure that if we get a signal, we'll do cleanup, then exit */
     act.sa_handler = close_handler;
     act.sa_flags = 0;
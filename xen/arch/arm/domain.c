@@ -19,6 +19,7 @@
 #include <xen/errno.h>
 #include <xen/bitops.h>
 #include <xen/grant_table.h>
+#include <xen/keyhandler.h>
 
 #include <asm/current.h>
 #include <asm/event.h>
@@ -38,6 +39,48 @@
 
 DEFINE_PER_CPU(struct vcpu *, curr_vcpu);
 
+/* Stop the scheduler's periodic timers while a pcpu idles. */
+static bool_t __read_mostly opt_tickless = 1;
+boolean_param("tickless", opt_tickless);
+
+/* Idle wakeups, and their count and time at the last 'W' dump. */
+struct idle_wakeups {
+    unsigned long count;
+    unsigned long last_count;
+    s_time_t last_time;
+};
+static DEFINE_PER_CPU(struct idle_wakeups, idle_wakeups);
+
+static void do_idle(void)
+{
+    unsigned int cpu = smp_processor_id();
+    /* Keep the tick while RCU needs this cpu to make progress. */
+    bool_t tickless = opt_tickless && !rcu_needs_cpu(cpu);
+
+    if ( tickless )
+    {
+        rcu_idle_enter(cpu);
+        sched_tick_suspend();
+        /* sched_tick_suspend() can raise TIMER_SOFTIRQ. Process it now. */
+        process_pending_softirqs();
+    }
+
+    local_irq_disable();
+    if ( cpu_is_haltable(cpu) )
+    {
+        dsb(sy);
+        wfi();
+        this_cpu(idle_wakeups).count++;
+    }
+    local_irq_enable();
+
+    if ( tickless )
+    {
+        sched_tick_resume();
+        rcu_idle_exit(cpu);
+    }
+}
+
 void idle_loop(void)
 {
     for ( ; ; )
@@ -45,19 +88,50 @@ void idle_loop(void)
         if ( cpu_is_offline(smp_processor_id()) )
             stop_cpu();
 
-        local_irq_disable();
-        if ( cpu_is_haltable(smp_processor_id()) )
-        {
-            dsb(sy);
-            wfi();
-        }
-        local_irq_enable();
+        do_idle();
 
         do_tasklet();
         do_softirq();
     }
 }
 
+static void dump_idle_wakeups(unsigned char key)
+{
+    s_time_t now = NOW();
+    unsigned int cpu;
+
+    printk("'%c' pressed -> dumping idle wakeups per second (tickless %s)\n",
+           key, opt_tickless ? "on" : "off");
+
+    for_each_online_cpu ( cpu )
+    {
+        struct idle_wakeups *w = &per_cpu(idle_wakeups, cpu);
+        unsigned long count = read_atomic(&w->count);
+        s_time_t delta = now - w->last_time;
+
+        printk("CPU%u: %lu wakeups, %lu/s over the last %"PRI_stime"ms\n",
+               cpu, count,
+               delta > 0 ? (unsigned long)((count - w->last_count) *
+                                           SECONDS(1) / delta) : 0,
+               delta / MILLISECS(1));
+        w->last_count = count;
+        w->last_time = now;
+    }
+}
+
+static struct keyhandler dump_idle_wakeups_keyhandler = {
+    .diagnostic = 1,
+    .u.fn = dump_idle_wakeups,
+    .desc = "dump idle wakeups per second"
+};
+
+static __init int register_idle_wakeups_trigger(void)
+{
+    register_keyhandler('W', &dump_idle_wakeups_keyhandler);
+    return 0;
+}
+__initcall(register_idle_wakeups_trigger);
+
 static void ctxt_switch_from(struct vcpu *p)
 {
     p2m_save_state(p);
@@ -748,11 +822,22 @@ int domain_relinquish_resources(struct domain *d)
 void arch_dump_domain_info(struct domain *d)
 {
     struct vcpu *v;
+    unsigned long hits = 0, misses = 0, blocks = 0, traps = 0, yields = 0;
 
     for_each_vcpu ( d, v )
     {
         gic_dump_info(v);
+
+        hits += v->arch.wfx.poll_hits;
+        misses += v->arch.wfx.poll_misses;
+        blocks += v->arch.wfx.blocks;
+        traps += v->arch.wfx.wfe_traps;
+        yields += v->arch.wfx.wfe_yields;
     }
+
+    printk("    WFI: %lu polled (%lu missed), %lu blocked;"
+           " WFE: %lu trapped, %lu yielded\n",
+           hits, misses, blocks, traps, yields);
 }
 
 
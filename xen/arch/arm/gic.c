@@ -27,6 +27,7 @@
 #include <xen/softirq.h>
 #include <xen/list.h>
 #include <xen/device_tree.h>
+#include <xen/trace.h>
 #include <asm/p2m.h>
 #include <asm/domain.h>
 #include <asm/platform.h>
@@ -260,6 +261,7 @@ static inline void gic_set_lr(int lr, struct pending_irq *p,
     ASSERT(!local_irq_is_enabled());
 
     gic_hw_ops->update_lr(lr, p, state);
+    TRACE_3D(TRC_GIC_LR_SET, lr, p->irq, state);
 
     set_bit(GIC_IRQ_GUEST_VISIBLE, &p->status);
     clear_bit(GIC_IRQ_GUEST_QUEUED, &p->status);
@@ -331,6 +333,9 @@ void gic_raise_guest_irq(struct vcpu *v, unsigned int virtual_irq,
             gic_set_lr(i, irq_to_pending(v, virtual_irq), GICH_LR_PENDING);
             return;
         }
+
+        TRACE_2D(TRC_GIC_LR_PENDING,
+                 (v->domain->domain_id << 16) | v->vcpu_id, virtual_irq);
     }
 
     gic_add_to_lr_pending(v, irq_to_pending(v, virtual_irq));
@@ -377,6 +382,7 @@ static void gic_update_one_lr(struct vcpu *v, int i)
     {
         gic_hw_ops->clear_lr(i);
         clear_bit(i, &this_cpu(lr_mask));
+        TRACE_2D(TRC_GIC_LR_CLEAR, i, irq);
 
         if ( p->desc != NULL )
             p->desc->status &= ~IRQ_INPROGRESS;
@@ -449,6 +455,7 @@ static void gic_restore_pending_irqs(struct vcpu *v)
 
 found:
             lr = p_r->lr;
+            TRACE_3D(TRC_GIC_LR_EVICT, lr, p_r->irq, p->irq);
             p_r->lr = GIC_INVALID_LR;
             set_bit(GIC_IRQ_GUEST_QUEUED, &p_r->status);
             clear_bit(GIC_IRQ_GUEST_VISIBLE, &p_r->status);
@@ -599,6 +606,7 @@ static void maintenance_interrupt(int irq, void *dev_id, struct cpu_user_regs *r
      * on return to guest that is going to clear the old LRs and inject
      * new interrupts.
      */
+    TRACE_0D(TRC_GIC_MAINTENANCE);
 }
 
 void gic_dump_info(struct vcpu *v)
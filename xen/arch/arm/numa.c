@@ -0,0 +1,245 @@
+/*
+ * xen/arch/arm/numa.c
+ *
+ * NUMA topology from the device tree.
+ *
+ * Memory and cpu nodes may carry a "numa-node-id" property, and a node
+ * compatible with "numa-distance-map-v1" may give the distance between
+ * each pair of nodes in its "distance-matrix" as (from, to, distance)
+ * triples.  Unlisted distances default to 10 locally and 20 remotely.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <xen/config.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/nodemask.h>
+#include <xen/numa.h>
+#include <xen/device_tree.h>
+#include <xen/keyhandler.h>
+#include <xen/sched.h>
+
+#define LOCAL_DISTANCE  10
+#define REMOTE_DISTANCE 20
+
+static bool_t __initdata opt_numa = 1;
+boolean_param("numa", opt_numa);
+
+static bool_t __read_mostly numa_enabled;
+
+nodemask_t __read_mostly node_online_map = { { [0] = 1UL } };
+
+unsigned char __read_mostly cpu_to_node[NR_CPUS];
+cpumask_t __read_mostly node_to_cpumask[MAX_NUMNODES];
+
+struct node_data node_data[MAX_NUMNODES];
+
+unsigned int __read_mostly nr_node_memblks;
+struct node_memblk __read_mostly node_memblk[NR_NODE_MEMBLKS];
+
+static u8 __read_mostly node_distance[MAX_NUMNODES][MAX_NUMNODES];
+
+int __node_distance(int a, int b)
+{
+    if ( a < 0 || a >= MAX_NUMNODES || b < 0 || b >= MAX_NUMNODES )
+        return 0;
+
+    return node_distance[a][b];
+}
+
+/*
+ * Use the bank node ids only if every bank has a valid one; a partial
+ * description is more likely a firmware bug than a real topology.
+ */
+static bool_t __init numa_banks_valid(const struct dt_mem_info *mi)
+{
+    unsigned int i, with_nid = 0;
+
+    for ( i = 0; i < mi->nr_banks; i++ )
+    {
+        if ( mi->bank[i].nid < 0 )
+            continue;
+        if ( mi->bank[i].nid >= MAX_NUMNODES )
+        {
+            printk(XENLOG_WARNING "NUMA: bank %u node %d out of range\n",
+                   i, mi->bank[i].nid);
+            return 0;
+        }
+        with_nid++;
+    }
+
+    if ( with_nid && with_nid != mi->nr_banks )
+        printk(XENLOG_WARNING "NUMA: only %u of %d banks have a node id\n",
+               with_nid, mi->nr_banks);
+
+    return with_nid && with_nid == mi->nr_banks;
+}
+
+static void __init numa_init_distance(const struct dt_numa_info *numa)
+{
+    unsigned int i, j;
+
+    for ( i = 0; i < MAX_NUMNODES; i++ )
+        for ( j = 0; j < MAX_NUMNODES; j++ )
+            node_distance[i][j] = (i == j) ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+
+    if ( !numa_enabled )
+        return;
+
+    for ( i = 0; i < numa->nr_distances; i++ )
+    {
+        const struct dt_numa_distance *d = &numa->distance[i];
+
+        if ( d->from >= MAX_NUMNODES || d->to >= MAX_NUMNODES ||
+             d->distance > 0xff ||
+             (d->from == d->to ? d->distance != LOCAL_DISTANCE
+                               : d->distance <= LOCAL_DISTANCE) )
+        {
+            printk(XENLOG_WARNING "NUMA: bad distance %u -> %u = %u\n",
+                   d->from, d->to, d->distance);
+            continue;
+        }
+
+        /* The binding allows giving only one direction. */
+        node_distance[d->from][d->to] = d->distance;
+        node_distance[d->to][d->from] = d->distance;
+    }
+}
+
+/*
+ * Called before the boot allocator hands memory to the heaps, so that
+ * init_heap_pages() sees the final phys_to_nid().
+ */
+void __init numa_init(void)
+{
+    const struct dt_mem_info *mi = &early_info.mem;
+    unsigned int i;
+    int nid;
+
+    BUILD_BUG_ON(NR_NODE_MEMBLKS < NR_MEM_BANKS);
+
+    numa_enabled = opt_numa && numa_banks_valid(mi);
+
+    for ( i = 0; i < mi->nr_banks; i++ )
+    {
+        struct node_memblk *blk = &node_memblk[nr_node_memblks];
+        paddr_t start = mi->bank[i].start, end = start + mi->bank[i].size;
+        unsigned long spfn = paddr_to_pfn(start), epfn = paddr_to_pfn(end);
+        struct node_data *nd;
+
+        nid = numa_enabled ? mi->bank[i].nid : 0;
+        nd = NODE_DATA(nid);
+
+        if ( !nd->node_spanned_pages )
+        {
+            nd->node_start_pfn = spfn;
+            nd->node_spanned_pages = epfn - spfn;
+        }
+        else
+        {
+            unsigned long nend = max(node_end_pfn(nid), epfn);
+
+            nd->node_start_pfn = min(nd->node_start_pfn, spfn);
+            nd->node_spanned_pages = nend - nd->node_start_pfn;
+        }
+
+        node_set_online(nid);
+
+        if ( !numa_enabled )
+            continue;
+
+        blk->start = start;
+        blk->end = end;
+        blk->nid = nid;
+        nr_node_memblks++;
+    }
+
+    numa_init_distance(&early_info.numa);
+
+    cpumask_set_cpu(0, &node_to_cpumask[0]);
+
+    if ( !numa_enabled )
+    {
+        printk("NUMA: %s\n", opt_numa ? "no configuration found"
+                                      : "turned off");
+        return;
+    }
+
+    for_each_online_node ( nid )
+        printk("NUMA: node %d: %"PRIpaddr" - %"PRIpaddr"\n", nid,
+               pfn_to_paddr(node_start_pfn(nid)),
+               pfn_to_paddr(node_end_pfn(nid)) - 1);
+}
+
+/* Place a CPU on the node named by its DT node, or on node 0. */
+void __init numa_set_cpu_node(unsigned int cpu,
+                              const struct dt_device_node *dn)
+{
+    u32 nid = 0;
+
+    if ( numa_enabled && dn &&
+         dt_property_read_u32(dn, "numa-node-id", &nid) &&
+         (nid >= MAX_NUMNODES || !node_online(nid)) )
+    {
+        printk(XENLOG_WARNING "NUMA: cpu%u on unknown node %u\n", cpu, nid);
+        nid = 0;
+    }
+
+    cpumask_clear_cpu(cpu, &node_to_cpumask[cpu_to_node(cpu)]);
+    cpu_to_node[cpu] = nid;
+    cpumask_set_cpu(cpu, &node_to_cpumask[nid]);
+}
+
+static void dump_numa(unsigned char key)
+{
+    unsigned int cpu, nid, j;
+
+    printk("'%c' pressed -> dumping numa info\n", key);
+
+    for_each_online_node ( nid )
+    {
+        printk("Node %u: %"PRIpaddr" - %"PRIpaddr", %lu pages free\n", nid,
+               pfn_to_paddr(node_start_pfn(nid)),
+               pfn_to_paddr(node_end_pfn(nid)) - 1,
+               avail_node_heap_pages(nid));
+        printk("  distances:");
+        for_each_online_node ( j )
+            printk(" %d", __node_distance(nid, j));
+        printk("\n");
+    }
+
+    for_each_online_cpu ( cpu )
+        printk("CPU%u -> NODE%d\n", cpu, cpu_to_node(cpu));
+}
+
+static struct keyhandler dump_numa_keyhandler = {
+    .diagnostic = 1,
+    .u.fn = dump_numa,
+    .desc = "dump numa info"
+};
+
+static __init int register_numa_trigger(void)
+{
+    register_keyhandler('u', &dump_numa_keyhandler);
+    return 0;
+}
+__initcall(register_numa_trigger);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
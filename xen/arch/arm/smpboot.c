@@ -41,8 +41,21 @@ struct cpuinfo_arm cpu_data[NR_CPUS];
 /* CPU logical map: map xen cpuid to an MPIDR */
 u32 __cpu_logical_map[NR_CPUS] = { [0 ... NR_CPUS-1] = MPIDR_INVALID };
 
-/* Fake one node for now. See also include/asm-arm/numa.h */
-nodemask_t __read_mostly node_online_map = { { [0] = 1UL } };
+/* CPU topology: filled in as each CPU comes up. See cpu_to_socket(). */
+struct cpu_topology cpu_topology[NR_CPUS] =
+    { [0 ... NR_CPUS-1] = { .thread_id = -1, .core_id = -1, .cluster_id = -1 } };
+
+/*
+ * Topology as found in the DT cpu-map node, if any. Clusters and cores are
+ * numbered in the order they appear there.
+ */
+static struct {
+    u32 cluster, core, thread;
+} dt_topology[NR_CPUS] __read_mostly;
+static bool_t __read_mostly topology_from_dt;
+
+/* DT node of each logical CPU, to resolve cpu-map phandles. */
+static const struct dt_device_node *cpu_dt_node[NR_CPUS] __initdata;
 
 /* Xen stack for bringing up the first CPU. */
 static unsigned char __initdata cpu0_boot_stack[STACK_SIZE]
@@ -67,15 +80,223 @@ DEFINE_PER_CPU_READ_MOSTLY(cpumask_var_t, cpu_sibling_mask);
 /* representing HT and core siblings of each logical CPU */
 DEFINE_PER_CPU_READ_MOSTLY(cpumask_var_t, cpu_core_mask);
 
+/* CPUs whose sibling/core maps have been set up. */
+static cpumask_t cpu_sibling_setup_map;
+
+static int __init get_cpu_for_node(const struct dt_device_node *node)
+{
+    const struct dt_device_node *cpu = dt_parse_phandle(node, "cpu", 0);
+    unsigned int i;
+
+    if ( !cpu )
+        return -1;
+
+    for ( i = 0; i < nr_cpu_ids; i++ )
+        if ( cpu_dt_node[i] == cpu )
+            return i;
+
+    return -1;
+}
+
+static bool_t __init parse_dt_core(const struct dt_device_node *core,
+                                   u32 cluster, u32 core_id, cpumask_t *found)
+{
+    const struct dt_device_node *t;
+    bool_t any = 0;
+    u32 thread = 0;
+    int cpu;
+
+    dt_for_each_child_node( core, t )
+    {
+        if ( strncmp(dt_node_name(t), "thread", 6) )
+            continue;
+
+        if ( (cpu = get_cpu_for_node(t)) >= 0 )
+        {
+            dt_topology[cpu].cluster = cluster;
+            dt_topology[cpu].core = core_id;
+            dt_topology[cpu].thread = thread;
+            cpumask_set_cpu(cpu, found);
+            any = 1;
+        }
+        thread++;
+    }
+
+    if ( !any && (cpu = get_cpu_for_node(core)) >= 0 )
+    {
+        dt_topology[cpu].cluster = cluster;
+        dt_topology[cpu].core = core_id;
+        dt_topology[cpu].thread = 0;
+        cpumask_set_cpu(cpu, found);
+        any = 1;
+    }
+
+    return any;
+}
+
+/* Clusters may nest; only those holding cores get a number. */
+static void __init parse_dt_cluster(const struct dt_device_node *cluster,
+                                    unsigned int depth, u32 *nr_clusters,
+                                    cpumask_t *found)
+{
+    const struct dt_device_node *c;
+    bool_t leaf = 0;
+    u32 core = 0;
+
+    dt_for_each_child_node( cluster, c )
+        if ( !strncmp(dt_node_name(c), "cluster", 7) )
+            parse_dt_cluster(c, depth + 1, nr_clusters, found);
+
+    dt_for_each_child_node( cluster, c )
+    {
+        if ( strncmp(dt_node_name(c), "core", 4) )
+            continue;
+
+        if ( depth == 0 )
+        {
+            printk(XENLOG_WARNING "cpu-map: core `%s` outside a cluster\n",
+                   dt_node_full_name(c));
+            continue;
+        }
+
+        if ( parse_dt_core(c, *nr_clusters, core, found) )
+            leaf = 1;
+        core++;
+    }
+
+    if ( leaf )
+        (*nr_clusters)++;
+}
+
+/*
+ * Use the /cpus/cpu-map node when it describes every CPU, otherwise fall
+ * back to the MPIDR affinity levels.
+ */
+static void __init parse_dt_topology(void)
+{
+    const struct dt_device_node *map = dt_find_node_by_path("/cpus/cpu-map");
+    cpumask_t found;
+    u32 nr_clusters = 0;
+
+    if ( !map )
+        return;
+
+    cpumask_clear(&found);
+    parse_dt_cluster(map, 0, &nr_clusters, &found);
+
+    if ( !cpumask_subset(&cpu_possible_map, &found) )
+    {
+        printk(XENLOG_WARNING
+               "cpu-map does not cover all CPUs, using MPIDR topology\n");
+        return;
+    }
+
+    topology_from_dt = 1;
+}
+
+/* Work out @cpu's topology. Must run on @cpu. */
+static void store_cpu_topology(unsigned int cpu)
+{
+    struct cpu_topology *topo = &cpu_topology[cpu];
+    register_t mpidr = READ_SYSREG(MPIDR_EL1);
+    u64 cluster;
+    unsigned int i;
+
+    if ( topo->cluster_id >= 0 )
+        return;
+
+    if ( topology_from_dt )
+    {
+        topo->thread_id = dt_topology[cpu].thread;
+        topo->core_id = dt_topology[cpu].core;
+        cluster = dt_topology[cpu].cluster;
+    }
+    else if ( mpidr & MPIDR_MT )
+    {
+        /* Multi-threaded cores: Aff0 is the thread. */
+        topo->thread_id = MPIDR_AFFINITY_LEVEL(mpidr, 0);
+        topo->core_id = MPIDR_AFFINITY_LEVEL(mpidr, 1);
+        cluster = MPIDR_AFFINITY_LEVEL(mpidr, 2);
+#ifdef CONFIG_ARM_64
+        cluster |= MPIDR_AFFINITY_LEVEL(mpidr, 3) << MPIDR_LEVEL_BITS;
+#endif
+    }
+    else
+    {
+        topo->thread_id = 0;
+        topo->core_id = MPIDR_AFFINITY_LEVEL(mpidr, 0);
+        cluster = MPIDR_AFFINITY_LEVEL(mpidr, 1) |
+                  (MPIDR_AFFINITY_LEVEL(mpidr, 2) << MPIDR_LEVEL_BITS);
+#ifdef CONFIG_ARM_64
+        cluster |= MPIDR_AFFINITY_LEVEL(mpidr, 3) << (2 * MPIDR_LEVEL_BITS);
+#endif
+    }
+
+    /*
+     * Schedulers use the cluster as an index (e.g. credit2 runqueues), and
+     * credit2 puts CPU0 on runqueue 0, so number clusters densely in the
+     * order their first CPU comes up.
+     */
+    topo->cluster_id = 0;
+    for ( i = 0; i < nr_cpu_ids; i++ )
+    {
+        if ( i == cpu || cpu_topology[i].cluster_id < 0 )
+            continue;
+        if ( cpu_topology[i].cluster_key == cluster )
+        {
+            topo->cluster_id = cpu_topology[i].cluster_id;
+            break;
+        }
+        topo->cluster_id = max(topo->cluster_id,
+                               cpu_topology[i].cluster_id + 1);
+    }
+    topo->cluster_key = cluster;
+}
+
 static void setup_cpu_sibling_map(int cpu)
 {
+    unsigned int i;
+
     if ( !zalloc_cpumask_var(&per_cpu(cpu_sibling_mask, cpu)) ||
          !zalloc_cpumask_var(&per_cpu(cpu_core_mask, cpu)) )
         panic("No memory for CPU sibling/core maps");
 
+    store_cpu_topology(cpu);
+
     /* A CPU is a sibling with itself and is always on its own core. */
     cpumask_set_cpu(cpu, per_cpu(cpu_sibling_mask, cpu));
     cpumask_set_cpu(cpu, per_cpu(cpu_core_mask, cpu));
+
+    /* Siblings share a core; a cluster plays the part of a socket. */
+    for_each_cpu ( i, &cpu_sibling_setup_map )
+    {
+        if ( cpu_to_socket(i) != cpu_to_socket(cpu) )
+            continue;
+
+        cpumask_set_cpu(i, per_cpu(cpu_core_mask, cpu));
+        cpumask_set_cpu(cpu, per_cpu(cpu_core_mask, i));
+
+        if ( cpu_to_core(i) != cpu_to_core(cpu) )
+            continue;
+
+        cpumask_set_cpu(i, per_cpu(cpu_sibling_mask, cpu));
+        cpumask_set_cpu(cpu, per_cpu(cpu_sibling_mask, i));
+    }
+
+    cpumask_set_cpu(cpu, &cpu_sibling_setup_map);
+}
+
+static void remove_cpu_sibling_map(int cpu)
+{
+    unsigned int i;
+
+    for_each_cpu ( i, per_cpu(cpu_core_mask, cpu) )
+    {
+        cpumask_clear_cpu(cpu, per_cpu(cpu_core_mask, i));
+        cpumask_clear_cpu(cpu, per_cpu(cpu_sibling_mask, i));
+    }
+
+    cpumask_clear_cpu(cpu, &cpu_sibling_setup_map);
 }
 
 void __init
@@ -224,7 +445,10 @@ void __init smp_init_cpus(void)
             tmp_map[i] = MPIDR_INVALID;
         }
         else
+        {
             tmp_map[i] = hwid;
+            cpu_dt_node[i] = cpu;
+        }
     }
 
     if ( !bootcpu_valid )
@@ -240,7 +464,10 @@ void __init smp_init_cpus(void)
             continue;
         cpumask_set_cpu(i, &cpu_possible_map);
         cpu_logical_map(i) = tmp_map[i];
+        numa_set_cpu_node(i, cpu_dt_node[i]);
     }
+
+    parse_dt_topology();
 }
 
 int __init
@@ -325,6 +552,7 @@ void __cpu_disable(void)
 
     /* It's now safe to remove this processor from the online map */
     cpumask_clear_cpu(cpu, &cpu_online_map);
+    remove_cpu_sibling_map(cpu);
 
     if ( cpu_disable_scheduler(cpu) )
         BUG();
@@ -71,6 +71,13 @@ static int debug_stack_lines = 40;
 
 integer_param("debug_stack_lines", debug_stack_lines);
 
+/* Longest time (in us) to poll for an interrupt before blocking on WFI. */
+static unsigned int __read_mostly vwfi_poll;
+integer_param("vwfi_poll", vwfi_poll);
+
+/* Trap WFE so that spinning vcpus give way to preempted siblings. */
+static bool_t __read_mostly vwfe = 1;
+boolean_param("vwfe", vwfe);
 
 void __cpuinit init_traps(void)
 {
@@ -92,7 +99,7 @@ void __cpuinit init_traps(void)
 
     /* Setup hypervisor traps */
     WRITE_SYSREG(HCR_PTW|HCR_BSU_INNER|HCR_AMO|HCR_IMO|HCR_VM|HCR_TWI|HCR_TSC|
-                 HCR_TAC|HCR_SWIO|HCR_TIDCP, HCR_EL2);
+                 HCR_TAC|HCR_SWIO|HCR_TIDCP|(vwfe ? HCR_TWE : 0), HCR_EL2);
     isb();
 }
 
@@ -1795,6 +1802,107 @@ bad_data_abort:
     inject_dabt_exception(regs, info.gva, hsr.len);
 }
 
+/* First poll window, and the granularity below which polling stops. */
+#define WFI_POLL_MIN_NS MICROSECS(10)
+
+/*
+ * Spin with interrupts enabled until the vcpu has an interrupt to take,
+ * the window closes, or this pcpu has other work to do.
+ */
+static bool_t wfi_poll(struct vcpu *v)
+{
+    unsigned int cpu = smp_processor_id();
+    s_time_t deadline = NOW() + v->arch.wfx.poll_ns;
+
+    do {
+        if ( local_events_need_delivery_nomask() )
+            return 1;
+        if ( softirq_pending(cpu) )
+            break;
+        cpu_relax();
+    } while ( NOW() < deadline );
+
+    return 0;
+}
+
+/*
+ * The poll window adapts per vcpu: it doubles, up to vwfi_poll, each time
+ * a block turns out to have been shorter than that, and halves each time
+ * polling fails, so vcpus which idle for long periods stop polling.
+ */
+static void do_trap_wfi(struct cpu_user_regs *regs, union hsr hsr)
+{
+    struct vcpu *v = current;
+    s_time_t max = MICROSECS(vwfi_poll);
+
+    if ( v->arch.wfx.blocked )
+    {
+        s_time_t blocked = v->runstate.time[RUNSTATE_blocked] -
+                           v->arch.wfx.block_start;
+
+        v->arch.wfx.blocked = 0;
+        if ( blocked < max )
+            v->arch.wfx.poll_ns = min(max, v->arch.wfx.poll_ns ?
+                                           v->arch.wfx.poll_ns * 2 :
+                                           WFI_POLL_MIN_NS);
+    }
+
+    if ( v->arch.wfx.poll_ns )
+    {
+        if ( wfi_poll(v) )
+        {
+            v->arch.wfx.poll_hits++;
+            advance_pc(regs, hsr);
+            return;
+        }
+
+        v->arch.wfx.poll_misses++;
+        v->arch.wfx.poll_ns /= 2;
+        if ( v->arch.wfx.poll_ns < WFI_POLL_MIN_NS )
+            v->arch.wfx.poll_ns = 0;
+    }
+
+    v->arch.wfx.blocks++;
+    v->arch.wfx.blocked = 1;
+    v->arch.wfx.block_start = v->runstate.time[RUNSTATE_blocked];
+
+    vcpu_block();
+    /* The ARM spec declares that even if local irqs are masked in
+     * the CPSR register, an irq should wake up a cpu from WFI anyway.
+     * For this reason we need to check for irqs that need delivery,
+     * ignoring the CPSR register, *after* calling SCHEDOP_block to
+     * avoid races with vgic_vcpu_inject_irq.
+     */
+    if ( local_events_need_delivery_nomask() )
+        vcpu_unblock(current);
+    advance_pc(regs, hsr);
+}
+
+/*
+ * A vcpu spinning in WFE is most likely waiting for a lock held by a
+ * sibling which has been descheduled.  Give the pcpu up if there is such
+ * a sibling, otherwise let the guest go round its loop again: WFE is
+ * allowed to complete early.
+ */
+static void do_trap_wfe(struct cpu_user_regs *regs, union hsr hsr)
+{
+    struct vcpu *v = current, *t;
+
+    v->arch.wfx.wfe_traps++;
+
+    for_each_vcpu ( v->domain, t )
+    {
+        if ( t != v && !t->is_running && vcpu_runnable(t) )
+        {
+            v->arch.wfx.wfe_yields++;
+            vcpu_yield();
+            break;
+        }
+    }
+
+    advance_pc(regs, hsr);
+}
+
 static void enter_hypervisor_head(struct cpu_user_regs *regs)
 {
     if ( guest_mode(regs) )
@@ -1814,17 +1922,10 @@ asmlinkage void do_trap_hypervisor(struct cpu_user_regs *regs)
             advance_pc(regs, hsr);
             return;
         }
-        /* at the moment we only trap WFI */
-        vcpu_block();
-        /* The ARM spec declares that even if local irqs are masked in
-         * the CPSR register, an irq should wake up a cpu from WFI anyway.
-         * For this reason we need to check for irqs that need delivery,
-         * ignoring the CPSR register, *after* calling SCHEDOP_block to
-         * avoid races with vgic_vcpu_inject_irq.
-         */
-        if ( local_events_need_delivery_nomask() )
-            vcpu_unblock(current);
-        advance_pc(regs, hsr);
+        if ( hsr.wfi_wfe.ti )
+            do_trap_wfe(regs, hsr);
+        else
+            do_trap_wfi(regs, hsr);
         break;
     case HSR_EC_CP15_32:
         if ( !is_32bit_domain(current->domain) )
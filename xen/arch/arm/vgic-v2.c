@@ -24,6 +24,7 @@
 #include <xen/softirq.h>
 #include <xen/irq.h>
 #include <xen/sched.h>
+#include <xen/trace.h>
 
 #include <asm/current.h>
 #include <asm/device.h>
@@ -32,7 +33,7 @@
 #include <asm/gic.h>
 #include <asm/vgic.h>
 
-static int vgic_v2_distr_mmio_read(struct vcpu *v, mmio_info_t *info)
+static int __vgic_v2_distr_mmio_read(struct vcpu *v, mmio_info_t *info)
 {
     struct hsr_dabt dabt = info->dabt;
     struct cpu_user_regs *regs = guest_cpu_user_regs();
@@ -261,7 +262,7 @@ static int vgic_v2_to_sgi(struct vcpu *v, register_t sgir)
     return vgic_to_sgi(v, sgir, sgi_mode, virq, vcpu_mask);
 }
 
-static int vgic_v2_distr_mmio_write(struct vcpu *v, mmio_info_t *info)
+static int __vgic_v2_distr_mmio_write(struct vcpu *v, mmio_info_t *info)
 {
     struct hsr_dabt dabt = info->dabt;
     struct cpu_user_regs *regs = guest_cpu_user_regs();
@@ -455,6 +456,20 @@ write_ignore:
     return 1;
 }
 
+static int vgic_v2_distr_mmio_read(struct vcpu *v, mmio_info_t *info)
+{
+    return vgic_mmio_access(v, info, TRC_VGIC_DIST_READ,
+                            info->gpa - v->domain->arch.vgic.dbase,
+                            __vgic_v2_distr_mmio_read);
+}
+
+static int vgic_v2_distr_mmio_write(struct vcpu *v, mmio_info_t *info)
+{
+    return vgic_mmio_access(v, info, TRC_VGIC_DIST_WRITE,
+                            info->gpa - v->domain->arch.vgic.dbase,
+                            __vgic_v2_distr_mmio_write);
+}
+
 const struct mmio_handler_ops vgic_v2_distr_mmio_handler = {
     .read_handler  = vgic_v2_distr_mmio_read,
     .write_handler = vgic_v2_distr_mmio_write,
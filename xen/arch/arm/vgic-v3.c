@@ -25,6 +25,7 @@
 #include <xen/softirq.h>
 #include <xen/irq.h>
 #include <xen/sched.h>
+#include <xen/trace.h>
 
 #include <asm/current.h>
 #include <asm/device.h>
@@ -546,7 +547,7 @@ write_ignore:
     return 1;
 }
 
-static int vgic_v3_rdistr_mmio_read(struct vcpu *v, mmio_info_t *info)
+static int __vgic_v3_rdistr_mmio_read(struct vcpu *v, mmio_info_t *info)
 {
     uint32_t offset;
 
@@ -563,7 +564,7 @@ static int vgic_v3_rdistr_mmio_read(struct vcpu *v, mmio_info_t *info)
     return 0;
 }
 
-static int vgic_v3_rdistr_mmio_write(struct vcpu *v, mmio_info_t *info)
+static int __vgic_v3_rdistr_mmio_write(struct vcpu *v, mmio_info_t *info)
 {
     uint32_t offset;
 
@@ -579,7 +580,7 @@ static int vgic_v3_rdistr_mmio_write(struct vcpu *v, mmio_info_t *info)
     return 0;
 }
 
-static int vgic_v3_distr_mmio_read(struct vcpu *v, mmio_info_t *info)
+static int __vgic_v3_distr_mmio_read(struct vcpu *v, mmio_info_t *info)
 {
     struct hsr_dabt dabt = info->dabt;
     struct cpu_user_regs *regs = guest_cpu_user_regs();
@@ -713,7 +714,7 @@ read_as_zero:
     return 1;
 }
 
-static int vgic_v3_distr_mmio_write(struct vcpu *v, mmio_info_t *info)
+static int __vgic_v3_distr_mmio_write(struct vcpu *v, mmio_info_t *info)
 {
     struct hsr_dabt dabt = info->dabt;
     struct cpu_user_regs *regs = guest_cpu_user_regs();
@@ -885,6 +886,34 @@ int vgic_emulate(struct cpu_user_regs *regs, union hsr hsr)
     }
 }
 
+static int vgic_v3_rdistr_mmio_read(struct vcpu *v, mmio_info_t *info)
+{
+    return vgic_mmio_access(v, info, TRC_VGIC_RDIST_READ,
+                            info->gpa & (v->domain->arch.vgic.rdist_stride - 1),
+                            __vgic_v3_rdistr_mmio_read);
+}
+
+static int vgic_v3_rdistr_mmio_write(struct vcpu *v, mmio_info_t *info)
+{
+    return vgic_mmio_access(v, info, TRC_VGIC_RDIST_WRITE,
+                            info->gpa & (v->domain->arch.vgic.rdist_stride - 1),
+                            __vgic_v3_rdistr_mmio_write);
+}
+
+static int vgic_v3_distr_mmio_read(struct vcpu *v, mmio_info_t *info)
+{
+    return vgic_mmio_access(v, info, TRC_VGIC_DIST_READ,
+                            info->gpa - v->domain->arch.vgic.dbase,
+                            __vgic_v3_distr_mmio_read);
+}
+
+static int vgic_v3_distr_mmio_write(struct vcpu *v, mmio_info_t *info)
+{
+    return vgic_mmio_access(v, info, TRC_VGIC_DIST_WRITE,
+                            info->gpa - v->domain->arch.vgic.dbase,
+                            __vgic_v3_distr_mmio_write);
+}
+
 static const struct mmio_handler_ops vgic_rdistr_mmio_handler = {
     .read_handler  = vgic_v3_rdistr_mmio_read,
     .write_handler = vgic_v3_rdistr_mmio_write,
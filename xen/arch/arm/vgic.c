@@ -24,6 +24,7 @@
 #include <xen/softirq.h>
 #include <xen/irq.h>
 #include <xen/sched.h>
+#include <xen/trace.h>
 
 #include <asm/current.h>
 
@@ -295,6 +296,8 @@ void vgic_vcpu_inject_irq(struct vcpu *v, unsigned int irq)
     unsigned long flags;
     bool_t running;
 
+    TRACE_2D(TRC_GIC_INJECT, (v->domain->domain_id << 16) | v->vcpu_id, irq);
+
     spin_lock_irqsave(&v->arch.vgic.lock, flags);
 
     if ( !list_empty(&n->inflight) )
@@ -339,6 +342,30 @@ out:
         smp_send_event_check_mask(cpumask_of(v->processor));
 }
 
+/*
+ * Emulate a vGIC register read or write with @handler.  While tracing,
+ * record it as @event with the register @offset, the value read or
+ * written, and how long the emulation took.
+ */
+int vgic_mmio_access(struct vcpu *v, mmio_info_t *info, uint32_t event,
+                     uint32_t offset,
+                     int (*handler)(struct vcpu *v, mmio_info_t *info))
+{
+    register_t *r;
+    s_time_t start;
+    int rc;
+
+    if ( likely(!tb_init_done) )
+        return handler(v, info);
+
+    start = NOW();
+    rc = handler(v, info);
+    r = select_user_reg(guest_cpu_user_regs(), info->dabt.reg);
+    TRACE_4D(event, offset, *r, (rc << 8) | info->dabt.size, NOW() - start);
+
+    return rc;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -301,6 +301,7 @@ static void __init process_memory_node(const void *fdt, int node,
     const __be32 *cell;
     paddr_t start, size;
     u32 reg_cells = address_cells + size_cells;
+    int nid;
 
     if ( address_cells < 1 || size_cells < 1 )
     {
@@ -319,15 +320,45 @@ static void __init process_memory_node(const void *fdt, int node,
     cell = (const __be32 *)prop->data;
     banks = fdt32_to_cpu(prop->len) / (reg_cells * sizeof (u32));
 
+    nid = device_tree_get_u32(fdt, node, "numa-node-id", -1);
+
     for ( i = 0; i < banks && early_info.mem.nr_banks < NR_MEM_BANKS; i++ )
     {
         device_tree_get_reg(&cell, address_cells, size_cells, &start, &size);
         early_info.mem.bank[early_info.mem.nr_banks].start = start;
         early_info.mem.bank[early_info.mem.nr_banks].size = size;
+        early_info.mem.bank[early_info.mem.nr_banks].nid = nid;
         early_info.mem.nr_banks++;
     }
 }
 
+static void __init process_distance_map_node(const void *fdt, int node,
+                                             const char *name)
+{
+    struct dt_numa_info *numa = &early_info.numa;
+    const struct fdt_property *prop;
+    const __be32 *cell;
+    int i, entries;
+
+    prop = fdt_get_property(fdt, node, "distance-matrix", NULL);
+    if ( !prop )
+    {
+        printk("fdt: node `%s': missing `distance-matrix' property\n", name);
+        return;
+    }
+
+    cell = (const __be32 *)prop->data;
+    entries = fdt32_to_cpu(prop->len) / (3 * sizeof(u32));
+
+    for ( i = 0; i < entries && numa->nr_distances < NR_NUMA_DISTANCES; i++ )
+    {
+        numa->distance[numa->nr_distances].from = dt_next_cell(1, &cell);
+        numa->distance[numa->nr_distances].to = dt_next_cell(1, &cell);
+        numa->distance[numa->nr_distances].distance = dt_next_cell(1, &cell);
+        numa->nr_distances++;
+    }
+}
+
 static void __init process_multiboot_node(const void *fdt, int node,
                                           const char *name,
                                           u32 address_cells, u32 size_cells)
@@ -437,6 +468,8 @@ static int __init early_scan_node(const void *fdt,
         process_multiboot_node(fdt, node, name, address_cells, size_cells);
     else if ( depth == 1 && device_tree_node_matches(fdt, node, "chosen") )
         process_chosen_node(fdt, node, name, address_cells, size_cells);
+    else if ( device_tree_node_compatible(fdt, node, "numa-distance-map-v1") )
+        process_distance_map_node(fdt, node, name);
 
     return 0;
 }
@@ -448,9 +481,14 @@ static void __init early_print_info(void)
     int i, nr_rsvd;
 
     for ( i = 0; i < mi->nr_banks; i++ )
-        printk("RAM: %"PRIpaddr" - %"PRIpaddr"\n",
+    {
+        printk("RAM: %"PRIpaddr" - %"PRIpaddr,
                      mi->bank[i].start,
                      mi->bank[i].start + mi->bank[i].size - 1);
+        if ( mi->bank[i].nid >= 0 )
+            printk(" node %d", mi->bank[i].nid);
+        printk("\n");
+    }
     printk("\n");
     for ( i = 1 ; i < mods->nr_mods + 1; i++ )
         printk("MODULE[%d]: %"PRIpaddr" - %"PRIpaddr" %s\n",
@@ -861,7 +861,7 @@ void domain_destroy(struct domain *d)
     spin_unlock(&domlist_update_lock);
 
     /* Schedule RCU asynchronous completion of domain destroy. */
-    call_rcu(&d->rcu, complete_domain_destroy);
+    call_rcu_expedited(&d->rcu, complete_domain_destroy);
 }
 
 void vcpu_pause(struct vcpu *v)
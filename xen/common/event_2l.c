@@ -33,7 +33,7 @@ static void evtchn_2l_set_pending(struct vcpu *v, struct evtchn *evtchn)
          !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
                            &vcpu_info(v, evtchn_pending_sel)) )
     {
-        vcpu_mark_events_pending(v);
+        evtchn_port_notify(v, evtchn);
     }
 
     evtchn_check_pollers(d, port);
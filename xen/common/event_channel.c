@@ -97,6 +97,21 @@ static uint8_t get_xen_consumer(xen_event_channel_notification_t fn)
 
 static void evtchn_set_pending(struct vcpu *v, int port);
 
+/*
+ * Upcall moderation state of a port, allocated the first time
+ * EVTCHNOP_set_moderation is used on it and freed when it is closed.
+ * The counters are statistics only and are updated without locking.
+ */
+struct evtchn_moderation {
+    s_time_t     interval;  /* Minimum time between upcalls. */
+    s_time_t     last;      /* When the port last raised an upcall. */
+    struct vcpu *vcpu;      /* vCPU owed the deferred upcall. */
+    struct timer timer;     /* Raises the deferred upcall. */
+    bool_t       deferred;  /* Is an upcall waiting on the timer? */
+    uint64_t     notified;  /* Upcalls raised. */
+    uint64_t     coalesced; /* Events whose upcall was deferred. */
+};
+
 static int virq_is_global(uint32_t virq)
 {
     int rc;
@@ -141,6 +156,7 @@ static struct evtchn *alloc_evtchn_bucket(struct domain *d, unsigned int port)
             return NULL;
         }
         chn[i].port = port + i;
+        spin_lock_init(&chn[i].lock);
     }
     return chn;
 }
@@ -191,9 +207,40 @@ static int get_free_port(struct domain *d)
         return -ENOMEM;
     bucket_from_port(d, port) = chn;
 
+    /* Publish the bucket before making its ports valid to lockless users. */
+    smp_wmb();
+    write_atomic(&d->valid_evtchns, d->valid_evtchns + EVTCHNS_PER_BUCKET);
+
     return port;
 }
 
+/*
+ * Each channel's lock serialises sends through it against changes to
+ * its binding.  Both ends of an interdomain channel are locked when it
+ * is bound or closed, in address order to avoid deadlock.
+ */
+static void double_evtchn_lock(struct evtchn *lchn, struct evtchn *rchn)
+{
+    if ( lchn < rchn )
+    {
+        spin_lock(&lchn->lock);
+        spin_lock(&rchn->lock);
+    }
+    else
+    {
+        if ( lchn != rchn )
+            spin_lock(&rchn->lock);
+        spin_lock(&lchn->lock);
+    }
+}
+
+static void double_evtchn_unlock(struct evtchn *lchn, struct evtchn *rchn)
+{
+    spin_unlock(&lchn->lock);
+    if ( lchn != rchn )
+        spin_unlock(&rchn->lock);
+}
+
 
 static long evtchn_alloc_unbound(evtchn_alloc_unbound_t *alloc)
 {
@@ -217,11 +264,15 @@ static long evtchn_alloc_unbound(evtchn_alloc_unbound_t *alloc)
     if ( rc )
         goto out;
 
+    spin_lock(&chn->lock);
+
     chn->state = ECS_UNBOUND;
     if ( (chn->u.unbound.remote_domid = alloc->remote_dom) == DOMID_SELF )
         chn->u.unbound.remote_domid = current->domain->domain_id;
     evtchn_port_init(d, chn);
 
+    spin_unlock(&chn->lock);
+
     alloc->port = port;
 
  out:
@@ -274,6 +325,8 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
     if ( rc )
         goto out;
 
+    double_evtchn_lock(lchn, rchn);
+
     lchn->u.interdomain.remote_dom  = rd;
     lchn->u.interdomain.remote_port = rport;
     lchn->state                     = ECS_INTERDOMAIN;
@@ -289,6 +342,8 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
      */
     evtchn_set_pending(ld->vcpu[lchn->notify_vcpu_id], lport);
 
+    double_evtchn_unlock(lchn, rchn);
+
     bind->local_port = lport;
 
  out:
@@ -329,11 +384,16 @@ static long evtchn_bind_virq(evtchn_bind_virq_t *bind)
         ERROR_EXIT(port);
 
     chn = evtchn_from_port(d, port);
+
+    spin_lock(&chn->lock);
+
     chn->state          = ECS_VIRQ;
     chn->notify_vcpu_id = vcpu;
     chn->u.virq         = virq;
     evtchn_port_init(d, chn);
 
+    spin_unlock(&chn->lock);
+
     v->virq_to_evtchn[virq] = bind->port = port;
 
  out:
@@ -360,10 +420,15 @@ static long evtchn_bind_ipi(evtchn_bind_ipi_t *bind)
         ERROR_EXIT(port);
 
     chn = evtchn_from_port(d, port);
+
+    spin_lock(&chn->lock);
+
     chn->state          = ECS_IPI;
     chn->notify_vcpu_id = vcpu;
     evtchn_port_init(d, chn);
 
+    spin_unlock(&chn->lock);
+
     bind->port = port;
 
  out:
@@ -438,11 +503,15 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
         goto out;
     }
 
+    spin_lock(&chn->lock);
+
     chn->state  = ECS_PIRQ;
     chn->u.pirq.irq = pirq;
     link_pirq_port(port, chn, v);
     evtchn_port_init(d, chn);
 
+    spin_unlock(&chn->lock);
+
     bind->port = port;
 
 #ifdef CONFIG_X86
@@ -457,6 +526,26 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
 }
 
 
+/* Called with the channel's lock held. */
+static void free_evtchn(struct domain *d, struct evtchn *chn)
+{
+    if ( chn->moderation )
+    {
+        kill_timer(&chn->moderation->timer);
+        xfree(chn->moderation);
+        chn->moderation = NULL;
+    }
+
+    /* Clear pending event to avoid unexpected behavior on re-bind. */
+    evtchn_port_clear_pending(d, chn);
+
+    /* Reset binding to vcpu0 when the channel is freed. */
+    chn->state          = ECS_FREE;
+    chn->notify_vcpu_id = 0;
+
+    xsm_evtchn_close_post(chn);
+}
+
 static long __evtchn_close(struct domain *d1, int port1)
 {
     struct domain *d2 = NULL;
@@ -563,22 +652,24 @@ static long __evtchn_close(struct domain *d1, int port1)
         BUG_ON(chn2->state != ECS_INTERDOMAIN);
         BUG_ON(chn2->u.interdomain.remote_dom != d1);
 
+        double_evtchn_lock(chn1, chn2);
+
+        free_evtchn(d1, chn1);
+
         chn2->state = ECS_UNBOUND;
         chn2->u.unbound.remote_domid = d1->domain_id;
-        break;
+
+        double_evtchn_unlock(chn1, chn2);
+
+        goto out;
 
     default:
         BUG();
     }
 
-    /* Clear pending event to avoid unexpected behavior on re-bind. */
-    evtchn_port_clear_pending(d1, chn1);
-
-    /* Reset binding to vcpu0 when the channel is freed. */
-    chn1->state          = ECS_FREE;
-    chn1->notify_vcpu_id = 0;
-
-    xsm_evtchn_close_post(chn1);
+    spin_lock(&chn1->lock);
+    free_evtchn(d1, chn1);
+    spin_unlock(&chn1->lock);
 
  out:
     if ( d2 != NULL )
@@ -606,21 +697,24 @@ int evtchn_send(struct domain *d, unsigned int lport)
     struct vcpu   *rvcpu;
     int            rport, ret = 0;
 
-    spin_lock(&ld->event_lock);
-
     if ( unlikely(!port_is_valid(ld, lport)) )
-    {
-        spin_unlock(&ld->event_lock);
         return -EINVAL;
-    }
 
     lchn = evtchn_from_port(ld, lport);
 
+    /*
+     * Only this channel's lock is needed: while it is held the channel
+     * cannot be closed or rebound, and nor can an interdomain peer, so
+     * sends through different ports (or from different vCPUs) do not
+     * contend on the domain's event_lock.
+     */
+    spin_lock(&lchn->lock);
+
     /* Guest cannot send via a Xen-attached event channel. */
     if ( unlikely(consumer_is_xen(lchn)) )
     {
-        spin_unlock(&ld->event_lock);
-        return -EINVAL;
+        ret = -EINVAL;
+        goto out;
     }
 
     ret = xsm_evtchn_send(XSM_HOOK, ld, lchn);
@@ -650,7 +744,7 @@ int evtchn_send(struct domain *d, unsigned int lport)
     }
 
 out:
-    spin_unlock(&ld->event_lock);
+    spin_unlock(&lchn->lock);
 
     return ret;
 }
@@ -660,6 +754,103 @@ static void evtchn_set_pending(struct vcpu *v, int port)
     evtchn_port_set_pending(v, evtchn_from_port(v->domain, port));
 }
 
+static void evtchn_moderation_timer_fn(void *data)
+{
+    struct evtchn_moderation *mod = data;
+
+    mod->last = NOW();
+    mod->notified++;
+
+    /* Events arriving from now on start a new interval. */
+    mod->deferred = 0;
+    smp_mb();
+
+    vcpu_mark_events_pending(mod->vcpu);
+}
+
+void evtchn_moderate_notify(struct vcpu *v, struct evtchn *evtchn)
+{
+    struct evtchn_moderation *mod = evtchn->moderation;
+    s_time_t now = NOW();
+
+    if ( !mod->deferred && now - mod->last >= read_atomic(&mod->interval) )
+    {
+        mod->last = now;
+        mod->notified++;
+        vcpu_mark_events_pending(v);
+        return;
+    }
+
+    mod->coalesced++;
+    mod->vcpu = v;
+    smp_mb(); /* set vcpu /then/ claim the timer */
+
+    if ( !test_and_set_bool(mod->deferred) )
+        set_timer(&mod->timer, mod->last + mod->interval);
+}
+
+static long evtchn_set_moderation(struct evtchn_set_moderation *set)
+{
+    struct domain *d = current->domain;
+    struct evtchn *chn;
+    struct evtchn_moderation *mod;
+    long rc = 0;
+
+    spin_lock(&d->event_lock);
+
+    if ( !port_is_valid(d, set->port) )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    chn = evtchn_from_port(d, set->port);
+
+    if ( chn->state == ECS_FREE || chn->state == ECS_RESERVED ||
+         consumer_is_xen(chn) )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    if ( (mod = chn->moderation) == NULL )
+    {
+        set->notified = set->coalesced = 0;
+        if ( !set->interval_us )
+            goto out;
+
+        if ( (mod = xzalloc(struct evtchn_moderation)) == NULL )
+        {
+            rc = -ENOMEM;
+            goto out;
+        }
+        mod->vcpu = d->vcpu[chn->notify_vcpu_id];
+        init_timer(&mod->timer, evtchn_moderation_timer_fn, mod,
+                   mod->vcpu->processor);
+
+        /* Senders read chn->moderation without holding chn->lock. */
+        smp_wmb();
+        spin_lock(&chn->lock);
+        chn->moderation = mod;
+        spin_unlock(&chn->lock);
+    }
+    else
+    {
+        set->notified = mod->notified;
+        set->coalesced = mod->coalesced;
+        mod->notified = mod->coalesced = 0;
+    }
+
+    /* A zero interval lets every event through; a deferred upcall still
+       fires on its timer. */
+    write_atomic(&mod->interval, MICROSECS(set->interval_us));
+
+ out:
+    spin_unlock(&d->event_lock);
+
+    return rc;
+}
+
 int guest_enabled_event(struct vcpu *v, uint32_t virq)
 {
     return ((v != NULL) && (v->virq_to_evtchn[virq] != 0));
@@ -1121,6 +1312,16 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_set_moderation: {
+        struct evtchn_set_moderation set_moderation;
+        if ( copy_from_guest(&set_moderation, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_set_moderation(&set_moderation);
+        if ( !rc && __copy_to_guest(arg, &set_moderation, 1) )
+            rc = -EFAULT;
+        break;
+    }
+
     default:
         rc = -ENOSYS;
         break;
@@ -1146,11 +1347,15 @@ int alloc_unbound_xen_event_channel(
 
     rc = xsm_evtchn_unbound(XSM_TARGET, d, chn, remote_domid);
 
+    spin_lock(&chn->lock);
+
     chn->state = ECS_UNBOUND;
     chn->xen_consumer = get_xen_consumer(notification_fn);
     chn->notify_vcpu_id = local_vcpu->vcpu_id;
     chn->u.unbound.remote_domid = !rc ? remote_domid : DOMID_INVALID;
 
+    spin_unlock(&chn->lock);
+
  out:
     spin_unlock(&d->event_lock);
 
@@ -1189,27 +1394,21 @@ void notify_via_xen_event_channel(struct domain *ld, int lport)
     struct domain *rd;
     int            rport;
 
-    spin_lock(&ld->event_lock);
-
-    if ( unlikely(ld->is_dying) )
-    {
-        spin_unlock(&ld->event_lock);
-        return;
-    }
-
     ASSERT(port_is_valid(ld, lport));
     lchn = evtchn_from_port(ld, lport);
-    ASSERT(consumer_is_xen(lchn));
+
+    spin_lock(&lchn->lock);
 
     if ( likely(lchn->state == ECS_INTERDOMAIN) )
     {
+        ASSERT(consumer_is_xen(lchn));
         rd    = lchn->u.interdomain.remote_dom;
         rport = lchn->u.interdomain.remote_port;
         rchn  = evtchn_from_port(rd, rport);
         evtchn_set_pending(rd->vcpu[rchn->notify_vcpu_id], rport);
     }
 
-    spin_unlock(&ld->event_lock);
+    spin_unlock(&lchn->lock);
 }
 
 void evtchn_check_pollers(struct domain *d, unsigned int port)
@@ -1244,6 +1443,7 @@ int evtchn_init(struct domain *d)
     d->evtchn = alloc_evtchn_bucket(d, 0);
     if ( !d->evtchn )
         return -ENOMEM;
+    d->valid_evtchns = EVTCHNS_PER_BUCKET;
 
     spin_lock_init(&d->event_lock);
     if ( get_free_port(d) != 0 )
@@ -1269,7 +1469,7 @@ int evtchn_init(struct domain *d)
 
 void evtchn_destroy(struct domain *d)
 {
-    unsigned int i, j;
+    unsigned int i;
 
     /* After this barrier no new event-channel allocations can occur. */
     BUG_ON(!d->is_dying);
@@ -1282,8 +1482,20 @@ void evtchn_destroy(struct domain *d)
         (void)__evtchn_close(d, i);
     }
 
-    /* Free all event-channel buckets. */
-    spin_lock(&d->event_lock);
+    clear_global_virq_handlers(d);
+
+    evtchn_fifo_destroy(d);
+}
+
+
+void evtchn_destroy_final(struct domain *d)
+{
+    unsigned int i, j;
+
+    /*
+     * Free all event-channel buckets.  This is deferred until the domain
+     * can no longer be found, as senders look ports up without locking.
+     */
     for ( i = 0; i < NR_EVTCHN_GROUPS; i++ )
     {
         if ( !d->evtchn_group[i] )
@@ -1295,16 +1507,7 @@ void evtchn_destroy(struct domain *d)
     }
     free_evtchn_bucket(d, d->evtchn);
     d->evtchn = NULL;
-    spin_unlock(&d->event_lock);
 
-    clear_global_virq_handlers(d);
-
-    evtchn_fifo_destroy(d);
-}
-
-
-void evtchn_destroy_final(struct domain *d)
-{
 #if MAX_VIRT_CPUS > BITS_PER_LONG
     xfree(d->poll_mask);
     d->poll_mask = NULL;
@@ -1380,6 +1583,11 @@ static void domain_dump_evtchn_info(struct domain *d)
             break;
         }
 
+        if ( chn->moderation )
+            printk(" m=%"PRI_stime"us/%"PRIu64"/%"PRIu64,
+                   chn->moderation->interval / MICROSECS(1),
+                   chn->moderation->notified, chn->moderation->coalesced);
+
         ssid = xsm_show_security_evtchn(d, chn);
         if (ssid) {
             printk(" Z=%s\n", ssid);
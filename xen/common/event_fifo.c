@@ -25,8 +25,13 @@ static inline event_word_t *evtchn_fifo_word_from_port(struct domain *d,
 {
     unsigned int p, w;
 
-    if ( unlikely(port >= d->evtchn_fifo->num_evtchns) )
+    /*
+     * Callers need not hold d->event_lock, so read num_evtchns before the
+     * event_array[] slot it covers.
+     */
+    if ( unlikely(port >= read_atomic(&d->evtchn_fifo->num_evtchns)) )
         return NULL;
+    smp_rmb();
 
     p = port / EVTCHN_FIFO_EVENT_WORDS_PER_PAGE;
     w = port % EVTCHN_FIFO_EVENT_WORDS_PER_PAGE;
@@ -162,7 +167,16 @@ static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
     if ( unlikely(!word) )
     {
         evtchn->pending = 1;
-        return;
+
+        /*
+         * The page may have been added concurrently, after its pending
+         * events were re-raised.  Pairs with the barrier in
+         * add_page_to_event_array().
+         */
+        smp_mb();
+        word = evtchn_fifo_word_from_port(d, port);
+        if ( !word )
+            return;
     }
 
     was_pending = test_and_set_bit(EVTCHN_FIFO_PENDING, word);
@@ -236,7 +250,7 @@ static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
         if ( !linked
              && !test_and_set_bit(q->priority,
                                   &v->evtchn_fifo->control_block->ready) )
-            vcpu_mark_events_pending(v);
+            evtchn_port_notify(v, evtchn);
     }
  done:
     if ( !was_pending )
@@ -548,7 +562,12 @@ static int add_page_to_event_array(struct domain *d, unsigned long gfn)
         return rc;
 
     d->evtchn_fifo->event_array[slot] = virt;
-    d->evtchn_fifo->num_evtchns += EVTCHN_FIFO_EVENT_WORDS_PER_PAGE;
+
+    /* Senders look up event words without d->event_lock. */
+    smp_wmb();
+    write_atomic(&d->evtchn_fifo->num_evtchns,
+                 d->evtchn_fifo->num_evtchns + EVTCHN_FIFO_EVENT_WORDS_PER_PAGE);
+    smp_mb(); /* publish num_evtchns /then/ sample evtchn->pending */
 
     /*
      * Re-raise any events that were pending while this array page was
@@ -45,16 +45,38 @@
 #include <xen/softirq.h>
 #include <xen/cpu.h>
 #include <xen/stop_machine.h>
+#include <xen/keyhandler.h>
+
+/*
+ * Quiescent states are gathered in two levels. Each CPU reports to the
+ * leaf node covering its group of RCU_FANOUT CPUs, and only the last CPU
+ * of a leaf to report goes on to the global control block, so the global
+ * lock is taken once per leaf per grace period rather than once per CPU.
+ */
+#define RCU_FANOUT      16
+#define RCU_NR_LEAVES   DIV_ROUND_UP(NR_CPUS, RCU_FANOUT)
+
+struct rcu_node {
+    spinlock_t    lock;
+    long          batch;   /* Batch # that qsmask refers to */
+    unsigned long qsmask;  /* CPUs still to pass a quiescent state */
+} __cacheline_aligned;
 
 /* Global control variables for rcupdate callback mechanism. */
 static struct rcu_ctrlblk {
     long cur;           /* Current batch number.                      */
     long completed;     /* Number of the last completed batch         */
     int  next_pending;  /* Is the next batch already waiting?         */
+    bool_t expedite;    /* Kick all CPUs when the next batch starts.  */
+    unsigned long nr_expedited; /* Expedited requests, for 'U' key.   */
 
     spinlock_t  lock __cacheline_aligned;
-    cpumask_t   cpumask; /* CPUs that need to switch in order    */
-    /* for current batch to proceed.        */
+    /* Leaf nodes that still have CPUs to switch for the current batch. */
+    DECLARE_BITMAP(leafmask, RCU_NR_LEAVES);
+    /* CPUs idling without a tick, which new batches don't wait for. */
+    cpumask_t idle_cpumask;
+
+    struct rcu_node leaf[RCU_NR_LEAVES];
 } __cacheline_aligned rcu_ctrlblk = {
     .cur = -300,
     .completed = -300,
@@ -84,6 +106,10 @@ struct rcu_data {
     int cpu;
     struct rcu_head barrier;
     long            last_rs_qlen;     /* qlen during the last resched */
+
+    /* 3) statistics, for the 'U' key */
+    unsigned long   nr_queued;        /* callbacks queued on this cpu */
+    unsigned long   nr_invoked;       /* callbacks invoked on this cpu */
 };
 
 static DEFINE_PER_CPU(struct rcu_data, rcu_data);
@@ -148,6 +174,25 @@ static inline int rcu_batch_after(long a, long b)
     return (a - b) > 0;
 }
 
+/*
+ * Gather the CPUs that the current batch is still waiting for. Done without
+ * locking, so the result is only a hint.
+ */
+static void rcu_waiting_cpus(struct rcu_ctrlblk *rcp, cpumask_t *mask)
+{
+    unsigned int i, cpu;
+    unsigned long qsmask;
+
+    cpumask_clear(mask);
+    for_each_set_bit ( i, rcp->leafmask, RCU_NR_LEAVES )
+    {
+        qsmask = read_atomic(&rcp->leaf[i].qsmask);
+        for ( cpu = i * RCU_FANOUT; qsmask; qsmask >>= 1, cpu++ )
+            if ( qsmask & 1 )
+                cpumask_set_cpu(cpu, mask);
+    }
+}
+
 static void force_quiescent_state(struct rcu_data *rdp,
                                   struct rcu_ctrlblk *rcp)
 {
@@ -159,11 +204,33 @@ static void force_quiescent_state(struct rcu_data *rdp,
          * Don't send IPI to itself. With irqs disabled,
          * rdp->cpu is the current cpu.
          */
-        cpumask_andnot(&cpumask, &rcp->cpumask, cpumask_of(rdp->cpu));
+        rcu_waiting_cpus(rcp, &cpumask);
+        cpumask_clear_cpu(rdp->cpu, &cpumask);
         cpumask_raise_softirq(&cpumask, SCHEDULE_SOFTIRQ);
     }
 }
 
+/*
+ * Make every CPU that the current batch is waiting for run its RCU softirq
+ * now, which is all it takes for it to report its quiescent state. The
+ * next batch to start gets the same treatment.
+ */
+static void rcu_expedite(struct rcu_ctrlblk *rcp)
+{
+    cpumask_t cpumask;
+
+    rcp->expedite = 1;
+    rcp->nr_expedited++;
+    smp_mb();
+
+    rcu_waiting_cpus(rcp, &cpumask);
+    cpumask_clear_cpu(smp_processor_id(), &cpumask);
+    cpumask_raise_softirq(&cpumask, RCU_SOFTIRQ);
+
+    /* Start the batch holding our own callbacks. */
+    raise_softirq(RCU_SOFTIRQ);
+}
+
 /**
  * call_rcu - Queue an RCU callback for invocation after a grace period.
  * @head: structure to be used for queueing the RCU updates.
@@ -187,6 +254,7 @@ void call_rcu(struct rcu_head *head,
     rdp = &__get_cpu_var(rcu_data);
     *rdp->nxttail = head;
     rdp->nxttail = &head->next;
+    rdp->nr_queued++;
     if (unlikely(++rdp->qlen > qhimark)) {
         rdp->blimit = INT_MAX;
         force_quiescent_state(rdp, &rcu_ctrlblk);
@@ -194,6 +262,24 @@ void call_rcu(struct rcu_head *head,
     local_irq_restore(flags);
 }
 
+/**
+ * call_rcu_expedited - Queue an RCU callback and hurry the grace period.
+ * @head: structure to be used for queueing the RCU updates.
+ * @func: actual update function to be invoked after the grace period
+ *
+ * As call_rcu(), but rather than waiting for every CPU to pass through a
+ * quiescent state in its own time, IPI them all so the grace period ends
+ * as soon as possible. This costs an IPI per online CPU, so it is meant
+ * for control paths (domain destruction, CPU hotplug) which care more
+ * about latency than about disturbing other CPUs.
+ */
+void call_rcu_expedited(struct rcu_head *head,
+                        void (*func)(struct rcu_head *rcu))
+{
+    call_rcu(head, func);
+    rcu_expedite(&rcu_ctrlblk);
+}
+
 /*
  * Invoke the completed RCU callbacks. They are expected to be in
  * a per-cpu list.
@@ -209,6 +295,7 @@ static void rcu_do_batch(struct rcu_data *rdp)
         list->func(list);
         list = next;
         rdp->qlen--;
+        rdp->nr_invoked++;
         if (++count >= rdp->blimit)
             break;
     }
@@ -220,6 +307,33 @@ static void rcu_do_batch(struct rcu_data *rdp)
         raise_softirq(RCU_SOFTIRQ);
 }
 
+/*
+ * Clear cpu from its leaf for batch. Return whether it was the last cpu
+ * there, in which case the caller must clear the leaf from rcp->leafmask.
+ */
+static bool_t leaf_quiet(int cpu, long batch, struct rcu_ctrlblk *rcp)
+{
+    struct rcu_node *leaf = &rcp->leaf[cpu / RCU_FANOUT];
+    unsigned long bit = 1UL << (cpu % RCU_FANOUT);
+    bool_t last;
+
+    spin_lock(&leaf->lock);
+    /*
+     * The leaf may already have moved on to a later batch, e.g. during
+     * cpu startup, or when an offlined cpu is flushed. Ignore the quiescent
+     * state then.
+     */
+    if (leaf->batch != batch || !(leaf->qsmask & bit)) {
+        spin_unlock(&leaf->lock);
+        return 0;
+    }
+    leaf->qsmask &= ~bit;
+    last = !leaf->qsmask;
+    spin_unlock(&leaf->lock);
+
+    return last;
+}
+
 /*
  * Grace period handling:
  * The grace period handling consists out of two steps:
@@ -227,14 +341,15 @@ static void rcu_do_batch(struct rcu_data *rdp)
  *   This is done by rcu_start_batch. The start is not broadcasted to
  *   all cpus, they must pick this up by comparing rcp->cur with
  *   rdp->quiescbatch. All cpus are recorded  in the
- *   rcu_ctrlblk.cpumask bitmap.
+ *   leaf nodes.
  * - All cpus must go through a quiescent state.
  *   Since the start of the grace period is not broadcasted, at least two
  *   calls to rcu_check_quiescent_state are required:
  *   The first call just notices that a new grace period is running. The
  *   following calls check if there was a quiescent state since the beginning
- *   of the grace period. If so, it updates rcu_ctrlblk.cpumask. If
- *   the bitmap is empty, then the grace period is completed.
+ *   of the grace period. If so, it clears the cpu from its leaf node, and
+ *   the last cpu of the leaf clears the leaf from rcu_ctrlblk.leafmask. If
+ *   that bitmap is empty, then the grace period is completed.
  *   rcu_check_quiescent_state calls rcu_start_batch(0) to start the next grace
  *   period (if necessary).
  */
@@ -245,9 +360,39 @@ static void rcu_do_batch(struct rcu_data *rdp)
  */
 static void rcu_start_batch(struct rcu_ctrlblk *rcp)
 {
+    struct rcu_node *leaf;
+    unsigned long qsmask;
+    unsigned int i, cpu;
+    cpumask_t cpumask;
+
     if (rcp->next_pending &&
         rcp->completed == rcp->cur) {
         rcp->next_pending = 0;
+
+        /*
+         * The leaves must be set up before any cpu can see the new value
+         * of cur, or its quiescent state would be reported to a leaf still
+         * holding the old batch, and get lost.
+         */
+        bitmap_zero(rcp->leafmask, RCU_NR_LEAVES);
+        for (i = 0; i * RCU_FANOUT < nr_cpu_ids; i++) {
+            qsmask = 0;
+            for (cpu = i * RCU_FANOUT;
+                 cpu < min_t(unsigned int, (i + 1) * RCU_FANOUT, nr_cpu_ids);
+                 cpu++)
+                if (cpu_online(cpu))
+                    qsmask |= 1UL << (cpu % RCU_FANOUT);
+            if (!qsmask)
+                continue;
+
+            leaf = &rcp->leaf[i];
+            spin_lock(&leaf->lock);
+            leaf->batch = rcp->cur + 1;
+            leaf->qsmask = qsmask;
+            spin_unlock(&leaf->lock);
+            __set_bit(i, rcp->leafmask);
+        }
+
         /*
          * next_pending == 0 must be visible in
          * __rcu_process_callbacks() before it can see new value of cur.
@@ -255,23 +400,55 @@ static void rcu_start_batch(struct rcu_ctrlblk *rcp)
         smp_wmb();
         rcp->cur++;
 
-        cpumask_copy(&rcp->cpumask, &cpu_online_map);
+        /*
+         * Idle cpus don't run their softirq to report a quiescent state, so
+         * report it for them. rcu_idle_enter() sets a cpu's bit in
+         * idle_cpumask before reading cur, and we publish cur before
+         * reading idle_cpumask, each with a full barrier in between: a cpu
+         * going idle now is either seen here, or sees the new cur and
+         * reports for itself.
+         */
+        smp_mb();
+        for_each_cpu ( cpu, &rcp->idle_cpumask )
+            if (leaf_quiet(cpu, rcp->cur, rcp))
+                __clear_bit(cpu / RCU_FANOUT, rcp->leafmask);
+
+        /* Every cpu is idle, so the batch is already over. */
+        if (bitmap_empty(rcp->leafmask, RCU_NR_LEAVES))
+            rcp->completed = rcp->cur;
+
+        if (rcp->expedite) {
+            rcp->expedite = 0;
+            cpumask_andnot(&cpumask, &cpu_online_map,
+                           cpumask_of(smp_processor_id()));
+            cpumask_raise_softirq(&cpumask, RCU_SOFTIRQ);
+        }
     }
 }
 
 /*
- * cpu went through a quiescent state since the beginning of the grace period.
- * Clear it from the cpu mask and complete the grace period if it was the last
- * cpu. Start another grace period if someone has further entries pending
+ * cpu went through a quiescent state since the beginning of grace period
+ * @batch. Clear it from its leaf, and if it was the last cpu there clear the
+ * leaf from the control block, completing the grace period if it was the
+ * last leaf. Start another grace period if someone has further entries
+ * pending.
  */
-static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
+static void cpu_quiet(int cpu, long batch, struct rcu_ctrlblk *rcp)
 {
-    cpumask_clear_cpu(cpu, &rcp->cpumask);
-    if (cpumask_empty(&rcp->cpumask)) {
+    smp_rmb(); /* pairs with smp_wmb() in rcu_start_batch() */
+    if (!leaf_quiet(cpu, batch, rcp))
+        return;
+
+    /* The batch cannot complete, nor cur move on, while our leaf is set. */
+    spin_lock(&rcp->lock);
+    ASSERT(rcp->cur == batch);
+    __clear_bit(cpu / RCU_FANOUT, rcp->leafmask);
+    if (bitmap_empty(rcp->leafmask, RCU_NR_LEAVES)) {
         /* batch completed ! */
         rcp->completed = rcp->cur;
         rcu_start_batch(rcp);
     }
+    spin_unlock(&rcp->lock);
 }
 
 /*
@@ -298,15 +475,7 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 
     rdp->qs_pending = 0;
 
-    spin_lock(&rcp->lock);
-    /*
-     * rdp->quiescbatch/rcp->cur and the cpu bitmap can come out of sync
-     * during cpu startup. Ignore the quiescent state.
-     */
-    if (likely(rdp->quiescbatch == rcp->cur))
-        cpu_quiet(rdp->cpu, rcp);
-
-    spin_unlock(&rcp->lock);
+    cpu_quiet(rdp->cpu, rdp->quiescbatch, rcp);
 }
 
 
@@ -409,6 +578,42 @@ void rcu_check_callbacks(int cpu)
     raise_softirq(RCU_SOFTIRQ);
 }
 
+/*
+ * The current cpu is about to idle without a tick, and so won't run its
+ * RCU softirq for a while. Batches starting from now on report its
+ * quiescent state as they start, see rcu_start_batch(). It must have no
+ * callbacks queued (see rcu_needs_cpu()), and must not be in a read-side
+ * critical section until rcu_idle_exit().
+ */
+void rcu_idle_enter(unsigned int cpu)
+{
+    struct rcu_ctrlblk *rcp = &rcu_ctrlblk;
+    struct rcu_data *rdp = &per_cpu(rcu_data, cpu);
+
+    ASSERT(!cpumask_test_cpu(cpu, &rcp->idle_cpumask));
+    cpumask_set_cpu(cpu, &rcp->idle_cpumask);
+    smp_mb(); /* pairs with smp_mb() in rcu_start_batch() */
+
+    /*
+     * A batch whose start did not see our bit has published its cur by
+     * now, and may wait for us. Being idle is a quiescent state, so report
+     * it now rather than after the next wakeup.
+     */
+    if (rdp->quiescbatch != rcp->cur || rdp->qs_pending) {
+        rdp->quiescbatch = rcp->cur;
+        rdp->qs_pending = 0;
+        cpu_quiet(cpu, rdp->quiescbatch, rcp);
+    }
+}
+
+void rcu_idle_exit(unsigned int cpu)
+{
+    ASSERT(cpumask_test_cpu(cpu, &rcu_ctrlblk.idle_cpumask));
+    cpumask_clear_cpu(cpu, &rcu_ctrlblk.idle_cpumask);
+    /* Batches starting from now on must wait for our read-side sections. */
+    smp_mb();
+}
+
 static void rcu_move_batch(struct rcu_data *this_rdp, struct rcu_head *list,
                            struct rcu_head **tail)
 {
@@ -425,10 +630,7 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
     /* If the cpu going offline owns the grace period we can block
      * indefinitely waiting for it, so flush it here.
      */
-    spin_lock(&rcp->lock);
-    if (rcp->cur != rcp->completed)
-        cpu_quiet(rdp->cpu, rcp);
-    spin_unlock(&rcp->lock);
+    cpu_quiet(rdp->cpu, read_atomic(&rcp->cur), rcp);
 
     rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
     rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
@@ -478,10 +680,45 @@ static struct notifier_block cpu_nfb = {
     .notifier_call = cpu_callback
 };
 
+static void rcu_dump_state(unsigned char key)
+{
+    struct rcu_ctrlblk *rcp = &rcu_ctrlblk;
+    struct rcu_data *rdp;
+    unsigned int cpu;
+
+    printk("RCU: cur %ld completed %ld next_pending %d expedited %lu\n",
+           rcp->cur, rcp->completed, rcp->next_pending, rcp->nr_expedited);
+
+    for_each_online_cpu ( cpu )
+    {
+        rdp = &per_cpu(rcu_data, cpu);
+        printk("CPU%u: qlen %ld queued %lu invoked %lu batch %ld "
+               "quiesc %ld%s%s%s%s\n",
+               cpu, rdp->qlen, rdp->nr_queued, rdp->nr_invoked,
+               rdp->batch, rdp->quiescbatch,
+               rdp->qs_pending ? " qs_pending" : "",
+               rdp->nxtlist ? " nxt" : "",
+               rdp->curlist ? " cur" : "",
+               rdp->donelist ? " done" : "");
+    }
+}
+
+static struct keyhandler rcu_dump_keyhandler = {
+    .diagnostic = 1,
+    .u.fn = rcu_dump_state,
+    .desc = "dump RCU state and per-cpu callback counts"
+};
+
 void __init rcu_init(void)
 {
     void *cpu = (void *)(long)smp_processor_id();
+    unsigned int i;
+
+    for (i = 0; i < RCU_NR_LEAVES; i++)
+        spin_lock_init(&rcu_ctrlblk.leaf[i].lock);
+
     cpu_callback(&cpu_nfb, CPU_UP_PREPARE, cpu);
     register_cpu_notifier(&cpu_nfb);
     open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
+    register_keyhandler('U', &rcu_dump_keyhandler);
 }
@@ -207,6 +207,7 @@ struct csched_private {
     uint32_t ncpus;
     struct timer  master_ticker;
     unsigned int master;
+    bool_t master_stopped;      /* No active vcpus: accounting not armed */
     cpumask_var_t idlers;
     cpumask_var_t cpus;
     uint32_t weight;
@@ -516,6 +517,7 @@ csched_alloc_pdata(const struct scheduler *ops, int cpu)
     if ( prv->ncpus == 1 )
     {
         prv->master = cpu;
+        prv->master_stopped = 0;
         init_timer(&prv->master_ticker, csched_acct, prv, cpu);
         set_timer(&prv->master_ticker,
                   NOW() + MILLISECS(prv->tslice_ms));
@@ -782,6 +784,13 @@ __csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc)
         {
             list_add(&sdom->active_sdom_elem, &prv->active_sdom);
         }
+        /* Accounting went to sleep with the last active vcpu. */
+        if ( prv->master_stopped )
+        {
+            prv->master_stopped = 0;
+            set_timer(&prv->master_ticker,
+                      NOW() + MILLISECS(prv->tslice_ms));
+        }
     }
 
     TRACE_3D(TRC_CSCHED_ACCOUNT_START, sdom->dom->domain_id,
@@ -1224,10 +1233,15 @@ csched_acct(void* dummy)
 
     if ( unlikely(weight_total == 0) )
     {
+        /*
+         * Nothing to account for: don't wake up the master cpu again
+         * until a vcpu becomes active.
+         */
         prv->credit_balance = 0;
+        prv->master_stopped = 1;
         spin_unlock_irqrestore(&prv->lock, flags);
         SCHED_STAT_CRANK(acct_no_work);
-        goto out;
+        return;
     }
 
     SCHED_STAT_CRANK(acct_run);
@@ -1392,7 +1406,6 @@ csched_acct(void* dummy)
     /* Inform each CPU that its runq needs to be sorted */
     prv->runq_sort++;
 
-out:
     set_timer( &prv->master_ticker,
                NOW() + MILLISECS(prv->tslice_ms));
 }
@@ -54,7 +54,6 @@
  * + Immediate bug-fixes
  *  - Do per-runqueue, grab proper lock for dump debugkey
  * + Multiple sockets
- *  - Detect cpu layout and make runqueue map, one per L2 (make_runq_map())
  *  - Simple load balancer / runqueue assignment
  *  - Runqueue load measurement
  *  - Load-based load balancer
@@ -178,6 +177,13 @@ integer_param("sched_credit2_migrate_resist", opt_migrate_resist);
 /* CPU to runqueue struct macro */
 #define RQD(_ops, _cpu)     (&CSCHED2_PRIV(_ops)->rqd[c2r(_ops, _cpu)])
 
+/*
+ * Load, in the units of csched2_runqueue_data.b_avgload, by which a
+ * runqueue outside a vcpu's soft affinity looks busier to that vcpu:
+ * half of a fully busy vcpu.
+ */
+#define SOFT_AFFINITY_PENALTY(_prv) (1LL << ((_prv)->load_window_shift - 1))
+
 /*
  * Shifts for load average.
  * - granularity: Reduce granularity of time by a factor of 1000, so we can use 32-bit maths
@@ -194,6 +200,47 @@ integer_param("credit2_balance_under", opt_underload_balance_tolerance);
 int opt_overload_balance_tolerance=-3;
 integer_param("credit2_balance_over", opt_overload_balance_tolerance);
 
+/*
+ * Runqueue granularity: which cpus share a runqueue.  vcpus move freely
+ * between the cpus of a runqueue and only move between runqueues through
+ * the load balancer, so a runqueue should cover the cpus which share a
+ * cache.  On ARM a "socket" is a cluster, i.e. the cpus sharing an L2.
+ */
+#define OPT_RUNQUEUE_CORE   0
+#define OPT_RUNQUEUE_SOCKET 1
+#define OPT_RUNQUEUE_NODE   2
+#define OPT_RUNQUEUE_ALL    3
+static const char *const opt_runqueue_str[] = {
+    [OPT_RUNQUEUE_CORE] = "core",
+    [OPT_RUNQUEUE_SOCKET] = "socket",
+    [OPT_RUNQUEUE_NODE] = "node",
+    [OPT_RUNQUEUE_ALL] = "all"
+};
+static int __read_mostly opt_runqueue = OPT_RUNQUEUE_SOCKET;
+
+static void __init parse_credit2_runqueue(const char *s)
+{
+    unsigned int i;
+
+    if ( !strcmp(s, "cluster") )
+    {
+        opt_runqueue = OPT_RUNQUEUE_SOCKET;
+        return;
+    }
+
+    for ( i = 0; i < ARRAY_SIZE(opt_runqueue_str); i++ )
+    {
+        if ( !strcmp(s, opt_runqueue_str[i]) )
+        {
+            opt_runqueue = i;
+            return;
+        }
+    }
+
+    printk("WARNING, unrecognized value of credit2_runqueue option!\n");
+}
+custom_param("credit2_runqueue", parse_credit2_runqueue);
+
 /*
  * Per-runqueue data
  */
@@ -231,6 +278,28 @@ struct csched2_private {
     int load_window_shift;
 };
 
+/* May the vcpu run on some cpu of this runqueue? */
+static inline bool_t vcpu_fits_rqd(const struct vcpu *vc,
+                                   const struct csched2_runqueue_data *rqd)
+{
+    return cpumask_intersects(vc->cpu_hard_affinity, &rqd->active);
+}
+
+/*
+ * Does the vcpu have a soft affinity which this runqueue does not
+ * satisfy?  A soft affinity which is full, or which only names cpus
+ * the vcpu may not run on, is no preference at all.
+ */
+static inline bool_t vcpu_dislikes_rqd(const struct vcpu *vc,
+                                       const struct csched2_runqueue_data *rqd)
+{
+    if ( cpumask_full(vc->cpu_soft_affinity) ||
+         !cpumask_intersects(vc->cpu_soft_affinity, vc->cpu_hard_affinity) )
+        return 0;
+
+    return !cpumask_intersects(vc->cpu_soft_affinity, &rqd->active);
+}
+
 /*
  * Virtual CPU
  */
@@ -496,14 +565,16 @@ runq_tickle(const struct scheduler *ops, unsigned int cpu, struct csched2_vcpu *
     cur = CSCHED2_VCPU(per_cpu(schedule_data, cpu).curr);
     burn_credits(rqd, cur, now);
 
-    if ( cur->credit < new->credit )
+    if ( cur->credit < new->credit &&
+         cpumask_test_cpu(cpu, new->vcpu->cpu_hard_affinity) )
     {
         ipid = cpu;
         goto tickle;
     }
     
-    /* Get a mask of idle, but not tickled */
+    /* Get a mask of idle, but not tickled, cpus the vcpu may run on */
     cpumask_andnot(&mask, &rqd->idle, &rqd->tickled);
+    cpumask_and(&mask, &mask, new->vcpu->cpu_hard_affinity);
     
     /* If it's not empty, choose one */
     i = cpumask_cycle(cpu, &mask);
@@ -517,6 +588,7 @@ runq_tickle(const struct scheduler *ops, unsigned int cpu, struct csched2_vcpu *
      * skipping cpus which have been tickled but not scheduled yet */
     cpumask_andnot(&mask, &rqd->active, &rqd->idle);
     cpumask_andnot(&mask, &mask, &rqd->tickled);
+    cpumask_and(&mask, &mask, new->vcpu->cpu_hard_affinity);
 
     for_each_cpu(i, &mask)
     {
@@ -1031,6 +1103,35 @@ csched2_context_saved(const struct scheduler *ops, struct vcpu *vc)
     vcpu_schedule_unlock_irq(lock, vc);
 }
 
+/*
+ * Where to put a vcpu when we can't look at the runqueue loads: where it
+ * is if allowed, else on a cpu it may use in its runqueue or its pool.
+ */
+static int
+get_fallback_cpu(struct csched2_vcpu *svc)
+{
+    struct vcpu *vc = svc->vcpu;
+    cpumask_t mask;
+    int cpu;
+
+    if ( likely(cpumask_test_cpu(vc->processor, vc->cpu_hard_affinity)) )
+        return vc->processor;
+
+    if ( svc->rqd )
+    {
+        cpumask_and(&mask, vc->cpu_hard_affinity, &svc->rqd->active);
+        cpu = cpumask_cycle(vc->processor, &mask);
+        if ( cpu < nr_cpu_ids )
+            return cpu;
+    }
+
+    cpumask_and(&mask, vc->cpu_hard_affinity,
+                cpupool_online_cpumask(vc->domain->cpupool));
+    cpu = cpumask_cycle(vc->processor, &mask);
+
+    return cpu < nr_cpu_ids ? cpu : vc->processor;
+}
+
 #define MAX_LOAD (1ULL<<60);
 static int
 choose_cpu(const struct scheduler *ops, struct vcpu *vc)
@@ -1039,6 +1140,7 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
     int i, min_rqi = -1, new_cpu;
     struct csched2_vcpu *svc = CSCHED2_VCPU(vc);
     s_time_t min_avgload;
+    cpumask_t mask;
 
     BUG_ON(cpumask_empty(&prv->active_queues));
 
@@ -1064,9 +1166,8 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
             d2printk("%pv -\n", svc->vcpu);
             clear_bit(__CSFLAG_runq_migrate_request, &svc->flags);
         }
-        /* Leave it where it is for now.  When we actually pay attention
-         * to affinity we'll have to figure something out... */
-        return vc->processor;
+        /* Leave it where it is for now, if it is allowed there. */
+        return get_fallback_cpu(svc);
     }
 
     /* First check to see if we're here because someone else suggested a place
@@ -1079,19 +1180,29 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
                    __func__);
             /* Fall-through to normal cpu pick */
         }
+        else if ( !vcpu_fits_rqd(vc, svc->migrate_rqd) )
+        {
+            /* Affinity changed since the balancer chose the runqueue. */
+            d2printk("%pv !\n", svc->vcpu);
+            /* Fall-through to normal cpu pick */
+        }
         else
         {
             d2printk("%pv +\n", svc->vcpu);
-            new_cpu = cpumask_cycle(vc->processor, &svc->migrate_rqd->active);
+            cpumask_and(&mask, &svc->migrate_rqd->active,
+                        vc->cpu_hard_affinity);
+            new_cpu = cpumask_cycle(vc->processor, &mask);
             goto out_up;
         }
     }
 
-    /* FIXME: Pay attention to cpu affinity */                                                                                      
-
     min_avgload = MAX_LOAD;
 
-    /* Find the runqueue with the lowest instantaneous load */
+    /*
+     * Find the runqueue with the lowest instantaneous load among those the
+     * vcpu may run on, counting runqueues outside its soft affinity as
+     * somewhat busier than they are.
+     */
     for_each_cpu(i, &prv->active_queues)
     {
         struct csched2_runqueue_data *rqd;
@@ -1099,6 +1210,9 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
 
         rqd = prv->rqd + i;
 
+        if ( !vcpu_fits_rqd(vc, rqd) )
+            continue;
+
         /* If checking a different runqueue, grab the lock,
          * read the avg, and then release the lock.
          *
@@ -1117,6 +1231,9 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
         else
             continue;
 
+        if ( vcpu_dislikes_rqd(vc, rqd) )
+            rqd_avgload += SOFT_AFFINITY_PENALTY(prv);
+
         if ( rqd_avgload < min_avgload )
         {
             min_avgload = rqd_avgload;
@@ -1126,10 +1243,11 @@ choose_cpu(const struct scheduler *ops, struct vcpu *vc)
 
     /* We didn't find anyone (most likely because of spinlock contention); leave it where it is */
     if ( min_rqi == -1 )
-        new_cpu = vc->processor;
+        new_cpu = get_fallback_cpu(svc);
     else
     {
-        new_cpu = cpumask_cycle(vc->processor, &prv->rqd[min_rqi].active);
+        cpumask_and(&mask, &prv->rqd[min_rqi].active, vc->cpu_hard_affinity);
+        new_cpu = cpumask_cycle(vc->processor, &mask);
         BUG_ON(new_cpu >= nr_cpu_ids);
     }
 
@@ -1147,8 +1265,22 @@ typedef struct {
     /* NB: Read by consider() */
     struct csched2_runqueue_data *lrqd;
     struct csched2_runqueue_data *orqd;                  
+    s_time_t soft_penalty;
 } balance_state_t;
 
+/*
+ * How much worse (or, if negative, better) moving svc from frqd to trqd
+ * is in terms of its soft affinity.
+ */
+static s_time_t soft_affinity_cost(const balance_state_t *st,
+                                   const struct csched2_vcpu *svc,
+                                   const struct csched2_runqueue_data *frqd,
+                                   const struct csched2_runqueue_data *trqd)
+{
+    return st->soft_penalty * ((int)vcpu_dislikes_rqd(svc->vcpu, trqd) -
+                               (int)vcpu_dislikes_rqd(svc->vcpu, frqd));
+}
+
 static void consider(balance_state_t *st, 
                      struct csched2_vcpu *push_svc,
                      struct csched2_vcpu *pull_svc)
@@ -1174,6 +1306,12 @@ static void consider(balance_state_t *st,
     if ( delta < 0 )
         delta = -delta;
 
+    /* Prefer moves which keep vcpus within their soft affinity. */
+    if ( push_svc )
+        delta += soft_affinity_cost(st, push_svc, st->lrqd, st->orqd);
+    if ( pull_svc )
+        delta += soft_affinity_cost(st, pull_svc, st->orqd, st->lrqd);
+
     if ( delta < st->load_delta )
     {
         st->load_delta = delta;
@@ -1199,6 +1337,8 @@ static void migrate(const struct scheduler *ops,
     else
     {
         int on_runq=0;
+        cpumask_t mask;
+
         /* It's not running; just move it */
         d2printk("%pv %d-%d i\n", svc->vcpu, svc->rqd->id, trqd->id);
         if ( __vcpu_on_runq(svc) )
@@ -1208,7 +1348,9 @@ static void migrate(const struct scheduler *ops,
             on_runq=1;
         }
         __runq_deassign(svc);
-        svc->vcpu->processor = cpumask_any(&trqd->active);
+        cpumask_and(&mask, &trqd->active, svc->vcpu->cpu_hard_affinity);
+        svc->vcpu->processor = cpumask_any(cpumask_empty(&mask) ?
+                                           &trqd->active : &mask);
         __runq_assign(svc, trqd);
         if ( on_runq )
         {
@@ -1239,6 +1381,7 @@ static void balance_load(const struct scheduler *ops, int cpu, s_time_t now)
      * - pcpu schedule lock should be already locked
      */
     st.lrqd = RQD(ops, cpu);
+    st.soft_penalty = SOFT_AFFINITY_PENALTY(prv);
 
     __update_runq_load(ops, st.lrqd, 0, now);
 
@@ -1331,6 +1474,10 @@ retry:
         if ( test_bit(__CSFLAG_runq_migrate_request, &push_svc->flags) )
             continue;
 
+        /* Or if it can't run over there */
+        if ( !vcpu_fits_rqd(push_svc->vcpu, st.orqd) )
+            continue;
+
         list_for_each( pull_iter, &st.orqd->svc )
         {
             struct csched2_vcpu * pull_svc = list_entry(pull_iter, struct csched2_vcpu, rqd_elem);
@@ -1344,6 +1491,9 @@ retry:
             if ( test_bit(__CSFLAG_runq_migrate_request, &pull_svc->flags) )
                 continue;
 
+            if ( !vcpu_fits_rqd(pull_svc->vcpu, st.lrqd) )
+                continue;
+
             consider(&st, push_svc, pull_svc);
         }
 
@@ -1361,6 +1511,9 @@ retry:
         if ( test_bit(__CSFLAG_runq_migrate_request, &pull_svc->flags) )
             continue;
 
+        if ( !vcpu_fits_rqd(pull_svc->vcpu, st.lrqd) )
+            continue;
+
         /* Consider pull only */
         consider(&st, NULL, pull_svc);
     }
@@ -1611,6 +1764,10 @@ runq_candidate(struct csched2_runqueue_data *rqd,
     {
         struct csched2_vcpu * svc = list_entry(iter, struct csched2_vcpu, runq_elem);
 
+        /* Only consider vcpus which are allowed to run on this cpu. */
+        if ( !cpumask_test_cpu(cpu, svc->vcpu->cpu_hard_affinity) )
+            continue;
+
         /* If this is on a different processor, don't pull it unless
          * its credit is at least CSCHED2_MIGRATE_RESIST higher. */
         if ( svc->vcpu->processor != cpu
@@ -1918,6 +2075,43 @@ static void deactivate_runqueue(struct csched2_private *prv, int rqi)
     cpumask_clear_cpu(rqi, &prv->active_queues);
 }
 
+static bool_t same_runqueue(unsigned int cpua, unsigned int cpub)
+{
+    switch ( opt_runqueue )
+    {
+    case OPT_RUNQUEUE_CORE:
+        return cpu_to_socket(cpua) == cpu_to_socket(cpub) &&
+               cpu_to_core(cpua) == cpu_to_core(cpub);
+    case OPT_RUNQUEUE_SOCKET:
+        return cpu_to_socket(cpua) == cpu_to_socket(cpub);
+    case OPT_RUNQUEUE_NODE:
+        return cpu_to_node(cpua) == cpu_to_node(cpub);
+    }
+
+    return 1;
+}
+
+/*
+ * Join the runqueue of a topologically matching cpu, or else start the
+ * first unused one.  Runqueue ids are thus dense whatever the socket or
+ * core numbering.
+ */
+static int cpu_to_runqueue(struct csched2_private *prv, unsigned int cpu)
+{
+    int rqi;
+
+    for ( rqi = 0; rqi < nr_cpu_ids; rqi++ )
+    {
+        struct csched2_runqueue_data *rqd = prv->rqd + rqi;
+
+        if ( rqd->id == -1 ||
+             same_runqueue(cpumask_first(&rqd->active), cpu) )
+            break;
+    }
+
+    return rqi < nr_cpu_ids ? rqi : -1;
+}
+
 static void init_pcpu(const struct scheduler *ops, int cpu)
 {
     int rqi;
@@ -1936,19 +2130,11 @@ static void init_pcpu(const struct scheduler *ops, int cpu)
     }
 
     /* Figure out which runqueue to put it in */
-    rqi = 0;
-
-    /* Figure out which runqueue to put it in */
-    /* NB: cpu 0 doesn't get a STARTING callback, so we hard-code it to runqueue 0. */
-    if ( cpu == 0 )
-        rqi = 0;
-    else
-        rqi = cpu_to_socket(cpu);
+    rqi = cpu_to_runqueue(prv, cpu);
 
     if ( rqi < 0 )
     {
-        printk("%s: cpu_to_socket(%d) returned %d!\n",
-               __func__, cpu, rqi);
+        printk("%s: no runqueue for cpu %d!\n", __func__, cpu);
         BUG();
     }
 
@@ -2101,6 +2287,7 @@ csched2_init(struct scheduler *ops)
     printk(" load_window_shift: %d\n", opt_load_window_shift);
     printk(" underload_balance_tolerance: %d\n", opt_underload_balance_tolerance);
     printk(" overload_balance_tolerance: %d\n", opt_overload_balance_tolerance);
+    printk(" runqueues arrangement: per-%s\n", opt_runqueue_str[opt_runqueue]);
 
     if ( opt_load_window_shift < LOADAVG_WINDOW_SHIFT_MIN )
     {
@@ -0,0 +1,683 @@
+/****************************************************************************
+ * sched_gang.c
+ *
+ * Gang scheduler: the pcpus of a cpupool run the vcpus of one domain at a
+ * time, so that vcpus which wait on each other (spinlocks, barriers) are
+ * never kept waiting for a sibling which has been descheduled.
+ *
+ * Domains with runnable vcpus take turns, each for a timeslice (the gang
+ * window).  Vcpu n of the running domain is placed on the n-th pcpu of the
+ * pool (modulo the pool size, within its hard affinity); vcpus sharing a
+ * pcpu take turns at the start of each window, least recently run first.
+ * A domain whose vcpus all block gives up the rest of its window.
+ *
+ * All pcpus of the pool share a single schedule lock, so that the window
+ * can be switched for all of them at once and vcpus can be pulled between
+ * pcpus without further locking.  This limits the size of pools this
+ * scheduler is suitable for, which is fine for its intended use: a pool
+ * of a few cores dedicated to tightly coupled multi-vcpu guests.
+ *
+ * With backfill enabled, a pcpu which has nothing to run from the current
+ * gang may run a vcpu of another domain instead, unless one of its
+ * hyperthread siblings is running a vcpu of a different domain (core
+ * scheduling: siblings never run two domains at once).  A pcpu picking a
+ * vcpu of the gang makes siblings running another domain reschedule, so
+ * backfill gives way to the gang straight away.  For all that to hold,
+ * the pool should consist of whole cores.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <xen/config.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/sched-if.h>
+#include <xen/softirq.h>
+#include <xen/time.h>
+#include <xen/errno.h>
+#include <xen/list.h>
+#include <xen/keyhandler.h>
+#include <public/sysctl.h>
+
+#define GANG_DEFAULT_TSLICE_MS  30
+
+static unsigned int __read_mostly sched_gang_tslice_ms = GANG_DEFAULT_TSLICE_MS;
+integer_param("sched_gang_tslice_ms", sched_gang_tslice_ms);
+
+static bool_t __read_mostly sched_gang_backfill;
+boolean_param("sched_gang_backfill", sched_gang_backfill);
+
+#define GANG_PRIV(_ops) ((struct gang_private *)((_ops)->sched_data))
+#define GANG_VCPU(_v)   ((struct gang_vcpu *)(_v)->sched_priv)
+#define GANG_DOM(_d)    ((struct gang_dom *)(_d)->sched_priv)
+
+struct gang_vcpu {
+    struct list_head elem;          /* on gang_dom.vcpu */
+    struct vcpu *vcpu;
+    struct gang_dom *sdom;
+    unsigned int cpu;               /* placement, valid if gen matches */
+    unsigned int gen;
+};
+
+struct gang_dom {
+    struct list_head elem;          /* on gang_private.sdom */
+    struct list_head vcpu;
+    struct domain *dom;
+};
+
+struct gang_private {
+    /* Schedule lock of all pcpus of the pool, and lock of the lists. */
+    spinlock_t lock;
+    cpumask_var_t cpus;
+    unsigned int gen;               /* bumped when cpus changes */
+    struct list_head sdom;
+    unsigned int nr_sdom;
+    struct gang_dom *active;        /* current gang, or NULL */
+    s_time_t slice_end;
+    s_time_t tslice;
+    bool_t backfill;
+    unsigned long switches;
+};
+
+/*
+ * Vcpu n goes to the n-th pcpu of the pool it may run on, so that the
+ * vcpus of a gang are spread one per pcpu as long as there are enough.
+ */
+static unsigned int gang_place(const struct vcpu *v)
+{
+    const cpumask_t *online = cpupool_online_cpumask(v->domain->cpupool);
+    cpumask_t cpus;
+    unsigned int cpu, n;
+
+    cpumask_and(&cpus, online, v->cpu_hard_affinity);
+    if ( cpumask_empty(&cpus) )
+        cpumask_copy(&cpus, online);
+    if ( cpumask_empty(&cpus) )
+        return v->processor;
+
+    n = v->vcpu_id % cpumask_weight(&cpus);
+    for_each_cpu ( cpu, &cpus )
+        if ( n-- == 0 )
+            break;
+
+    return cpu;
+}
+
+static unsigned int gang_vcpu_cpu(const struct gang_private *prv,
+                                  struct gang_vcpu *svc)
+{
+    if ( svc->gen != prv->gen )
+    {
+        svc->cpu = gang_place(svc->vcpu);
+        svc->gen = prv->gen;
+    }
+
+    return svc->cpu;
+}
+
+static bool_t gang_runnable(const struct gang_dom *sdom)
+{
+    const struct gang_vcpu *svc;
+
+    list_for_each_entry ( svc, &sdom->vcpu, elem )
+        if ( vcpu_runnable(svc->vcpu) )
+            return 1;
+
+    return 0;
+}
+
+/*
+ * Start a new window, for the next domain with runnable vcpus after the
+ * current one, and make the other pcpus switch to it.
+ */
+static void gang_rotate(struct gang_private *prv, unsigned int cpu,
+                        s_time_t now)
+{
+    struct list_head *iter = prv->active ? &prv->active->elem : &prv->sdom;
+    struct gang_dom *next = NULL;
+    cpumask_t mask;
+    unsigned int n;
+
+    for ( n = 0; n < prv->nr_sdom + 1 && !list_empty(&prv->sdom); n++ )
+    {
+        iter = iter->next;
+        if ( iter == &prv->sdom )
+            iter = iter->next;
+        if ( gang_runnable(list_entry(iter, struct gang_dom, elem)) )
+        {
+            next = list_entry(iter, struct gang_dom, elem);
+            break;
+        }
+    }
+
+    prv->slice_end = now + prv->tslice;
+
+    if ( next == prv->active )
+        return;
+
+    prv->active = next;
+    prv->switches++;
+
+    cpumask_andnot(&mask, prv->cpus, cpumask_of(cpu));
+    cpumask_raise_softirq(&mask, SCHEDULE_SOFTIRQ);
+}
+
+/*
+ * The least recently run vcpu of sdom placed on cpu, or NULL.  The vcpu
+ * currently running here counts as having run until now.
+ */
+static struct vcpu *gang_pick(struct gang_private *prv,
+                              struct gang_dom *sdom, unsigned int cpu,
+                              s_time_t now)
+{
+    struct gang_vcpu *svc;
+    struct vcpu *best = NULL;
+    s_time_t best_time = 0;
+
+    list_for_each_entry ( svc, &sdom->vcpu, elem )
+    {
+        struct vcpu *v = svc->vcpu;
+        s_time_t t = (v == current) ? now : v->last_run_time;
+
+        if ( gang_vcpu_cpu(prv, svc) != cpu || !vcpu_runnable(v) )
+            continue;
+        /* Still being descheduled from another pcpu. */
+        if ( v->is_running && v != current )
+            continue;
+
+        if ( best == NULL || t < best_time )
+        {
+            best = v;
+            best_time = t;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Make the hyperthread siblings of cpu in the pool which run a vcpu of
+ * another domain than d reschedule, so that the core runs only d.
+ */
+static void gang_kick_siblings(struct gang_private *prv, unsigned int cpu,
+                               const struct domain *d)
+{
+    cpumask_t mask;
+    unsigned int sibling;
+
+    cpumask_clear(&mask);
+    for_each_cpu ( sibling, per_cpu(cpu_sibling_mask, cpu) )
+    {
+        const struct vcpu *curr = per_cpu(schedule_data, sibling).curr;
+
+        if ( sibling != cpu && cpumask_test_cpu(sibling, prv->cpus) &&
+             !is_idle_vcpu(curr) && curr->domain != d )
+            cpumask_set_cpu(sibling, &mask);
+    }
+
+    cpumask_raise_softirq(&mask, SCHEDULE_SOFTIRQ);
+}
+
+static struct vcpu *gang_backfill(struct gang_private *prv, unsigned int cpu,
+                                  s_time_t now)
+{
+    struct domain *sibling_dom = NULL;
+    struct gang_dom *sdom;
+    struct vcpu *v, *best = NULL;
+    unsigned int sibling;
+
+    /* Only the domain all busy siblings run, if any, may share the core. */
+    for_each_cpu ( sibling, per_cpu(cpu_sibling_mask, cpu) )
+    {
+        const struct vcpu *curr = per_cpu(schedule_data, sibling).curr;
+
+        if ( sibling == cpu || is_idle_vcpu(curr) )
+            continue;
+        if ( sibling_dom == NULL )
+            sibling_dom = curr->domain;
+        else if ( curr->domain != sibling_dom )
+            return NULL;
+    }
+
+    list_for_each_entry ( sdom, &prv->sdom, elem )
+    {
+        if ( sdom == prv->active ||
+             (sibling_dom != NULL && sdom->dom != sibling_dom) )
+            continue;
+
+        v = gang_pick(prv, sdom, cpu, now);
+        if ( v != NULL &&
+             (best == NULL || (v == current ? now : v->last_run_time) <
+                              (best == current ? now : best->last_run_time)) )
+            best = v;
+    }
+
+    return best;
+}
+
+static struct task_slice
+gang_schedule(const struct scheduler *ops, s_time_t now,
+              bool_t tasklet_work_scheduled)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    const unsigned int cpu = smp_processor_id();
+    struct vcpu *next = NULL;
+    struct task_slice ret;
+
+    /* prv->lock is held: it is the schedule lock of this pcpu. */
+    if ( now >= prv->slice_end || prv->active == NULL ||
+         !gang_runnable(prv->active) )
+        gang_rotate(prv, cpu, now);
+
+    /* Tasklet work (which runs in idle VCPU context) overrides all else. */
+    if ( !tasklet_work_scheduled )
+    {
+        if ( prv->active != NULL )
+            next = gang_pick(prv, prv->active, cpu, now);
+        /* The gang takes the whole core from backfilled siblings. */
+        if ( next != NULL && prv->backfill )
+            gang_kick_siblings(prv, cpu, next->domain);
+        if ( next == NULL && prv->backfill )
+            next = gang_backfill(prv, cpu, now);
+    }
+    if ( next == NULL )
+        next = idle_vcpu[cpu];
+
+    ret.migrated = 0;
+    if ( !is_idle_vcpu(next) && next->processor != cpu )
+    {
+        /* Both pcpus share our lock, so the vcpu can simply be moved. */
+        next->processor = cpu;
+        ret.migrated = 1;
+    }
+
+    ret.task = next;
+    ret.time = prv->slice_end - now;
+
+    return ret;
+}
+
+static int
+gang_pick_cpu(const struct scheduler *ops, struct vcpu *v)
+{
+    struct gang_vcpu *svc = GANG_VCPU(v);
+
+    /* Affinity may have changed: place afresh. */
+    svc->cpu = gang_place(v);
+    svc->gen = GANG_PRIV(ops)->gen;
+
+    return svc->cpu;
+}
+
+static void
+gang_vcpu_sleep(const struct scheduler *ops, struct vcpu *v)
+{
+    if ( per_cpu(schedule_data, v->processor).curr == v )
+        cpu_raise_softirq(v->processor, SCHEDULE_SOFTIRQ);
+}
+
+static void
+gang_vcpu_wake(const struct scheduler *ops, struct vcpu *v)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct gang_vcpu *svc = GANG_VCPU(v);
+    unsigned int cpu;
+
+    if ( unlikely(is_idle_vcpu(v)) )
+        return;
+
+    /*
+     * Only the current gang's vcpus, or anything if the pcpu idles (for
+     * backfill, or to start the next window early), need running now.
+     */
+    cpu = gang_vcpu_cpu(prv, svc);
+    if ( svc->sdom == prv->active || prv->active == NULL ||
+         is_idle_vcpu(per_cpu(schedule_data, cpu).curr) )
+        cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+}
+
+static void *
+gang_alloc_vdata(const struct scheduler *ops, struct vcpu *v, void *dd)
+{
+    struct gang_vcpu *svc;
+
+    svc = xzalloc(struct gang_vcpu);
+    if ( svc == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&svc->elem);
+    svc->vcpu = v;
+    svc->sdom = dd;
+    svc->gen = GANG_PRIV(ops)->gen - 1;
+
+    return svc;
+}
+
+static void
+gang_free_vdata(const struct scheduler *ops, void *priv)
+{
+    struct gang_vcpu *svc = priv;
+
+    if ( svc != NULL )
+        ASSERT(list_empty(&svc->elem));
+
+    xfree(svc);
+}
+
+static void
+gang_vcpu_insert(const struct scheduler *ops, struct vcpu *v)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct gang_vcpu *svc = GANG_VCPU(v);
+    unsigned long flags;
+
+    if ( is_idle_vcpu(v) )
+        return;
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_add_tail(&svc->elem, &svc->sdom->vcpu);
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static void
+gang_vcpu_remove(const struct scheduler *ops, struct vcpu *v)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct gang_vcpu *svc = GANG_VCPU(v);
+    unsigned long flags;
+
+    if ( is_idle_vcpu(v) )
+        return;
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_del_init(&svc->elem);
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static void *
+gang_alloc_domdata(const struct scheduler *ops, struct domain *d)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct gang_dom *sdom;
+    unsigned long flags;
+
+    sdom = xzalloc(struct gang_dom);
+    if ( sdom == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&sdom->vcpu);
+    sdom->dom = d;
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_add_tail(&sdom->elem, &prv->sdom);
+    prv->nr_sdom++;
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return sdom;
+}
+
+static void
+gang_free_domdata(const struct scheduler *ops, void *data)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct gang_dom *sdom = data;
+    unsigned long flags;
+
+    if ( sdom == NULL )
+        return;
+
+    ASSERT(list_empty(&sdom->vcpu));
+
+    spin_lock_irqsave(&prv->lock, flags);
+    if ( prv->active == sdom )
+        prv->active = NULL;
+    list_del(&sdom->elem);
+    prv->nr_sdom--;
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    xfree(sdom);
+}
+
+static int
+gang_dom_init(const struct scheduler *ops, struct domain *d)
+{
+    struct gang_dom *sdom;
+
+    if ( is_idle_domain(d) )
+        return 0;
+
+    sdom = gang_alloc_domdata(ops, d);
+    if ( sdom == NULL )
+        return -ENOMEM;
+
+    d->sched_priv = sdom;
+
+    return 0;
+}
+
+static void
+gang_dom_destroy(const struct scheduler *ops, struct domain *d)
+{
+    gang_free_domdata(ops, GANG_DOM(d));
+}
+
+static void *
+gang_alloc_pdata(const struct scheduler *ops, int cpu)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    spinlock_t *old_lock;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    /* IRQs already disabled */
+    old_lock = pcpu_schedule_lock(cpu);
+    per_cpu(schedule_data, cpu).schedule_lock = &prv->lock;
+    /* _Not_ pcpu_schedule_unlock(): per_cpu().schedule_lock changed! */
+    spin_unlock(old_lock);
+
+    cpumask_set_cpu(cpu, prv->cpus);
+    prv->gen++;
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    /* Non-NULL to keep schedule.c happy. */
+    return prv;
+}
+
+static void
+gang_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    /* Another pool's gang scheduler may have taken the pcpu already. */
+    if ( sd->schedule_lock == &prv->lock )
+    {
+        ASSERT(!spin_is_locked(&sd->_lock));
+        sd->schedule_lock = &sd->_lock;
+    }
+
+    cpumask_clear_cpu(cpu, prv->cpus);
+    prv->gen++;
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static int
+gang_sys_cntl(const struct scheduler *ops,
+              struct xen_sysctl_scheduler_op *sc)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    xen_sysctl_gang_schedule_t *params = &sc->u.sched_gang;
+    unsigned long flags;
+    int rc = -EINVAL;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    switch ( sc->cmd )
+    {
+    case XEN_SYSCTL_SCHEDOP_putinfo:
+        if ( params->tslice_ms > XEN_SYSCTL_GANG_TSLICE_MAX ||
+             params->tslice_ms < XEN_SYSCTL_GANG_TSLICE_MIN )
+            break;
+        prv->tslice = MILLISECS(params->tslice_ms);
+        prv->backfill = !!params->backfill;
+        /* FALLTHRU */
+    case XEN_SYSCTL_SCHEDOP_getinfo:
+        params->tslice_ms = prv->tslice / MILLISECS(1);
+        params->backfill = prv->backfill;
+        rc = 0;
+        break;
+    }
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return rc;
+}
+
+static void
+gang_dump_pcpu(const struct scheduler *ops, int cpu)
+{
+    const struct vcpu *curr = per_cpu(schedule_data, cpu).curr;
+
+    /* The pcpu's schedule lock, i.e. prv->lock, is held. */
+    printk("curr=d%dv%d%s\n", curr->domain->domain_id, curr->vcpu_id,
+           (!is_idle_vcpu(curr) && GANG_PRIV(ops)->active &&
+            curr->domain != GANG_PRIV(ops)->active->dom) ? " (backfill)" : "");
+}
+
+static void
+gang_dump(const struct scheduler *ops)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+    struct gang_dom *sdom;
+    struct gang_vcpu *svc;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    printk("info:\n"
+           "\ttslice          = %"PRI_stime"ms\n"
+           "\tbackfill        = %d\n"
+           "\tdomains         = %u\n"
+           "\tgang switches   = %lu\n",
+           prv->tslice / MILLISECS(1), prv->backfill, prv->nr_sdom,
+           prv->switches);
+    if ( prv->active != NULL )
+        printk("\tcurrent gang    = d%d, %"PRI_stime"us left\n",
+               prv->active->dom->domain_id,
+               (prv->slice_end - NOW()) / MICROSECS(1));
+
+    list_for_each_entry ( sdom, &prv->sdom, elem )
+    {
+        printk("\td%d:", sdom->dom->domain_id);
+        list_for_each_entry ( svc, &sdom->vcpu, elem )
+            printk(" v%d->cpu%u", svc->vcpu->vcpu_id,
+                   gang_vcpu_cpu(prv, svc));
+        printk("\n");
+    }
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static int
+gang_init(struct scheduler *ops)
+{
+    struct gang_private *prv;
+
+    prv = xzalloc(struct gang_private);
+    if ( prv == NULL )
+        return -ENOMEM;
+    if ( !zalloc_cpumask_var(&prv->cpus) )
+    {
+        xfree(prv);
+        return -ENOMEM;
+    }
+
+    ops->sched_data = prv;
+    spin_lock_init(&prv->lock);
+    INIT_LIST_HEAD(&prv->sdom);
+
+    if ( sched_gang_tslice_ms > XEN_SYSCTL_GANG_TSLICE_MAX ||
+         sched_gang_tslice_ms < XEN_SYSCTL_GANG_TSLICE_MIN )
+    {
+        printk("WARNING: sched_gang_tslice_ms outside of valid range [%d,%d].\n"
+               " Resetting to default %u\n",
+               XEN_SYSCTL_GANG_TSLICE_MIN, XEN_SYSCTL_GANG_TSLICE_MAX,
+               GANG_DEFAULT_TSLICE_MS);
+        sched_gang_tslice_ms = GANG_DEFAULT_TSLICE_MS;
+    }
+
+    prv->tslice = MILLISECS(sched_gang_tslice_ms);
+    prv->backfill = sched_gang_backfill;
+
+    return 0;
+}
+
+static void
+gang_deinit(const struct scheduler *ops)
+{
+    struct gang_private *prv = GANG_PRIV(ops);
+
+    if ( prv != NULL )
+    {
+        free_cpumask_var(prv->cpus);
+        xfree(prv);
+    }
+}
+
+const struct scheduler sched_gang_def = {
+    .name           = "SMP Gang Scheduler",
+    .opt_name       = "gang",
+    .sched_id       = XEN_SCHEDULER_GANG,
+    .sched_data     = NULL,
+
+    .init           = gang_init,
+    .deinit         = gang_deinit,
+
+    .alloc_vdata    = gang_alloc_vdata,
+    .free_vdata     = gang_free_vdata,
+    .alloc_pdata    = gang_alloc_pdata,
+    .free_pdata     = gang_free_pdata,
+    .alloc_domdata  = gang_alloc_domdata,
+    .free_domdata   = gang_free_domdata,
+
+    .init_domain    = gang_dom_init,
+    .destroy_domain = gang_dom_destroy,
+
+    .insert_vcpu    = gang_vcpu_insert,
+    .remove_vcpu    = gang_vcpu_remove,
+
+    .sleep          = gang_vcpu_sleep,
+    .wake           = gang_vcpu_wake,
+
+    .do_schedule    = gang_schedule,
+    .pick_cpu       = gang_pick_cpu,
+
+    .adjust_global  = gang_sys_cntl,
+
+    .dump_settings  = gang_dump,
+    .dump_cpu_state = gang_dump_pcpu,
+};
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
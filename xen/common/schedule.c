@@ -64,11 +64,28 @@ static void poll_timer_fn(void *data);
 DEFINE_PER_CPU(struct schedule_data, schedule_data);
 DEFINE_PER_CPU(struct scheduler *, scheduler);
 
+/*
+ * Scheduling latency histograms.  The per-pcpu ones are only updated by
+ * their own pcpu and the per-vcpu ones under the vcpu's schedule lock, so
+ * neither needs atomics; readers may see a sample in flight.
+ */
+struct sched_stats {
+    uint64_t hist[XEN_SYSCTL_SCHED_STATS_NR][XEN_SYSCTL_SCHED_STATS_BUCKETS];
+};
+static DEFINE_PER_CPU(struct sched_stats, sched_stats);
+
+struct sched_vcpu_stats {
+    bool_t woken;          /* Runnable since a wakeup, not a preemption. */
+    uint64_t hist[XEN_SYSCTL_SCHED_STATS_NR_VCPU]
+                 [XEN_SYSCTL_SCHED_STATS_BUCKETS];
+};
+
 static const struct scheduler *schedulers[] = {
     &sched_sedf_def,
     &sched_credit_def,
     &sched_credit2_def,
     &sched_arinc653_def,
+    &sched_gang_def,
 };
 
 static struct scheduler __read_mostly ops;
@@ -137,6 +154,40 @@ static inline void vcpu_urgent_count_update(struct vcpu *v)
     }
 }
 
+static inline unsigned int sched_stats_bucket(s_time_t ns)
+{
+    uint64_t us = (uint64_t)ns >> 10;
+
+    return us ? min_t(unsigned int, generic_fls64(us),
+                      XEN_SYSCTL_SCHED_STATS_BUCKETS - 1) : 0;
+}
+
+static inline void sched_stats_account(struct vcpu *v, int new_state,
+                                       s_time_t new_entry_time)
+{
+    struct sched_vcpu_stats *vs = v->sched_stats;
+    unsigned int h, b;
+
+    if ( vs == NULL )
+        return;
+
+    if ( new_state == RUNSTATE_runnable )
+    {
+        vs->woken = (v->runstate.state != RUNSTATE_running);
+        return;
+    }
+
+    if ( new_state != RUNSTATE_running ||
+         v->runstate.state != RUNSTATE_runnable )
+        return;
+
+    h = vs->woken ? XEN_SYSCTL_SCHED_STATS_wakeup
+                  : XEN_SYSCTL_SCHED_STATS_delay;
+    b = sched_stats_bucket(new_entry_time - v->runstate.state_entry_time);
+    vs->hist[h][b]++;
+    per_cpu(sched_stats, v->processor).hist[h][b]++;
+}
+
 static inline void vcpu_runstate_change(
     struct vcpu *v, int new_state, s_time_t new_entry_time)
 {
@@ -149,6 +200,8 @@ static inline void vcpu_runstate_change(
 
     trace_runstate_change(v, new_state);
 
+    sched_stats_account(v, new_state, new_entry_time);
+
     delta = new_entry_time - v->runstate.state_entry_time;
     if ( delta > 0 )
     {
@@ -214,12 +267,22 @@ int sched_init_vcpu(struct vcpu *v, unsigned int processor)
         per_cpu(schedule_data, v->processor).curr = v;
         v->is_running = 1;
     }
+    else
+    {
+        v->sched_stats = xzalloc(struct sched_vcpu_stats);
+        if ( v->sched_stats == NULL )
+            return 1;
+    }
 
     TRACE_2D(TRC_SCHED_DOM_ADD, v->domain->domain_id, v->vcpu_id);
 
     v->sched_priv = SCHED_OP(DOM2OP(d), alloc_vdata, v, d->sched_priv);
     if ( v->sched_priv == NULL )
+    {
+        xfree(v->sched_stats);
+        v->sched_stats = NULL;
         return 1;
+    }
 
     SCHED_OP(DOM2OP(d), insert_vcpu, v);
 
@@ -332,6 +395,8 @@ void sched_destroy_vcpu(struct vcpu *v)
         atomic_dec(&per_cpu(schedule_data, v->processor).urgent_count);
     SCHED_OP(VCPU2OP(v), remove_vcpu, v);
     SCHED_OP(VCPU2OP(v), free_vdata, v->sched_priv);
+    xfree(v->sched_stats);
+    v->sched_stats = NULL;
 }
 
 int sched_init_domain(struct domain *d)
@@ -795,7 +860,7 @@ static long do_poll(struct sched_poll *sched_poll)
 }
 
 /* Voluntarily yield the processor for this allocation. */
-static long do_yield(void)
+long vcpu_yield(void)
 {
     struct vcpu * v=current;
     spinlock_t *lock = vcpu_schedule_lock_irq(v);
@@ -888,7 +953,7 @@ long do_sched_op_compat(int cmd, unsigned long arg)
     {
     case SCHEDOP_yield:
     {
-        ret = do_yield();
+        ret = vcpu_yield();
         break;
     }
 
@@ -925,7 +990,7 @@ ret_t do_sched_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
     {
     case SCHEDOP_yield:
     {
-        ret = do_yield();
+        ret = vcpu_yield();
         break;
     }
 
@@ -1128,6 +1193,59 @@ long sched_adjust_global(struct xen_sysctl_scheduler_op *op)
     return rc;
 }
 
+long sched_stats_op(struct xen_sysctl_sched_stats_op *op)
+{
+    struct domain *d;
+    struct vcpu *v;
+    unsigned int cpu;
+    long rc = 0;
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_SCHED_STATS_get_pcpu:
+        if ( op->cpu >= nr_cpu_ids || !cpu_online(op->cpu) )
+            return -EINVAL;
+        if ( copy_to_guest(op->buckets,
+                           &per_cpu(sched_stats, op->cpu).hist[0][0],
+                           XEN_SYSCTL_SCHED_STATS_NR *
+                           XEN_SYSCTL_SCHED_STATS_BUCKETS) )
+            rc = -EFAULT;
+        break;
+
+    case XEN_SYSCTL_SCHED_STATS_get_vcpu:
+        d = rcu_lock_domain_by_id(op->domid);
+        if ( d == NULL )
+            return -ESRCH;
+        if ( op->vcpu >= d->max_vcpus || (v = d->vcpu[op->vcpu]) == NULL ||
+             v->sched_stats == NULL )
+            rc = -ENOENT;
+        else if ( copy_to_guest(op->buckets, &v->sched_stats->hist[0][0],
+                                XEN_SYSCTL_SCHED_STATS_NR_VCPU *
+                                XEN_SYSCTL_SCHED_STATS_BUCKETS) )
+            rc = -EFAULT;
+        rcu_unlock_domain(d);
+        break;
+
+    case XEN_SYSCTL_SCHED_STATS_reset:
+        for_each_online_cpu ( cpu )
+            memset(&per_cpu(sched_stats, cpu), 0, sizeof(struct sched_stats));
+        rcu_read_lock(&domlist_read_lock);
+        for_each_domain ( d )
+            for_each_vcpu ( d, v )
+                if ( v->sched_stats )
+                    memset(v->sched_stats->hist, 0,
+                           sizeof(v->sched_stats->hist));
+        rcu_read_unlock(&domlist_read_lock);
+        break;
+
+    default:
+        rc = -EOPNOTSUPP;
+        break;
+    }
+
+    return rc;
+}
+
 static void vcpu_periodic_timer_work(struct vcpu *v)
 {
     s_time_t now = NOW();
@@ -1207,6 +1325,8 @@ static void schedule(void)
     if ( unlikely(prev == next) )
     {
         pcpu_schedule_unlock_irq(lock, cpu);
+        this_cpu(sched_stats).hist[XEN_SYSCTL_SCHED_STATS_schedule]
+                                  [sched_stats_bucket(NOW() - now)]++;
         trace_continue_running(next);
         return continue_running(prev);
     }
@@ -1255,6 +1375,9 @@ static void schedule(void)
 
     vcpu_periodic_timer_work(next);
 
+    this_cpu(sched_stats).hist[XEN_SYSCTL_SCHED_STATS_schedule]
+                              [sched_stats_bucket(NOW() - now)]++;
+
     context_switch(prev, next);
 }
 
@@ -28,12 +28,23 @@ DEFINE_PER_CPU(unsigned long, tasklet_work_to_do);
 static DEFINE_PER_CPU(struct list_head, tasklet_list);
 static DEFINE_PER_CPU(struct list_head, softirq_tasklet_list);
 
-/* Protects all lists and tasklet structures. */
-static DEFINE_SPINLOCK(tasklet_lock);
+/*
+ * Each CPU's lists are protected by that CPU's tasklet_lock, and each
+ * tasklet's state by its own lock.  The lock order is tasklet lock, then
+ * CPU lock; the CPU owning a list takes the locks of the tasklets on it
+ * with spin_trylock().  A tasklet is on CPU X's list iff it is neither
+ * running nor dead and t->scheduled_on == X, and both locks are held to
+ * add or remove it, so that holding either one is enough to look at it.
+ */
+static DEFINE_PER_CPU(spinlock_t, tasklet_lock);
 
+/* Called with t->lock held and interrupts disabled. */
 static void tasklet_enqueue(struct tasklet *t)
 {
     unsigned int cpu = t->scheduled_on;
+    spinlock_t *lock = &per_cpu(tasklet_lock, cpu);
+
+    spin_lock(lock);
 
     if ( t->is_softirq )
     {
@@ -50,25 +61,71 @@ static void tasklet_enqueue(struct tasklet *t)
         if ( !test_and_set_bit(_TASKLET_enqueued, work_to_do) )
             cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
     }
+
+    spin_unlock(lock);
+}
+
+/* Called with t->lock held and interrupts disabled. */
+static void tasklet_dequeue(struct tasklet *t)
+{
+    spinlock_t *lock;
+
+    if ( list_empty(&t->list) )
+        return;
+
+    BUG_ON(t->is_dead || t->is_running || (t->scheduled_on < 0));
+    lock = &per_cpu(tasklet_lock, t->scheduled_on);
+    spin_lock(lock);
+    list_del_init(&t->list);
+    spin_unlock(lock);
+}
+
+/*
+ * Take the first tasklet off @list, with its lock held, or return NULL if
+ * @list is empty.  Called with @lock held and interrupts disabled; @lock
+ * may be dropped and retaken meanwhile.
+ */
+static struct tasklet *tasklet_dequeue_first(
+    struct list_head *list, spinlock_t *lock)
+{
+    struct tasklet *t;
+
+    while ( !list_empty(list) )
+    {
+        t = list_entry(list->next, struct tasklet, list);
+        if ( spin_trylock(&t->lock) )
+        {
+            list_del_init(&t->list);
+            return t;
+        }
+
+        /* Its scheduler may be waiting for @lock to dequeue it. */
+        spin_unlock(lock);
+        cpu_relax();
+        spin_lock(lock);
+    }
+
+    return NULL;
 }
 
 void tasklet_schedule_on_cpu(struct tasklet *t, unsigned int cpu)
 {
     unsigned long flags;
 
-    spin_lock_irqsave(&tasklet_lock, flags);
+    spin_lock_irqsave(&t->lock, flags);
 
-    if ( tasklets_initialised && !t->is_dead )
+    /* Nothing to do if it is already queued on @cpu. */
+    if ( tasklets_initialised && !t->is_dead &&
+         !(t->scheduled_on == cpu && !list_empty(&t->list)) )
     {
+        if ( !t->is_running )
+            tasklet_dequeue(t);
         t->scheduled_on = cpu;
         if ( !t->is_running )
-        {
-            list_del(&t->list);
             tasklet_enqueue(t);
-        }
     }
 
-    spin_unlock_irqrestore(&tasklet_lock, flags);
+    spin_unlock_irqrestore(&t->lock, flags);
 }
 
 void tasklet_schedule(struct tasklet *t)
@@ -76,24 +133,30 @@ void tasklet_schedule(struct tasklet *t)
     tasklet_schedule_on_cpu(t, smp_processor_id());
 }
 
+/* Called with interrupts disabled. */
 static void do_tasklet_work(unsigned int cpu, struct list_head *list)
 {
+    spinlock_t *lock = &per_cpu(tasklet_lock, cpu);
     struct tasklet *t;
 
-    if ( unlikely(list_empty(list) || cpu_is_offline(cpu)) )
+    if ( unlikely(cpu_is_offline(cpu)) )
         return;
 
-    t = list_entry(list->next, struct tasklet, list);
-    list_del_init(&t->list);
+    spin_lock(lock);
+    t = tasklet_dequeue_first(list, lock);
+    spin_unlock(lock);
+
+    if ( t == NULL )
+        return;
 
     BUG_ON(t->is_dead || t->is_running || (t->scheduled_on != cpu));
     t->scheduled_on = -1;
     t->is_running = 1;
 
-    spin_unlock_irq(&tasklet_lock);
+    spin_unlock_irq(&t->lock);
     sync_local_execstate();
     t->func(t->data);
-    spin_lock_irq(&tasklet_lock);
+    spin_lock_irq(&t->lock);
 
     t->is_running = 0;
 
@@ -102,6 +165,8 @@ static void do_tasklet_work(unsigned int cpu, struct list_head *list)
         BUG_ON(t->is_dead || !list_empty(&t->list));
         tasklet_enqueue(t);
     }
+
+    spin_unlock(&t->lock);
 }
 
 /* VCPU context work */
@@ -110,6 +175,7 @@ void do_tasklet(void)
     unsigned int cpu = smp_processor_id();
     unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
     struct list_head *list = &per_cpu(tasklet_list, cpu);
+    spinlock_t *lock = &per_cpu(tasklet_lock, cpu);
 
     /*
      * Work must be enqueued *and* scheduled. Otherwise there is no work to
@@ -118,17 +184,17 @@ void do_tasklet(void)
     if ( likely(*work_to_do != (TASKLET_enqueued|TASKLET_scheduled)) )
         return;
 
-    spin_lock_irq(&tasklet_lock);
+    local_irq_disable();
 
     do_tasklet_work(cpu, list);
 
+    spin_lock(lock);
     if ( list_empty(list) )
     {
         clear_bit(_TASKLET_enqueued, work_to_do);        
         raise_softirq(SCHEDULE_SOFTIRQ);
     }
-
-    spin_unlock_irq(&tasklet_lock);
+    spin_unlock_irq(lock);
 }
 
 /* Softirq context work */
@@ -136,59 +202,60 @@ static void tasklet_softirq_action(void)
 {
     unsigned int cpu = smp_processor_id();
     struct list_head *list = &per_cpu(softirq_tasklet_list, cpu);
+    spinlock_t *lock = &per_cpu(tasklet_lock, cpu);
 
-    spin_lock_irq(&tasklet_lock);
+    local_irq_disable();
 
     do_tasklet_work(cpu, list);
 
+    spin_lock(lock);
     if ( !list_empty(list) && !cpu_is_offline(cpu) )
         raise_softirq(TASKLET_SOFTIRQ);
-
-    spin_unlock_irq(&tasklet_lock);
+    spin_unlock_irq(lock);
 }
 
 void tasklet_kill(struct tasklet *t)
 {
     unsigned long flags;
 
-    spin_lock_irqsave(&tasklet_lock, flags);
+    spin_lock_irqsave(&t->lock, flags);
 
-    if ( !list_empty(&t->list) )
-    {
-        BUG_ON(t->is_dead || t->is_running || (t->scheduled_on < 0));
-        list_del_init(&t->list);
-    }
+    tasklet_dequeue(t);
 
     t->scheduled_on = -1;
     t->is_dead = 1;
 
     while ( t->is_running )
     {
-        spin_unlock_irqrestore(&tasklet_lock, flags);
+        spin_unlock_irqrestore(&t->lock, flags);
         cpu_relax();
-        spin_lock_irqsave(&tasklet_lock, flags);
+        spin_lock_irqsave(&t->lock, flags);
     }
 
-    spin_unlock_irqrestore(&tasklet_lock, flags);
+    spin_unlock_irqrestore(&t->lock, flags);
 }
 
 static void migrate_tasklets_from_cpu(unsigned int cpu, struct list_head *list)
 {
+    spinlock_t *lock = &per_cpu(tasklet_lock, cpu);
     unsigned long flags;
     struct tasklet *t;
 
-    spin_lock_irqsave(&tasklet_lock, flags);
+    spin_lock_irqsave(lock, flags);
 
-    while ( !list_empty(list) )
+    while ( (t = tasklet_dequeue_first(list, lock)) != NULL )
     {
-        t = list_entry(list->next, struct tasklet, list);
         BUG_ON(t->scheduled_on != cpu);
+        spin_unlock(lock);
+
         t->scheduled_on = smp_processor_id();
-        list_del(&t->list);
         tasklet_enqueue(t);
+        spin_unlock(&t->lock);
+
+        spin_lock(lock);
     }
 
-    spin_unlock_irqrestore(&tasklet_lock, flags);
+    spin_unlock_irqrestore(lock, flags);
 }
 
 void tasklet_init(
@@ -196,6 +263,7 @@ void tasklet_init(
 {
     memset(t, 0, sizeof(*t));
     INIT_LIST_HEAD(&t->list);
+    spin_lock_init(&t->lock);
     t->scheduled_on = -1;
     t->func = func;
     t->data = data;
@@ -216,6 +284,7 @@ static int cpu_callback(
     switch ( action )
     {
     case CPU_UP_PREPARE:
+        spin_lock_init(&per_cpu(tasklet_lock, cpu));
         INIT_LIST_HEAD(&per_cpu(tasklet_list, cpu));
         INIT_LIST_HEAD(&per_cpu(softirq_tasklet_list, cpu));
         break;
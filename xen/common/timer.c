@@ -29,12 +29,35 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/*
+ * Near-term timers live on a hierarchical timer wheel: WHEEL_LEVELS levels
+ * of WHEEL_SIZE slots, where a level-N slot spans 2^(WHEEL_SHIFT +
+ * N*WHEEL_BITS) ns (~65us, ~4ms, ~268ms). Timers due beyond the top level
+ * (~17s) go on the heap. Level-0 slots are expired as the wheel clock
+ * passes them; a slot at a higher level is cascaded onto the lower levels
+ * when the clock reaches its start.
+ */
+#define WHEEL_SHIFT   16
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1u << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS  3
+#define WHEEL_SLOTS   (WHEEL_LEVELS * WHEEL_SIZE)
+#define WHEEL_NONE    (~0u)
+#define LEVEL_SHIFT(_l) (WHEEL_SHIFT + (_l) * WHEEL_BITS)
+
 struct timers {
     spinlock_t     lock;
     struct timer **heap;
     struct timer  *list;
     struct timer  *running;
     struct list_head inactive;
+
+    s_time_t       wheel_clk;    /* Start of the current level-0 slot. */
+    unsigned int   wheel_count;  /* Timers on the wheel or expired list. */
+    struct list_head expired;    /* Wheel timers waiting to be run. */
+    DECLARE_BITMAP(wheel_map, WHEEL_SLOTS); /* Non-empty slots. */
+    struct list_head wheel[WHEEL_SLOTS];
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -167,6 +190,223 @@ static int add_to_list(struct timer **pprev, struct timer *t)
 }
 
 
+/****************************************************************************
+ * TIMER WHEEL OPERATIONS.
+ */
+
+/* Slot for a timer due at @expires, or WHEEL_NONE if beyond the wheel. */
+static unsigned int wheel_slot(const struct timers *ts, s_time_t expires)
+{
+    unsigned int level;
+
+    if ( expires < ts->wheel_clk )
+        expires = ts->wheel_clk;
+
+    /*
+     * Use the lowest level that reaches @expires. At levels above 0 this
+     * is never the current slot, so every timer is cascaded or expired
+     * once the clock gets to its slot.
+     */
+    for ( level = 0; level < WHEEL_LEVELS; level++ )
+    {
+        s_time_t slot = expires >> LEVEL_SHIFT(level);
+
+        if ( slot - (ts->wheel_clk >> LEVEL_SHIFT(level)) < WHEEL_SIZE )
+            return level * WHEEL_SIZE + (slot & WHEEL_MASK);
+    }
+
+    return WHEEL_NONE;
+}
+
+/* Add @t to the wheel. Return FALSE if it is too far in the future. */
+static bool_t add_to_wheel(struct timers *ts, struct timer *t)
+{
+    unsigned int slot;
+
+    if ( ts->wheel_count == 0 )
+        ts->wheel_clk = NOW() & ~((1LL << WHEEL_SHIFT) - 1);
+
+    slot = wheel_slot(ts, t->expires);
+    if ( slot == WHEEL_NONE )
+        return 0;
+
+    list_add_tail(&t->inactive, &ts->wheel[slot]);
+    __set_bit(slot, ts->wheel_map);
+    ts->wheel_count++;
+
+    return 1;
+}
+
+static void remove_from_wheel(struct timers *ts, struct timer *t)
+{
+    struct list_head *head = t->inactive.next;
+
+    /* Removing the only timer in a slot leaves the slot empty. */
+    if ( (head == t->inactive.prev) &&
+         (head >= &ts->wheel[0]) && (head < &ts->wheel[WHEEL_SLOTS]) )
+        __clear_bit(head - &ts->wheel[0], ts->wheel_map);
+
+    list_del(&t->inactive);
+    ts->wheel_count--;
+}
+
+/* Move a whole slot's timers onto @list. */
+static void wheel_take_slot(
+    struct timers *ts, unsigned int slot, struct list_head *list)
+{
+    list_splice_init(&ts->wheel[slot], list);
+    __clear_bit(slot, ts->wheel_map);
+}
+
+/* Re-add timers from higher-level slots which start at the wheel clock. */
+static void wheel_cascade(struct timers *ts)
+{
+    struct list_head list;
+    struct timer *t, *tmp;
+    unsigned int level, slot;
+
+    for ( level = WHEEL_LEVELS - 1; level > 0; level-- )
+    {
+        if ( ts->wheel_clk & ((1LL << LEVEL_SHIFT(level)) - 1) )
+            continue;
+
+        slot = level * WHEEL_SIZE +
+               ((ts->wheel_clk >> LEVEL_SHIFT(level)) & WHEEL_MASK);
+        if ( !test_bit(slot, ts->wheel_map) )
+            continue;
+
+        INIT_LIST_HEAD(&list);
+        wheel_take_slot(ts, slot, &list);
+        list_for_each_entry_safe ( t, tmp, &list, inactive )
+        {
+            slot = wheel_slot(ts, t->expires);
+            ASSERT(slot < (level * WHEEL_SIZE));
+            list_add_tail(&t->inactive, &ts->wheel[slot]);
+            __set_bit(slot, ts->wheel_map);
+        }
+        perfc_incr(timer_wheel_cascade);
+    }
+}
+
+static bool_t wheel_level_empty(const struct timers *ts, unsigned int level)
+{
+    return find_next_bit(ts->wheel_map, (level + 1) * WHEEL_SIZE,
+                         level * WHEEL_SIZE) >= (level + 1) * WHEEL_SIZE;
+}
+
+/* Move the wheel clock up to @now, queueing due timers on ts->expired. */
+static void wheel_advance(struct timers *ts, s_time_t now)
+{
+    s_time_t target = now & ~((1LL << WHEEL_SHIFT) - 1);
+    s_time_t next;
+    struct timer *t, *tmp;
+    unsigned int level;
+
+    while ( ts->wheel_clk < target )
+    {
+        if ( !wheel_level_empty(ts, 0) )
+        {
+            /* Everything in the current level-0 slot is due before @now. */
+            wheel_take_slot(ts, (ts->wheel_clk >> WHEEL_SHIFT) & WHEEL_MASK,
+                            &ts->expired);
+            next = ts->wheel_clk + (1LL << WHEEL_SHIFT);
+        }
+        else
+        {
+            /* Skip ahead to the next slot start at a non-empty level. */
+            for ( level = 1; level < WHEEL_LEVELS; level++ )
+                if ( !wheel_level_empty(ts, level) )
+                    break;
+            if ( level == WHEEL_LEVELS )
+                next = target;
+            else
+                next = ((ts->wheel_clk >> LEVEL_SHIFT(level)) + 1) <<
+                       LEVEL_SHIFT(level);
+        }
+
+        ts->wheel_clk = min(next, target);
+        wheel_cascade(ts);
+    }
+
+    /* The current slot may hold a mix of due and pending timers. */
+    list_for_each_entry_safe ( t, tmp,
+                               &ts->wheel[(ts->wheel_clk >> WHEEL_SHIFT) &
+                                          WHEEL_MASK], inactive )
+        if ( t->expires < now )
+        {
+            remove_from_wheel(ts, t);
+            list_add_tail(&t->inactive, &ts->expired);
+            ts->wheel_count++;
+        }
+}
+
+/* First non-empty slot at @level, as an offset from the current one. */
+static unsigned int wheel_next_slot(
+    const struct timers *ts, unsigned int level)
+{
+    unsigned int cur = (ts->wheel_clk >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+    unsigned int slot;
+
+    slot = find_next_bit(ts->wheel_map, (level + 1) * WHEEL_SIZE,
+                         level * WHEEL_SIZE + cur);
+    if ( slot >= (level + 1) * WHEEL_SIZE )
+        slot = find_next_bit(ts->wheel_map, (level + 1) * WHEEL_SIZE,
+                             level * WHEEL_SIZE);
+    if ( slot >= (level + 1) * WHEEL_SIZE )
+        return WHEEL_NONE;
+
+    return (slot - level * WHEEL_SIZE - cur) & WHEEL_MASK;
+}
+
+/*
+ * Earliest deadline on the wheel, or STIME_MAX if it is empty. Timers due
+ * within timer_slop of the first one share its interrupt: the deadline is
+ * pushed out to the last of them, so none of them runs more than
+ * timer_slop late. A higher-level slot may hold timers due before any in
+ * level 0, so the deadline is never later than the next cascade.
+ */
+static s_time_t wheel_deadline(const struct timers *ts)
+{
+    s_time_t deadline = STIME_MAX, batch = STIME_MAX, cascade;
+    const struct timer *t;
+    unsigned int level, slot;
+
+    if ( !list_empty(&ts->expired) )
+        return ts->wheel_clk;
+
+    slot = wheel_next_slot(ts, 0);
+    if ( slot != WHEEL_NONE )
+    {
+        slot = ((ts->wheel_clk >> WHEEL_SHIFT) + slot) & WHEEL_MASK;
+
+        list_for_each_entry ( t, &ts->wheel[slot], inactive )
+            if ( t->expires < deadline )
+                deadline = t->expires;
+
+        batch = deadline;
+        list_for_each_entry ( t, &ts->wheel[slot], inactive )
+            if ( (t->expires > batch) &&
+                 (t->expires - deadline <= timer_slop) )
+                batch = t->expires;
+    }
+
+    for ( level = 1; level < WHEEL_LEVELS; level++ )
+    {
+        slot = wheel_next_slot(ts, level);
+        if ( slot == WHEEL_NONE )
+            continue;
+
+        /* Wake up to cascade the slot; its timers are sorted out then. */
+        cascade = ((ts->wheel_clk >> LEVEL_SHIFT(level)) + slot) <<
+                  LEVEL_SHIFT(level);
+        if ( cascade < batch )
+            batch = cascade;
+    }
+
+    return batch;
+}
+
+
 /****************************************************************************
  * TIMER OPERATIONS.
  */
@@ -184,6 +424,11 @@ static int remove_entry(struct timer *t)
     case TIMER_STATUS_in_list:
         rc = remove_from_list(&timers->list, t);
         break;
+    case TIMER_STATUS_in_wheel:
+        remove_from_wheel(timers, t);
+        /* Reprogram if this may have been what the deadline was set for. */
+        rc = (t->expires <= per_cpu(timer_deadline, t->cpu));
+        break;
     default:
         rc = 0;
         BUG();
@@ -200,6 +445,14 @@ static int add_entry(struct timer *t)
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
+    /* Near-term timers go on the wheel. */
+    if ( add_to_wheel(timers, t) )
+    {
+        t->status = TIMER_STATUS_in_wheel;
+        return ((per_cpu(timer_deadline, t->cpu) == 0) ||
+                (t->expires < per_cpu(timer_deadline, t->cpu)));
+    }
+
     /* Try to add to heap. t->heap_offset indicates whether we succeed. */
     t->heap_offset = 0;
     t->status = TIMER_STATUS_in_heap;
@@ -277,7 +530,7 @@ static inline void timer_unlock(struct timer *timer)
 static bool_t active_timer(struct timer *timer)
 {
     ASSERT(timer->status >= TIMER_STATUS_inactive);
-    ASSERT(timer->status <= TIMER_STATUS_in_list);
+    ASSERT(timer->status <= TIMER_STATUS_in_wheel);
     return (timer->status >= TIMER_STATUS_in_heap);
 }
 
@@ -476,6 +729,17 @@ static void timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    /* Execute ready wheel timers. */
+    if ( ts->wheel_count != 0 )
+        wheel_advance(ts, now);
+    while ( !list_empty(&ts->expired) )
+    {
+        t = list_entry(ts->expired.next, struct timer, inactive);
+        list_del(&t->inactive);
+        ts->wheel_count--;
+        execute_timer(ts, t);
+    }
+
     /* Try to move timers from linked list to more efficient heap. */
     next = ts->list;
     ts->list = NULL;
@@ -492,6 +756,8 @@ static void timer_softirq_action(void)
         deadline = heap[1]->expires;
     if ( (ts->list != NULL) && (ts->list->expires < deadline) )
         deadline = ts->list->expires;
+    if ( ts->wheel_count != 0 )
+        deadline = min(deadline, wheel_deadline(ts));
     now = NOW();
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : MAX(deadline, now + timer_slop);
@@ -536,6 +802,9 @@ static void dump_timerq(unsigned char key)
             dump_timer(ts->heap[j], now);
         for ( t = ts->list, j = 0; t != NULL; t = t->list_next, j++ )
             dump_timer(t, now);
+        for ( j = 0; j < WHEEL_SLOTS; j++ )
+            list_for_each_entry ( t, &ts->wheel[j], inactive )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
@@ -551,6 +820,7 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
     unsigned int new_cpu = cpumask_any(&cpu_online_map);
     struct timers *old_ts, *new_ts;
     struct timer *t;
+    unsigned int i;
     bool_t notify = 0;
 
     ASSERT(!cpu_online(old_cpu) && cpu_online(new_cpu));
@@ -577,6 +847,15 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
         notify |= add_entry(t);
     }
 
+    while ( (i = find_first_bit(old_ts->wheel_map,
+                                WHEEL_SLOTS)) < WHEEL_SLOTS )
+    {
+        t = list_entry(old_ts->wheel[i].next, struct timer, inactive);
+        remove_entry(t);
+        write_atomic(&t->cpu, new_cpu);
+        notify |= add_entry(t);
+    }
+
     while ( !list_empty(&old_ts->inactive) )
     {
         t = list_entry(old_ts->inactive.next, struct timer, inactive);
@@ -603,10 +882,17 @@ static int cpu_callback(
     switch ( action )
     {
     case CPU_UP_PREPARE:
+    {
+        unsigned int i;
+
         INIT_LIST_HEAD(&ts->inactive);
+        INIT_LIST_HEAD(&ts->expired);
+        for ( i = 0; i < WHEEL_SLOTS; i++ )
+            INIT_LIST_HEAD(&ts->wheel[i]);
         spin_lock_init(&ts->lock);
         ts->heap = &dummy_heap;
         break;
+    }
     case CPU_UP_CANCELED:
     case CPU_DEAD:
         migrate_timers_from_cpu(cpu);
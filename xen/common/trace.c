@@ -31,6 +31,7 @@
 #include <xen/percpu.h>
 #include <xen/pfn.h>
 #include <xen/cpu.h>
+#include <xen/guest_access.h>
 #include <asm/atomic.h>
 #include <public/sysctl.h>
 
@@ -53,8 +54,11 @@ integer_param("tevt_mask", opt_tevt_mask);
 static struct t_info *t_info;
 static unsigned int t_info_pages;
 
+/*
+ * Each cpu is the only producer of its buffer, and writes to it with
+ * interrupts disabled, so there is no lock on the record path.
+ */
 static DEFINE_PER_CPU_READ_MOSTLY(struct t_buf *, t_bufs);
-static DEFINE_PER_CPU_READ_MOSTLY(spinlock_t, t_lock);
 static u32 data_size __read_mostly;
 
 /* High water mark for trace buffers; */
@@ -64,6 +68,8 @@ static u32 t_buf_highwater;
 /* Number of records lost due to per-CPU trace buffer being full. */
 static DEFINE_PER_CPU(unsigned long, lost_records);
 static DEFINE_PER_CPU(unsigned long, lost_records_first_tsc);
+/* Lost records by trace class, since tracing was last enabled. */
+static DEFINE_PER_CPU(unsigned long [TRC_NR_CLASSES], lost_by_class);
 
 /* a flag recording whether initialization has been done */
 /* or more properly, if the tbuf subsystem is enabled right now */
@@ -79,21 +85,6 @@ static u32 tb_event_mask = TRC_ALL;
  * i.e., sizeof(_type) * ans >= _x. */
 #define fit_to_type(_type, _x) (((_x)+sizeof(_type)-1) / sizeof(_type))
 
-static int cpu_callback(
-    struct notifier_block *nfb, unsigned long action, void *hcpu)
-{
-    unsigned int cpu = (unsigned long)hcpu;
-
-    if ( action == CPU_UP_PREPARE )
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
-    return NOTIFY_DONE;
-}
-
-static struct notifier_block cpu_nfb = {
-    .notifier_call = cpu_callback
-};
-
 static uint32_t calc_tinfo_first_offset(void)
 {
     int offset_in_bytes = offsetof(struct t_info, mfn_offset[NR_CPUS]);
@@ -226,8 +217,6 @@ static int alloc_trace_bufs(unsigned int pages)
         struct t_buf *buf;
         struct page_info *pg;
 
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
         offset = t_info->mfn_offset[cpu];
 
         /* Initialize the buffer metadata */
@@ -342,7 +331,6 @@ int trace_will_trace_event(u32 event)
 void __init init_trace_bufs(void)
 {
     cpumask_setall(&tb_cpu_mask);
-    register_cpu_notifier(&cpu_nfb);
 
     if ( opt_tbuf_size )
     {
@@ -362,6 +350,26 @@ void __init init_trace_bufs(void)
     }
 }
 
+/* Called on each cpu, in interrupt context, so not within __trace_var(). */
+static void reset_lost_records(void *class)
+{
+    this_cpu(lost_records) = 0;
+    if ( class )
+        memset(this_cpu(lost_by_class), 0, sizeof(this_cpu(lost_by_class)));
+}
+
+static int get_lost_records(XEN_GUEST_HANDLE_64(uint64) lost)
+{
+    uint64_t sum[TRC_NR_CLASSES] = { 0 };
+    unsigned int cpu, i;
+
+    for_each_online_cpu ( cpu )
+        for ( i = 0; i < TRC_NR_CLASSES; i++ )
+            sum[i] += read_atomic(&per_cpu(lost_by_class, cpu)[i]);
+
+    return copy_to_guest(lost, sum, TRC_NR_CLASSES) ? -EFAULT : 0;
+}
+
 /**
  * tb_control - sysctl operations on trace buffers.
  * @tbc: a pointer to a xen_sysctl_tbuf_op_t to be filled out
@@ -403,7 +411,11 @@ int tb_control(xen_sysctl_tbuf_op_t *tbc)
         if ( opt_tbuf_size == 0 ) 
             rc = -EINVAL;
         else
+        {
+            on_selected_cpus(&cpu_online_map, reset_lost_records,
+                             (void *)1, 1);
             tb_init_done = 1;
+        }
         break;
     case XEN_SYSCTL_TBUFOP_disable:
     {
@@ -411,22 +423,17 @@ int tb_control(xen_sysctl_tbuf_op_t *tbc)
          * Disable trace buffers. Just stops new records from being written,
          * does not deallocate any memory.
          */
-        int i;
-
         tb_init_done = 0;
         smp_wmb();
         /* Clear any lost-record info so we don't get phantom lost records next time we
-         * start tracing.  Grab the lock to make sure we're not racing anyone.  After this
-         * hypercall returns, no more records should be placed into the buffers. */
-        for_each_online_cpu(i)
-        {
-            unsigned long flags;
-            spin_lock_irqsave(&per_cpu(t_lock, i), flags);
-            per_cpu(lost_records, i)=0;
-            spin_unlock_irqrestore(&per_cpu(t_lock, i), flags);
-        }
+         * start tracing.  Records are written with interrupts disabled, so once the IPI
+         * has run everywhere no more records will be placed into the buffers. */
+        on_selected_cpus(&cpu_online_map, reset_lost_records, NULL, 1);
     }
         break;
+    case XEN_SYSCTL_TBUFOP_get_lost:
+        rc = get_lost_records(tbc->lost);
+        break;
     default:
         rc = -EINVAL;
         break;
@@ -683,6 +690,7 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
 {
     struct t_buf *buf;
     unsigned long flags;
+    unsigned int class;
     u32 bytes_to_tail, bytes_to_wrap;
     unsigned int rec_size, total_size;
     unsigned int extra_word;
@@ -720,7 +728,7 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     /* Read tb_init_done /before/ t_bufs. */
     smp_rmb();
 
-    spin_lock_irqsave(&this_cpu(t_lock), flags);
+    local_irq_save(flags);
 
     buf = this_cpu(t_bufs);
 
@@ -776,6 +784,9 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     {
         if ( ++this_cpu(lost_records) == 1 )
             this_cpu(lost_records_first_tsc)=(u64)get_cycles();
+        class = find_first_set_bit((event >> TRC_CLS_SHIFT) |
+                                   (1u << (TRC_NR_CLASSES - 1)));
+        this_cpu(lost_by_class)[class]++;
         started_below_highwater = 0;
         goto unlock;
     }
@@ -807,7 +818,7 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
     __insert_record(buf, event, extra, cycles, rec_size, extra_data);
 
 unlock:
-    spin_unlock_irqrestore(&this_cpu(t_lock), flags);
+    local_irq_restore(flags);
 
     /* Notify trace buffer consumer that we've crossed the high water mark. */
     if ( likely(buf!=NULL)
@@ -244,6 +244,18 @@ struct arch_vcpu
     struct vtimer phys_timer;
     struct vtimer virt_timer;
     bool_t vtimer_initialized;
+
+    /* Trapped WFI/WFE, see do_trap_wfi() and do_trap_wfe() in traps.c. */
+    struct {
+        s_time_t poll_ns;        /* Current WFI poll window */
+        s_time_t block_start;    /* runstate blocked time when we blocked */
+        bool_t blocked;          /* Blocked on the last WFI */
+        unsigned long poll_hits; /* WFIs completed by polling */
+        unsigned long poll_misses;
+        unsigned long blocks;    /* WFIs which blocked the vcpu */
+        unsigned long wfe_traps;
+        unsigned long wfe_yields;
+    } wfx;
 }  __cacheline_aligned;
 
 void vcpu_show_execution_state(struct vcpu *);
@@ -1,19 +1,64 @@
 #ifndef __ARCH_ARM_NUMA_H
 #define __ARCH_ARM_NUMA_H
 
-/* Fake one node for now. See also node_online_map. */
-#define cpu_to_node(cpu) 0
-#define node_to_cpumask(node)   (cpu_online_map)
+#include <xen/cpumask.h>
+
+/*
+ * Nodes are described by the device tree "numa-node-id" properties on
+ * memory and cpu nodes, and the "numa-distance-map-v1" node.  Without
+ * them everything lives on node 0.  See arch/arm/numa.c.
+ */
+#define NODES_SHIFT 3
+
+extern unsigned char cpu_to_node[];
+extern cpumask_t     node_to_cpumask[];
+
+#define cpu_to_node(cpu)        (cpu_to_node[cpu])
+#define node_to_cpumask(node)   (node_to_cpumask[node])
+
+struct node_data {
+    unsigned long node_start_pfn;
+    unsigned long node_spanned_pages;
+};
+
+extern struct node_data node_data[];
+
+#define NODE_DATA(nid)          (&(node_data[nid]))
+
+#define node_start_pfn(nid)     (NODE_DATA(nid)->node_start_pfn)
+#define node_spanned_pages(nid) (NODE_DATA(nid)->node_spanned_pages)
+#define node_end_pfn(nid)       (NODE_DATA(nid)->node_start_pfn + \
+                                 NODE_DATA(nid)->node_spanned_pages)
+
+/* One entry per device tree RAM bank (NR_MEM_BANKS). */
+#define NR_NODE_MEMBLKS 8
+
+struct node_memblk {
+    paddr_t start, end;
+    unsigned int nid;
+};
+
+extern unsigned int nr_node_memblks;
+extern struct node_memblk node_memblk[];
 
 static inline __attribute__((pure)) int phys_to_nid(paddr_t addr)
 {
+    unsigned int i;
+
+    for ( i = 0; i < nr_node_memblks; i++ )
+        if ( addr >= node_memblk[i].start && addr < node_memblk[i].end )
+            return node_memblk[i].nid;
+
     return 0;
 }
 
-/* XXX: implement NUMA support */
-#define node_spanned_pages(nid) (total_pages)
-#define node_start_pfn(nid) (frametable_base_mfn)
-#define __node_distance(a, b) (20)
+extern int __node_distance(int a, int b);
+
+struct dt_device_node;
+
+extern void numa_init(void);
+extern void numa_set_cpu_node(unsigned int cpu,
+                              const struct dt_device_node *dn);
 
 #endif /* __ARCH_ARM_NUMA_H */
 /*
@@ -8,6 +8,8 @@
 #define MIDR_MASK    0xff0ffff0
 
 /* MPIDR Multiprocessor Affinity Register */
+#define _MPIDR_MT           (24)
+#define MPIDR_MT            (_AC(1,U) << _MPIDR_MT)
 #define _MPIDR_UP           (30)
 #define MPIDR_UP            (_AC(1,U) << _MPIDR_UP)
 #define _MPIDR_SMP          (31)
@@ -389,6 +391,15 @@ union hsr {
         unsigned long ec:6;    /* Exception Class */
     } cond;
 
+    struct hsr_wfi_wfe {
+        unsigned long ti:1;    /* Trapped instruction: WFE if set */
+        unsigned long sbzp:19;
+        unsigned long cc:4;    /* Condition Code */
+        unsigned long ccvalid:1;/* CC Valid */
+        unsigned long len:1;   /* Instruction length */
+        unsigned long ec:6;    /* Exception Class */
+    } wfi_wfe; /* HSR_EC_WFI_WFE */
+
     /* reg, reg0, reg1 are 4 bits on AArch32, the fifth bit is sbzp. */
     struct hsr_cp32 {
         unsigned long read:1;  /* Direction */
@@ -584,9 +595,21 @@ void show_registers(struct cpu_user_regs *regs);
 
 #define cpu_relax() barrier() /* Could yield? */
 
-/* All a bit UP for the moment */
-#define cpu_to_core(_cpu)   (0)
-#define cpu_to_socket(_cpu) (0)
+/*
+ * CPU topology, from the DT cpu-map node if it describes every CPU, else
+ * from MPIDR. Clusters stand in for sockets. Fields are -1 until the CPU
+ * has been brought up.
+ */
+struct cpu_topology {
+    int thread_id;
+    int core_id;
+    int cluster_id;     /* Dense; the boot CPU's cluster is 0. */
+    u64 cluster_key;    /* Cluster as described by DT or MPIDR. */
+};
+extern struct cpu_topology cpu_topology[];
+
+#define cpu_to_core(_cpu)   (cpu_topology[_cpu].core_id)
+#define cpu_to_socket(_cpu) (cpu_topology[_cpu].cluster_id)
 
 void do_unexpected_trap(const char *msg, struct cpu_user_regs *regs);
 
@@ -5,12 +5,10 @@
     DT_MATCH_COMPATIBLE("arm,armv7-timer"), \
     DT_MATCH_COMPATIBLE("arm,armv8-timer")
 
-typedef unsigned long cycles_t;
+typedef uint64_t cycles_t;
 
-static inline cycles_t get_cycles (void)
-{
-        return 0;
-}
+/* The generic timer count, which also timestamps trace records. */
+extern cycles_t get_cycles(void);
 
 /* List of timer's IRQ */
 enum timer_ppi
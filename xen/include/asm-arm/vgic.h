@@ -179,6 +179,9 @@ extern int vgic_to_sgi(struct vcpu *v, register_t sgir,
                        enum gic_sgi_mode irqmode, int virq,
                        unsigned long vcpu_mask);
 extern int vgic_send_sgi(struct vcpu *v, register_t sgir);
+extern int vgic_mmio_access(struct vcpu *v, mmio_info_t *info, uint32_t event,
+                            uint32_t offset,
+                            int (*handler)(struct vcpu *v, mmio_info_t *info));
 #endif /* __ASM_ARM_VGIC_H__ */
 
 /*
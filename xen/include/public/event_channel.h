@@ -74,6 +74,7 @@
 #define EVTCHNOP_init_control    11
 #define EVTCHNOP_expand_array    12
 #define EVTCHNOP_set_priority    13
+#define EVTCHNOP_set_moderation  14
 /* ` } */
 
 typedef uint32_t evtchn_port_t;
@@ -308,6 +309,29 @@ struct evtchn_set_priority {
 };
 typedef struct evtchn_set_priority evtchn_set_priority_t;
 
+/*
+ * EVTCHNOP_set_moderation: limit the rate of upcalls raised by a local port.
+ * An event that becomes pending less than <interval_us> microseconds after
+ * the port last raised an upcall on its vCPU does not raise another one
+ * until that interval has elapsed; further events in the meantime are
+ * coalesced into the deferred upcall.  The pending state of the event
+ * itself is updated immediately.  An <interval_us> of 0 disables
+ * moderation.
+ * NOTES:
+ *  1. The counts of upcalls raised and of events deferred or coalesced
+ *     since the port's moderation was last set are returned, and reset.
+ *  2. Moderation is discarded when the port is closed.
+ */
+struct evtchn_set_moderation {
+    /* IN parameters. */
+    evtchn_port_t port;
+    uint32_t interval_us;
+    /* OUT parameters. */
+    uint64_t notified;
+    uint64_t coalesced;
+};
+typedef struct evtchn_set_moderation evtchn_set_moderation_t;
+
 /*
  * ` enum neg_errnoval
  * ` HYPERVISOR_event_channel_op_compat(struct evtchn_op *op)
@@ -49,7 +49,10 @@ enum xsd_sockmsg_type
     XS_RESUME,
     XS_SET_TARGET,
     XS_RESTRICT,
-    XS_RESET_WATCHES
+    XS_RESET_WATCHES,
+    XS_MULTI,
+
+    XS_TYPE_COUNT       /* Number of valid types. */
 };
 
 #define XS_WRITE_NONE "NONE"
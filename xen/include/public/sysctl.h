@@ -34,7 +34,7 @@
 #include "xen.h"
 #include "domctl.h"
 
-#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000B
+#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000C
 
 /*
  * Read console content from Xen buffer ring.
@@ -69,6 +69,7 @@ struct xen_sysctl_tbuf_op {
 #define XEN_SYSCTL_TBUFOP_set_size     3
 #define XEN_SYSCTL_TBUFOP_enable       4
 #define XEN_SYSCTL_TBUFOP_disable      5
+#define XEN_SYSCTL_TBUFOP_get_lost     6
     uint32_t cmd;
     /* IN/OUT variables */
     struct xenctl_bitmap cpu_mask;
@@ -76,6 +77,13 @@ struct xen_sysctl_tbuf_op {
     /* OUT variables */
     uint64_aligned_t buffer_mfn;
     uint32_t size;  /* Also an IN variable! */
+    /*
+     * get_lost: records dropped because a trace buffer was full since
+     * tracing was last enabled, summed over all cpus.  Element n counts
+     * the events of the class with bit n set in (event >> TRC_CLS_SHIFT);
+     * TRC_NR_CLASSES elements.
+     */
+    XEN_GUEST_HANDLE_64(uint64) lost;
 };
 typedef struct xen_sysctl_tbuf_op xen_sysctl_tbuf_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_tbuf_op_t);
@@ -583,6 +591,21 @@ struct xen_sysctl_credit_schedule {
 typedef struct xen_sysctl_credit_schedule xen_sysctl_credit_schedule_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_credit_schedule_t);
 
+struct xen_sysctl_gang_schedule {
+    /* Length of the window each domain's vcpus are co-scheduled for, in ms */
+#define XEN_SYSCTL_GANG_TSLICE_MAX 1000
+#define XEN_SYSCTL_GANG_TSLICE_MIN 1
+    unsigned tslice_ms;
+    /*
+     * Let pcpus which have nothing to run from the current gang run vcpus
+     * of other domains, as long as no hyperthread sibling is running a
+     * vcpu of a third domain.
+     */
+    unsigned backfill;
+};
+typedef struct xen_sysctl_gang_schedule xen_sysctl_gang_schedule_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_gang_schedule_t);
+
 /* XEN_SYSCTL_scheduler_op */
 /* Set or get info? */
 #define XEN_SYSCTL_SCHEDOP_putinfo 0
@@ -596,6 +619,7 @@ struct xen_sysctl_scheduler_op {
             XEN_GUEST_HANDLE_64(xen_sysctl_arinc653_schedule_t) schedule;
         } sched_arinc653;
         struct xen_sysctl_credit_schedule sched_credit;
+        struct xen_sysctl_gang_schedule sched_gang;
     } u;
 };
 typedef struct xen_sysctl_scheduler_op xen_sysctl_scheduler_op_t;
@@ -636,6 +660,49 @@ struct xen_sysctl_coverage_op {
 typedef struct xen_sysctl_coverage_op xen_sysctl_coverage_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_coverage_op_t);
 
+/* XEN_SYSCTL_sched_stats_op */
+/*
+ * Scheduling latency histograms.  Each has XEN_SYSCTL_SCHED_STATS_BUCKETS
+ * buckets on a log2 scale of nanoseconds: bucket 0 counts samples below
+ * 2^10ns, bucket i samples in [2^(9+i), 2^(10+i))ns, and the last bucket
+ * also counts anything longer.
+ */
+#define XEN_SYSCTL_SCHED_STATS_BUCKETS   32
+
+/*
+ * Histograms.  All are kept per pcpu, the first XEN_SYSCTL_SCHED_STATS_NR_VCPU
+ * also per vcpu.
+ */
+#define XEN_SYSCTL_SCHED_STATS_wakeup    0 /* Runnable after wakeup->running */
+#define XEN_SYSCTL_SCHED_STATS_delay     1 /* Runnable after preemption->running */
+#define XEN_SYSCTL_SCHED_STATS_schedule  2 /* Time taken by schedule() */
+#define XEN_SYSCTL_SCHED_STATS_NR        3
+#define XEN_SYSCTL_SCHED_STATS_NR_VCPU   2
+
+/*
+ * Read the histograms of a pcpu, XEN_SYSCTL_SCHED_STATS_NR of them one
+ * after the other.
+ */
+#define XEN_SYSCTL_SCHED_STATS_get_pcpu  0
+/*
+ * Read the histograms of a vcpu, XEN_SYSCTL_SCHED_STATS_NR_VCPU of them
+ * one after the other.
+ */
+#define XEN_SYSCTL_SCHED_STATS_get_vcpu  1
+/* Clear all histograms.  No parameters. */
+#define XEN_SYSCTL_SCHED_STATS_reset     2
+
+struct xen_sysctl_sched_stats_op {
+    uint32_t cmd;                       /* IN: XEN_SYSCTL_SCHED_STATS_* */
+    uint32_t cpu;                       /* IN: get_pcpu */
+    domid_t  domid;                     /* IN: get_vcpu */
+    uint16_t pad;
+    uint32_t vcpu;                      /* IN: get_vcpu */
+    XEN_GUEST_HANDLE_64(uint64) buckets;/* OUT: get_{p,v}cpu */
+};
+typedef struct xen_sysctl_sched_stats_op xen_sysctl_sched_stats_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_sched_stats_op_t);
+
 
 struct xen_sysctl {
     uint32_t cmd;
@@ -658,6 +725,7 @@ struct xen_sysctl {
 #define XEN_SYSCTL_cpupool_op                    18
 #define XEN_SYSCTL_scheduler_op                  19
 #define XEN_SYSCTL_coverage_op                   20
+#define XEN_SYSCTL_sched_stats_op                21
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -679,6 +747,7 @@ struct xen_sysctl {
         struct xen_sysctl_cpupool_op        cpupool_op;
         struct xen_sysctl_scheduler_op      scheduler_op;
         struct xen_sysctl_coverage_op       coverage_op;
+        struct xen_sysctl_sched_stats_op    sched_stats_op;
         uint8_t                             pad[128];
     } u;
 };
@@ -39,8 +39,10 @@
 #define TRC_PV       0x0020f000    /* Xen PV traces            */
 #define TRC_SHADOW   0x0040f000    /* Xen shadow tracing       */
 #define TRC_HW       0x0080f000    /* Xen hardware-related traces */
+#define TRC_ARM      0x0100f000    /* Xen ARM traces           */
 #define TRC_GUEST    0x0800f000    /* Guest-generated traces   */
 #define TRC_ALL      0x0ffff000
+#define TRC_NR_CLASSES 12          /* Class bits, from TRC_CLS_SHIFT */
 #define TRC_HD_TO_EVENT(x) ((x)&0x0fffffff)
 #define TRC_HD_CYCLE_FLAG (1UL<<31)
 #define TRC_HD_INCLUDES_CYCLE_COUNT(x) ( !!( (x) & TRC_HD_CYCLE_FLAG ) )
@@ -88,6 +90,10 @@
 #define TRC_HW_PM           0x00801000   /* Power management traces */
 #define TRC_HW_IRQ          0x00802000   /* Traces relating to the handling of IRQs */
 
+/* Trace subclasses for ARM */
+#define TRC_ARM_GIC         0x01001000   /* Injection and list registers */
+#define TRC_ARM_VGIC        0x01002000   /* vGIC register emulation */
+
 /* Trace events per class */
 #define TRC_LOST_RECORDS        (TRC_GEN + 1)
 #define TRC_TRACE_WRAP_BUFFER  (TRC_GEN + 2)
@@ -167,6 +173,31 @@
 #define TRC_PV_HYPERCALL_V2_ARG_64(i) (0x2 << (20 + 2*(i)))
 #define TRC_PV_HYPERCALL_V2_ARG_MASK  (0xfff00000)
 
+/*
+ * GIC and vGIC events.  dv is (domid << 16) | vcpu_id.
+ *
+ * TRC_GIC_INJECT        dv, virq
+ * TRC_GIC_LR_SET        lr, virq, state (GICH_LR_PENDING/ACTIVE)
+ * TRC_GIC_LR_CLEAR      lr, virq
+ * TRC_GIC_LR_PENDING    dv, virq: every LR of the running vcpu in use,
+ *                       queued on lr_pending
+ * TRC_GIC_LR_EVICT      lr, evicted virq, new virq
+ * TRC_GIC_MAINTENANCE   (none)
+ * TRC_VGIC_*            register offset, value (low 32 bits),
+ *                       (handled << 8) | access size, emulation time (ns)
+ */
+#define TRC_GIC_INJECT          (TRC_ARM_GIC + 1)
+#define TRC_GIC_LR_SET          (TRC_ARM_GIC + 2)
+#define TRC_GIC_LR_CLEAR        (TRC_ARM_GIC + 3)
+#define TRC_GIC_LR_PENDING      (TRC_ARM_GIC + 4)
+#define TRC_GIC_LR_EVICT        (TRC_ARM_GIC + 5)
+#define TRC_GIC_MAINTENANCE     (TRC_ARM_GIC + 6)
+
+#define TRC_VGIC_DIST_READ      (TRC_ARM_VGIC + 1)
+#define TRC_VGIC_DIST_WRITE     (TRC_ARM_VGIC + 2)
+#define TRC_VGIC_RDIST_READ     (TRC_ARM_VGIC + 3)
+#define TRC_VGIC_RDIST_WRITE    (TRC_ARM_VGIC + 4)
+
 #define TRC_SHADOW_NOT_SHADOW                 (TRC_SHADOW +  1)
 #define TRC_SHADOW_FAST_PROPAGATE             (TRC_SHADOW +  2)
 #define TRC_SHADOW_FAST_MMIO                  (TRC_SHADOW +  3)
@@ -22,6 +22,9 @@
 
 #define NR_MEM_BANKS 8
 
+/* Entries in a numa-distance-map-v1 distance-matrix. */
+#define NR_NUMA_DISTANCES 64
+
 #define MOD_XEN    0
 #define MOD_FDT    1
 #define MOD_KERNEL 2
@@ -34,6 +37,7 @@
 struct membank {
     paddr_t start;
     paddr_t size;
+    int nid;            /* numa-node-id, or -1 if none given */
 };
 
 struct dt_mem_info {
@@ -53,9 +57,19 @@ struct dt_module_info {
     struct dt_mb_module module[NR_MODULES];
 };
 
+struct dt_numa_distance {
+    u32 from, to, distance;
+};
+
+struct dt_numa_info {
+    int nr_distances;
+    struct dt_numa_distance distance[NR_NUMA_DISTANCES];
+};
+
 struct dt_early_info {
     struct dt_mem_info mem;
     struct dt_module_info modules;
+    struct dt_numa_info numa;
 };
 
 /*
@@ -83,15 +83,19 @@ void notify_via_xen_event_channel(struct domain *ld, int lport);
 #define bucket_from_port(d, p) \
     ((group_from_port(d, p))[((p) % EVTCHNS_PER_GROUP) / EVTCHNS_PER_BUCKET])
 
+/*
+ * Buckets are only ever added (in port order) while the domain is
+ * alive and are not freed until it is destroyed, so a port may be
+ * checked and looked up without holding d->event_lock.
+ */
 static inline bool_t port_is_valid(struct domain *d, unsigned int p)
 {
     if ( p >= d->max_evtchns )
         return 0;
-    if ( !d->evtchn )
+    if ( p >= read_atomic(&d->valid_evtchns) )
         return 0;
-    if ( p < EVTCHNS_PER_BUCKET )
-        return 1;
-    return group_from_port(d, p) != NULL && bucket_from_port(d, p) != NULL;
+    smp_rmb(); /* read valid_evtchns /then/ the bucket pointers */
+    return 1;
 }
 
 static inline struct evtchn *evtchn_from_port(struct domain *d, unsigned int p)
@@ -126,6 +130,21 @@ static inline struct evtchn *evtchn_from_port(struct domain *d, unsigned int p)
 
 void evtchn_check_pollers(struct domain *d, unsigned int port);
 
+void evtchn_moderate_notify(struct vcpu *v, struct evtchn *evtchn);
+
+/*
+ * Raise an upcall on @v for a newly pending event on @evtchn.  Used by
+ * the port ops in place of vcpu_mark_events_pending() so that any
+ * moderation configured on the port is honoured.
+ */
+static inline void evtchn_port_notify(struct vcpu *v, struct evtchn *evtchn)
+{
+    if ( likely(!evtchn->moderation) )
+        vcpu_mark_events_pending(v);
+    else
+        evtchn_moderate_notify(v, evtchn);
+}
+
 void evtchn_2l_init(struct domain *d);
 
 /*
@@ -12,6 +12,8 @@ PERFCOUNTER(calls_from_multicall,       "calls from multicall")
 PERFCOUNTER(irqs,                   "#interrupts")
 PERFCOUNTER(ipis,                   "#IPIs")
 
+PERFCOUNTER(timer_wheel_cascade,    "timer wheel slots cascaded")
+
 /* Generic scheduler counters (applicable to all schedulers) */
 PERFCOUNTER(sched_irq,              "sched: timer")
 PERFCOUNTER(sched_run,              "sched: runs through scheduler")
@@ -53,4 +55,7 @@ PERFCOUNTER(vcpu_hot,               "csched: vcpu_hot")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+PERFCOUNTER(gnttab_copy_claim,      "gnttab: copy frames acquired")
+PERFCOUNTER(gnttab_copy_reuse,      "gnttab: copy frames reused")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -60,6 +60,9 @@ struct rcu_head {
 int rcu_pending(int cpu);
 int rcu_needs_cpu(int cpu);
 
+void rcu_idle_enter(unsigned int cpu);
+void rcu_idle_exit(unsigned int cpu);
+
 /*
  * Dummy lock type for passing to rcu_read_{lock,unlock}. Currently exists
  * only to document the reason for rcu_read_lock() critical sections.
@@ -144,6 +147,8 @@ void rcu_check_callbacks(int cpu);
 /* Exported interfaces */
 void call_rcu(struct rcu_head *head, 
               void (*func)(struct rcu_head *head));
+void call_rcu_expedited(struct rcu_head *head,
+                        void (*func)(struct rcu_head *head));
 
 int rcu_barrier(void);
 
@@ -13,10 +13,12 @@
 #include <xen/types.h>
 #include <xen/list.h>
 #include <xen/percpu.h>
+#include <xen/spinlock.h>
 
 struct tasklet
 {
     struct list_head list;
+    spinlock_t lock;            /* Protects all fields except func/data. */
     int scheduled_on;
     bool_t is_softirq;
     bool_t is_running;
@@ -27,7 +29,8 @@ struct tasklet
 
 #define _DECLARE_TASKLET(name, func, data, softirq)                     \
     struct tasklet name = {                                             \
-        LIST_HEAD_INIT(name.list), -1, softirq, 0, 0, func, data }
+        LIST_HEAD_INIT(name.list), SPIN_LOCK_UNLOCKED, -1, softirq,     \
+        0, 0, func, data }
 #define DECLARE_TASKLET(name, func, data)               \
     _DECLARE_TASKLET(name, func, data, 0)
 #define DECLARE_SOFTIRQ_TASKLET(name, func, data)       \
@@ -742,6 +742,7 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__GETSCHEDULER);
 
     case XEN_SYSCTL_perfc_op:
+    case XEN_SYSCTL_sched_stats_op:
         return domain_has_xen(current->domain, XEN__PERFCONTROL);
 
     case XEN_SYSCTL_debug_keys: